@@ -0,0 +1,126 @@
+// Decode benchmark: DspReader::LoadInto over every .dsp of a library, one file at a time on one
+// thread, with the OS cache warm. Reports the best of N runs per file and in total, then decodes
+// everything again through the scalar kernels (std::exp) and reports how far the vector exp
+// moves the values.
+//
+//   decode_bench [library root] [runs]
+//
+// Without a root it writes a synthetic library (v1 and v2 files) to the temp directory.
+
+#include "dsp_library.h"
+#include "dsp_reader.h"
+#include "simd_kernels.h"
+#include "synthetic_library.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+double Seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Best of 'runs' LoadInto calls on 'path'
+double TimeLoad(const std::string& path, int runs, DspData& data) {
+    double best = 1e30;
+    for (int r = 0; r < runs; ++r) {
+        const auto start = std::chrono::steady_clock::now();
+        DspReader::LoadInto(path, data);
+        best = std::min(best, Seconds(start));
+    }
+    return best;
+}
+
+std::string WriteSynthetic() {
+    std::mt19937 rng(17);
+    std::vector<std::vector<double>> v1, v2;
+    for (int s = 0; s < 60; ++s) {
+        auto& target = (s % 2) ? v2 : v1;
+        target.push_back(SyntheticLibrary::RandomWalk(2000 + (rng() % 30000), rng));
+    }
+    const std::string root = SyntheticLibrary::Write("rel2_decode_bench", v1, 1);
+    SyntheticLibrary::Write("rel2_decode_bench/v2", v2, 2);
+    return root;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const bool synthetic = argc < 2;
+    const std::string root = synthetic ? WriteSynthetic() : argv[1];
+    const int runs = argc > 2 ? std::max(1, std::atoi(argv[2])) : 5;
+
+    const std::vector<DspFileEntry> entries = DspLibrary::Scan(root);
+    if (entries.empty()) {
+        std::printf("No .dsp files under %s\n", root.c_str());
+        return 1;
+    }
+    std::printf("%zu files under %s, best of %d runs, %s kernels\n\n", entries.size(), root.c_str(), runs,
+                SimdKernels::Name(SimdKernels::Active()));
+    std::printf("%-40s %10s %9s %10s %9s\n", "file", "points", "ms", "MB/s in", "GB/s out");
+
+    DspData data;
+    double total = 0.0;
+    unsigned long long points = 0, fileBytes = 0;
+    std::vector<std::string> decoded; // Files that decoded, for the scalar pass
+    for (const DspFileEntry& entry : entries) {
+        try {
+            DspReader::LoadInto(entry.fullPath, data); // Warms the OS cache and the scratch buffers
+        } catch (const std::exception& e) {
+            std::printf("%-40s failed: %s\n", entry.displayName.c_str(), e.what());
+            continue;
+        }
+        const double seconds = TimeLoad(entry.fullPath, runs, data);
+        const unsigned long long bytes = std::filesystem::file_size(std::filesystem::u8path(entry.fullPath));
+        const size_t n = data.values.size();
+        std::printf("%-40.40s %10zu %9.3f %10.1f %9.2f\n", entry.displayName.c_str(), n, seconds * 1e3,
+                    bytes / 1e6 / seconds, n * sizeof(double) / 1e9 / seconds);
+        total += seconds;
+        points += n;
+        fileBytes += bytes;
+        decoded.push_back(entry.fullPath);
+    }
+    std::printf("\nTotal: %llu points, %.1f MB of files in %.2f ms: %.1f MB/s in, %.2f GB/s out, %.1f ns per point\n",
+                points, fileBytes / 1e6, total * 1e3, fileBytes / 1e6 / total, points * sizeof(double) / 1e9 / total,
+                total * 1e9 / static_cast<double>(points));
+
+    // The same files through std::exp. Values are T * (exp(x) - 1), so deviations are measured in
+    // units of eps * |T| * max(1, exp(x)), the rounding that formula carries on either path.
+    const SimdIsa active = SimdKernels::Active();
+    double scalarTotal = 0.0;
+    double worstUlps = 0.0, worstAbs = 0.0;
+    unsigned long long differing = 0;
+    DspData reference;
+    for (const std::string& path : decoded) {
+        SimdKernels::SetActive(active);
+        DspReader::LoadInto(path, data);
+        SimdKernels::SetActive(SimdIsa::Scalar);
+        scalarTotal += TimeLoad(path, runs, reference);
+
+        const double T = reference.total_investment;
+        for (size_t i = 0; i < reference.values.size(); ++i) {
+            const double diff = std::fabs(data.values[i] - reference.values[i]);
+            if (diff == 0.0) continue;
+            ++differing;
+            worstAbs = std::max(worstAbs, diff);
+            if (std::fabs(T) >= 1e-9) {
+                const double e = std::max(1.0, reference.values[i] / T + 1.0);
+                worstUlps = std::max(worstUlps, diff / (std::fabs(T) * e * std::ldexp(1.0, -52)));
+            }
+        }
+    }
+    SimdKernels::SetActive(active);
+    std::printf("Scalar kernels (std::exp): %.2f ms, %.2fx the time\n", scalarTotal * 1e3, scalarTotal / total);
+    std::printf("Values that differ from the std::exp path: %llu of %llu, max %.3g eps*|T|*max(1, exp(x)) (max |diff| %.3g)\n",
+                differing, points, worstUlps, worstAbs);
+
+    if (synthetic) std::filesystem::remove_all(root);
+    return 0;
+}
@@ -0,0 +1,104 @@
+// Float32 benchmark: the same queries through SearchMode::Rolling (double) and SearchMode::Float32,
+// reporting the time of each and every place the two Top K lists disagree.
+//
+//   float32_bench [library root] [queries] [lazy budget MB]
+//
+// Without a root it writes a synthetic library to the temp directory. Queries are random walks of
+// 64 to 1000 points, with 1 and 3 matches per stock; a lazy budget of 0 (the default) loads eagerly.
+
+#include "analysis_engine.h"
+#include "simd_kernels.h"
+#include "synthetic_library.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+double Milliseconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+std::string WriteSynthetic() {
+    std::mt19937 rng(29);
+    std::vector<std::vector<double>> series;
+    for (int s = 0; s < 150; ++s) series.push_back(SyntheticLibrary::RandomWalk(400 + rng() % 15000, rng));
+    return SyntheticLibrary::Write("rel2_float32_bench", series);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const bool synthetic = argc < 2 || std::strcmp(argv[1], "-") == 0;
+    const std::string root = synthetic ? WriteSynthetic() : argv[1];
+    const int queries = argc > 2 ? std::max(1, std::atoi(argv[2])) : 15;
+    const size_t budgetMB = argc > 3 ? static_cast<size_t>(std::atoll(argv[3])) : 0;
+
+    AnalysisEngine& engine = AnalysisEngine::GetInstance();
+    engine.SetResultCacheSize(0); // Every query is timed, not answered from the cache
+    engine.EnableFloat32(true);
+    const size_t stocks = budgetMB ? engine.LoadLibraryLazy(root, budgetMB << 20) : engine.LoadLibrary(root);
+    if (stocks == 0) {
+        std::printf("No stocks under %s\n", root.c_str());
+        return 1;
+    }
+
+    std::mt19937 rng(11);
+    std::normal_distribution<double> step(0.0, 1.0);
+    const int sizes[] = { 64, 100, 300, 500, 1000 };
+    double rollingMs = 0.0, float32Ms = 0.0;
+    int results = 0, rankDisagreements = 0, valueDisagreements = 0, lengthDisagreements = 0;
+    std::printf("%-6s %6s %4s %12s %12s %8s %8s\n", "query", "points", "N", "Rolling ms", "Float32 ms", "results", "differ");
+    for (int q = 0; q < queries; ++q) {
+        std::vector<double> query(sizes[q % 5]);
+        double price = 100.0;
+        for (double& v : query) v = (price += step(rng));
+        SearchOptions options;
+        options.matchesPerStock = (q % 3 == 2) ? 3 : 1;
+        options.minPearson = (q % 2) ? 0.7 : 0.5;
+
+        options.mode = SearchMode::Rolling;
+        auto start = std::chrono::steady_clock::now();
+        const std::vector<SearchResult> exact = engine.Search(query, true, 35, 10, options);
+        const double rolling = Milliseconds(start);
+
+        options.mode = SearchMode::Float32;
+        start = std::chrono::steady_clock::now();
+        const std::vector<SearchResult> fast = engine.Search(query, true, 35, 10, options);
+        const double float32 = Milliseconds(start);
+
+        // Rank: a different match at a position; value: the same match with a different Pearson
+        int differ = 0;
+        if (exact.size() != fast.size()) ++lengthDisagreements;
+        for (size_t i = 0; i < exact.size() && i < fast.size(); ++i) {
+            const bool sameMatch = exact[i].stockId == fast[i].stockId && exact[i].offset == fast[i].offset &&
+                                   exact[i].scale == fast[i].scale;
+            if (!sameMatch) {
+                ++rankDisagreements;
+                ++differ;
+            } else if (std::memcmp(&exact[i].pearson, &fast[i].pearson, sizeof(double)) != 0) {
+                ++valueDisagreements;
+                ++differ;
+            }
+        }
+        std::printf("%-6d %6zu %4d %12.1f %12.1f %8zu %8d\n", q, query.size(), options.matchesPerStock, rolling, float32,
+                    exact.size(), differ);
+        rollingMs += rolling;
+        float32Ms += float32;
+        results += static_cast<int>(exact.size());
+    }
+
+    std::printf("\n%zu stocks (%s), %s kernels, %d queries\n", stocks, budgetMB ? "lazy" : "eager",
+                SimdKernels::Name(SimdKernels::Active()), queries);
+    std::printf("Rolling %.0f ms, Float32 %.0f ms: %.2fx\n", rollingMs, float32Ms, rollingMs / float32Ms);
+    std::printf("%d results: %d rank disagreements, %d value disagreements, %d lists of different length\n", results,
+                rankDisagreements, valueDisagreements, lengthDisagreements);
+
+    if (synthetic) std::filesystem::remove_all(root);
+    return (rankDisagreements || valueDisagreements || lengthDisagreements) ? 1 : 0;
+}
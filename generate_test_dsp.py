@@ -23,13 +23,13 @@ def _int_to_sleb128_reg(val):
     return result
 
 
-def save_compressed(file_path, normalized_y_values, total_investment, smooth_value):
-    # Step 1: Scale to 8 decimal points and split into two parts
-    scaled_8 = np.round(normalized_y_values * 1e8).astype(np.int64)
+def _compress_split8(scaled_8, cctx):
+    """Split8 + delta + SLEB128 + zstd of a run of scaled values: (frame1, frame2)."""
+    # Split into two parts
     first_part = (scaled_8 // 10000).astype(np.int64)
     second_part = (scaled_8 % 10000).astype(np.int64)
     
-    # Step 2: Delta encoding
+    # Delta encoding (the first delta is the absolute value, so every run decodes on its own)
     deltas1 = np.empty_like(first_part)
     deltas1[0] = first_part[0]
     deltas1[1:] = first_part[1:] - first_part[:-1]
@@ -38,7 +38,7 @@ def save_compressed(file_path, normalized_y_values, total_investment, smooth_val
     deltas2[0] = second_part[0]
     deltas2[1:] = second_part[1:] - second_part[:-1]
     
-    # Step 3: Signed LEB128 encoding
+    # Signed LEB128 encoding
     encoded_bytes1 = bytearray()
     for delta in deltas1:
         encoded_bytes1.extend(_int_to_sleb128_reg(delta))
@@ -47,10 +47,23 @@ def save_compressed(file_path, normalized_y_values, total_investment, smooth_val
     for delta in deltas2:
         encoded_bytes2.extend(_int_to_sleb128_reg(delta))
     
-    # Step 4: Zstandard compression
+    # Zstandard compression
+    return cctx.compress(encoded_bytes1), cctx.compress(encoded_bytes2)
+
+
+def _length_prefixed(*frames):
+    out = bytearray()
+    for frame in frames:
+        out += len(frame).to_bytes(4, 'big')
+        out += frame
+    return out
+
+
+def save_compressed(file_path, normalized_y_values, total_investment, smooth_value):
+    # Scale to 8 decimal points, then split8 + delta + leb128 + zstd over the whole series
+    scaled_8 = np.round(normalized_y_values * 1e8).astype(np.int64)
     cctx = zstd.ZstdCompressor(level=22)
-    compressed1 = cctx.compress(encoded_bytes1)
-    compressed2 = cctx.compress(encoded_bytes2)
+    compressed1, compressed2 = _compress_split8(scaled_8, cctx)
     
     metadata = {
         "total_investment": total_investment,
@@ -64,10 +77,58 @@ def save_compressed(file_path, normalized_y_values, total_investment, smooth_val
         meta_json = json.dumps(metadata).encode('utf-8')
         f.write(len(meta_json).to_bytes(4, 'big'))
         f.write(meta_json)
-        f.write(len(compressed1).to_bytes(4, 'big'))
-        f.write(compressed1)
-        f.write(len(compressed2).to_bytes(4, 'big'))
-        f.write(compressed2)
+        f.write(_length_prefixed(compressed1, compressed2))
+
+
+def save_compressed_v2(file_path, normalized_y_values, total_investment, smooth_value, block_size=4096):
+    """Block-indexed .dsp (version 2).
+
+    Same encoding as save_compressed, but every block_size points are compressed on their own.
+    The metadata carries a block index (start, count, byte offset and size after the metadata)
+    with min/max/mean/std of each block's decoded values, so readers can fetch any window
+    without decompressing the rest of the file.
+    """
+    scaled_8 = np.round(normalized_y_values * 1e8).astype(np.int64)
+    # Values as DspReader returns them: T * (exp(y) - 1), or y itself for zero investment
+    decoded = scaled_8 / 1e8
+    if abs(total_investment) >= 1e-9:
+        decoded = total_investment * np.expm1(decoded)
+
+    cctx = zstd.ZstdCompressor(level=22)
+    body = bytearray()
+    blocks = []
+    for start in range(0, len(scaled_8), block_size):
+        stop = min(start + block_size, len(scaled_8))
+        frames = _length_prefixed(*_compress_split8(scaled_8[start:stop], cctx))
+        values = decoded[start:stop]
+        blocks.append({
+            "start": start,
+            "count": stop - start,
+            "offset": len(body),
+            "size": len(frames),
+            "min": float(values.min()),
+            "max": float(values.max()),
+            "mean": float(values.mean()),
+            "std": float(values.std()),
+        })
+        body += frames
+
+    metadata = {
+        "total_investment": total_investment,
+        "smooth_value": smooth_value,
+        "n": len(scaled_8),
+        "format": "delta+leb128+zstd+split8",
+        "version": 2,
+        "block_size": block_size,
+        "blocks": blocks,
+    }
+
+    print(f"Saving to {file_path}")
+    with open(file_path, 'wb') as f:
+        meta_json = json.dumps(metadata).encode('utf-8')
+        f.write(len(meta_json).to_bytes(4, 'big'))
+        f.write(meta_json)
+        f.write(body)
 
 if __name__ == "__main__":
     # Generate dummy datum
@@ -82,4 +143,5 @@ if __name__ == "__main__":
     
     file_name = "test_signal.dsp"
     save_compressed(file_name, log_vals, T, 5)
+    save_compressed_v2("test_signal_v2.dsp", log_vals, T, 5, block_size=256)
     print("Done.")
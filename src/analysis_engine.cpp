@@ -1,12 +1,299 @@
 #include "analysis_engine.h"
 #include "dsp_library.h"
+#include "library_snapshot.h"
+#include "mapped_file.h"
+#include "result_cache.h"
+#include "sax_index.h"
+#include "search_common.h"
+#include "simd_kernels.h"
+#include "stock_cache.h"
 #include <iostream>
+#include <atomic>
+#include <chrono>
+#include <mutex>
 #include <algorithm>
 #include <cmath>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
 #include <omp.h>
 
 // ... (Previous content)
 
+namespace {
+
+// Every StockName ever interned; entries are never freed, see StockName
+struct NameRegistry {
+    std::mutex mutex;
+    std::unordered_map<std::string, std::unique_ptr<StockName>> byPath;
+    std::vector<const StockName*> byId; // Index id - 1; id 0 means no name
+};
+
+NameRegistry& Names() {
+    static NameRegistry registry;
+    return registry;
+}
+
+const std::string& NoName() {
+    static const std::string empty;
+    return empty;
+}
+
+// Arrays start on cache-line boundaries, as in a snapshot
+constexpr size_t kArenaAlignment = 64;
+constexpr size_t kAlignedDoubles = kArenaAlignment / sizeof(double);
+
+size_t AlignDoubles(size_t count) {
+    return (count + kAlignedDoubles - 1) & ~(kAlignedDoubles - 1);
+}
+
+size_t AlignFloats(size_t count) {
+    const size_t perLine = kArenaAlignment / sizeof(float);
+    return (count + perLine - 1) & ~(perLine - 1);
+}
+
+// One 64-byte-aligned allocation holding the arrays of many stocks
+class StockArena {
+public:
+    explicit StockArena(size_t bytes)
+        : m_Data(::operator new(std::max<size_t>(bytes, 1), std::align_val_t(kArenaAlignment))) {}
+    ~StockArena() { ::operator delete(m_Data, std::align_val_t(kArenaAlignment)); }
+    StockArena(const StockArena&) = delete;
+    StockArena& operator=(const StockArena&) = delete;
+
+    template <typename T>
+    T* As() const { return static_cast<T*>(m_Data); }
+
+private:
+    void* m_Data;
+};
+
+// Gives every stock in 'stocks' that has data but no float copy one, in a shared arena
+void AttachFloat32(CachedStock* stocks, size_t count) {
+    std::vector<size_t> slots(count, 0);
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i) {
+        slots[i] = total;
+        if (!stocks[i].pyramid32 && stocks[i].pyramid.ptr) total += AlignFloats(stocks[i].PyramidSize());
+    }
+    if (total == 0) return;
+    auto arena = std::make_shared<StockArena>(total * sizeof(float));
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < static_cast<int>(count); ++i) {
+        CachedStock& stock = stocks[i];
+        if (stock.pyramid32 || !stock.pyramid.ptr) continue;
+        float* out = arena->As<float>() + slots[i];
+        for (int level = 0; level < stock.LevelCount(); ++level) {
+            SeriesView view = stock.Level(level);
+            const double shift = stock.levelShift[level];
+            float* levelOut = out + stock.levelOffsets[level];
+            for (size_t k = 0; k < view.size(); ++k) levelOut[k] = static_cast<float>(view[k] - shift);
+        }
+        stock.pyramid32 = out;
+        stock.storage32 = arena;
+    }
+}
+
+// Gives every stock in 'stocks' that has data but no DFT features the features of its windows of
+// 'window' points, in a shared arena. Each level runs a sliding DFT over x - shift,
+//   X_f(j + 1) = (X_f(j) - x[j] + x[j + m]) * e^(2 pi i f / m),
+// restarted from a direct sum every kDftResync windows. Coefficients from 1 up do not see the
+// window mean, so z-normalizing only divides them by the window's std. Where the slide's rounding
+// could reach a quarter of DftFeatureTolerance (a std tiny next to the level's range), the window
+// is summed directly from its z-normalized points instead.
+void AttachDft(CachedStock* stocks, size_t count, size_t window) {
+    constexpr int K = CachedStock::kDftCoefficients;
+    constexpr int kDftResync = 64;
+    const size_t m = window;
+    if (m <= 2 * K) return; // Coefficients f and m - f must differ for the bound
+
+    std::vector<size_t> slots(count, 0);
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i) {
+        slots[i] = total;
+        if (!stocks[i].dftFeatures && stocks[i].pyramid.ptr) total += AlignFloats(2 * K * stocks[i].PyramidSize());
+    }
+    if (total == 0) return;
+    auto arena = std::make_shared<StockArena>(total * sizeof(float));
+
+    // e^(-2 pi i t / m), and the per-step rotations e^(2 pi i f / m)
+    const double twoPi = 2.0 * std::acos(-1.0);
+    std::vector<double> cosT(m), sinT(m);
+    for (size_t t = 0; t < m; ++t) {
+        cosT[t] = std::cos(twoPi * t / m);
+        sinT[t] = -std::sin(twoPi * t / m);
+    }
+    double rotCos[K], rotSin[K];
+    for (int f = 0; f < K; ++f) {
+        rotCos[f] = cosT[f + 1];
+        rotSin[f] = -sinT[f + 1];
+    }
+    // Rounding of a slide from its last direct sum, per unit of the level's largest |x - shift|,
+    // against the part of the tolerance it may use
+    const double driftPerUnit = (kDftResync + static_cast<double>(m)) * static_cast<double>(m) * std::ldexp(1.0, -50);
+    const double allowed = 0.25 * DftFeatureTolerance(m);
+    const float flat = std::numeric_limits<float>::quiet_NaN();
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < static_cast<int>(count); ++i) {
+        CachedStock& stock = stocks[i];
+        if (stock.dftFeatures || !stock.pyramid.ptr) continue;
+        float* out = arena->As<float>() + slots[i];
+        for (int level = 0; level < stock.LevelCount(); ++level) {
+            SeriesView view = stock.Level(level);
+            if (view.size() < m) continue;
+            const LevelStats stats = stock.Stats(level);
+            const double shift = stats.shift;
+            const double* x = view.data();
+            float* levelOut = out + 2 * K * stock.levelOffsets[level];
+
+            double range = 0.0;
+            for (double v : view) range = std::max(range, std::abs(v - shift));
+            const double drift = driftPerUnit * range;
+
+            double re[K], im[K];
+            auto directSum = [&](size_t j, double mean, double scale) {
+                for (int f = 0; f < K; ++f) {
+                    re[f] = im[f] = 0.0;
+                    for (size_t t = 0; t < m; ++t) {
+                        const size_t idx = ((f + 1) * t) % m;
+                        const double v = (x[j + t] - mean) * scale;
+                        re[f] += v * cosT[idx];
+                        im[f] += v * sinT[idx];
+                    }
+                }
+            };
+
+            const size_t windows = view.size() - m + 1;
+            for (size_t j = 0; j < windows; ++j) {
+                if (j % kDftResync == 0) {
+                    directSum(j, shift, 1.0);
+                } else {
+                    const double delta = x[j + m - 1] - x[j - 1];
+                    for (int f = 0; f < K; ++f) {
+                        const double r = re[f] + delta;
+                        re[f] = r * rotCos[f] - im[f] * rotSin[f];
+                        im[f] = r * rotSin[f] + im[f] * rotCos[f];
+                    }
+                }
+
+                float* o = levelOut + 2 * K * j;
+                double mean, ssx;
+                stats.Window(j, m, mean, ssx);
+                if (ssx == 0.0) {
+                    std::fill(o, o + 2 * K, flat);
+                    continue;
+                }
+                const double inv = 1.0 / std::sqrt(ssx / static_cast<double>(m));
+                if (drift * inv > allowed) {
+                    // Sum this one z-normalized; the slide carries on from the raw sums
+                    double slideRe[K], slideIm[K];
+                    std::copy(re, re + K, slideRe);
+                    std::copy(im, im + K, slideIm);
+                    directSum(j, mean, inv);
+                    for (int f = 0; f < K; ++f) {
+                        o[2 * f] = static_cast<float>(re[f]);
+                        o[2 * f + 1] = static_cast<float>(im[f]);
+                    }
+                    std::copy(slideRe, slideRe + K, re);
+                    std::copy(slideIm, slideIm + K, im);
+                    continue;
+                }
+                for (int f = 0; f < K; ++f) {
+                    o[2 * f] = static_cast<float>(re[f] * inv);
+                    o[2 * f + 1] = static_cast<float>(im[f] * inv);
+                }
+            }
+        }
+        stock.dftFeatures = out;
+        stock.dftWindow = m;
+        stock.storageDft = arena;
+    }
+}
+
+} // namespace
+
+const std::string& CachedStock::Symbol() const {
+    return name ? name->symbol : NoName();
+}
+
+const std::string& CachedStock::FullPath() const {
+    return name ? name->fullPath : NoName();
+}
+
+const StockName* AnalysisEngine::InternName(const std::string& fullPath, const std::string& symbol) {
+    NameRegistry& names = Names();
+    std::lock_guard<std::mutex> lock(names.mutex);
+    std::unique_ptr<StockName>& entry = names.byPath[fullPath];
+    if (!entry) {
+        entry = std::make_unique<StockName>();
+        entry->id = static_cast<uint32_t>(names.byId.size() + 1);
+        entry->symbol = symbol;
+        entry->fullPath = fullPath;
+        names.byId.push_back(entry.get());
+    }
+    return entry.get();
+}
+
+const StockName* AnalysisEngine::FindName(uint32_t id) {
+    NameRegistry& names = Names();
+    std::lock_guard<std::mutex> lock(names.mutex);
+    return id > 0 && id <= names.byId.size() ? names.byId[id - 1] : nullptr;
+}
+
+size_t CachedStock::LevelSize(int level) const {
+    if (level < 0 || level >= LevelCount()) return 0;
+    return levelOffsets[level + 1] - levelOffsets[level];
+}
+
+SeriesView CachedStock::Level(int level) const {
+    SeriesView view;
+    if (level < 0 || level >= LevelCount()) return view;
+    view.ptr = pyramid.data() + levelOffsets[level];
+    view.length = levelOffsets[level + 1] - levelOffsets[level];
+    return view;
+}
+
+SeriesView CachedStock::AtScale(int scale) const {
+    int level = 0;
+    while ((1 << level) < scale) ++level;
+    if ((1 << level) != scale) return SeriesView();
+    return Level(level);
+}
+
+const float* CachedStock::Level32(int level) const {
+    if (level < 0 || level >= LevelCount() || !pyramid32) return nullptr;
+    return pyramid32 + levelOffsets[level];
+}
+
+const float* CachedStock::LevelDft(int level) const {
+    if (level < 0 || level >= LevelCount() || !dftFeatures) return nullptr;
+    return dftFeatures + 2 * kDftCoefficients * levelOffsets[level];
+}
+
+LevelStats CachedStock::Stats(int level) const {
+    LevelStats stats;
+    if (level < 0 || level >= LevelCount() || !prefixSum) return stats;
+    size_t start = levelOffsets[level] + static_cast<size_t>(level);
+    stats.prefixSum = prefixSum + start;
+    stats.prefixSumSq = prefixSumSq + start;
+    stats.shift = levelShift[level];
+    return stats;
+}
+
+// Centered window energy below this fraction of the shifted raw energy is rounding noise
+static constexpr double kFlatTolerance = 1e-12;
+
+void LevelStats::Window(size_t offset, size_t length, double& mean, double& centeredSumSq) const {
+    double s1 = prefixSum[offset + length] - prefixSum[offset];
+    double s2 = prefixSumSq[offset + length] - prefixSumSq[offset];
+    double n = static_cast<double>(length);
+    mean = shift + s1 / n;
+    centeredSumSq = s2 - s1 * s1 / n;
+    if (centeredSumSq <= kFlatTolerance * s2) centeredSumSq = 0.0;
+}
+
 // Helper for "Fred" filter
 static bool ContainsFred(const std::string& path) {
     std::string lower = path;
@@ -14,38 +301,386 @@ static bool ContainsFred(const std::string& path) {
     return lower.find("fred") != std::string::npos;
 }
 
-size_t AnalysisEngine::LoadLibrary(const std::string& rootPath) {
-    if (m_Loaded) return m_Cache.size();
+// Shorter series are not worth searching
+static constexpr size_t kMinSeriesLength = 400;
 
-    std::vector<DspFileEntry> entries = DspLibrary::Scan(rootPath);
-    std::cout << "AnalysisEngine: Scanned " << entries.size() << " candidates." << std::endl;
+// Decodes the series behind a lazy header into a full stock
+static std::shared_ptr<const CachedStock> DecodeStock(const CachedStock& header, bool float32, size_t dftWindow) {
+    thread_local DspData data; // Decode buffer reused across files
+    DspReader::LoadInto(header.FullPath(), data);
 
-    m_Cache.reserve(entries.size());
-    std::mutex cacheMutex;
+    auto stock = std::make_shared<CachedStock>(header);
+    AnalysisEngine::BuildStock(data.values, *stock);
+    if (float32) AttachFloat32(stock.get(), 1);
+    if (dftWindow > 0) AttachDft(stock.get(), 1, dftWindow);
+
+    // Searches plan their work from the header layout; a file rewritten since the scan no longer fits it
+    if (stock->levelOffsets != header.levelOffsets) return nullptr;
+    return stock;
+}
+
+// Reads 'entries' in parallel (headersOnly: just their metadata). Eager loads decode in a
+// second pass straight into one arena sized from the headers, in entry order, so the stocks
+// of a load sit back to back in memory (a refresh that replaces some of them keeps their old
+// slots until the arena's last stock goes). Every file that can be stamped gets a manifest
+// entry, even if it is too short to become a stock, so a refresh does not retry it until it changes.
+static void LoadEntries(const std::vector<DspFileEntry>& entries, bool headersOnly,
+                        std::vector<CachedStock>& stocks, std::vector<DspFileStamp>& manifest) {
+    const int count = static_cast<int>(entries.size());
+    std::vector<DspFileStamp> stamps(entries.size());
+    std::vector<char> stamped(entries.size(), 0);
+    std::vector<CachedStock> found(entries.size()); // No levels: not a stock
 
     #pragma omp parallel for schedule(dynamic)
-    for (int i = 0; i < static_cast<int>(entries.size()); ++i) {
+    for (int i = 0; i < count; ++i) {
         const auto& entry = entries[i];
+        thread_local DspData data; // Decode buffer reused across files
 
+        // Stamp before reading, so a write racing the decode shows up on the next refresh
+        if (!DspLibrary::Stamp(entry.fullPath, stamps[i])) continue;
+        stamped[i] = 1;
 
         try {
-            DspData data = DspReader::Load(entry.fullPath);
-            if (data.values.size() < 400) continue;
+            // The layout of a stock is known from n without touching its data
+            DspReader::LoadHeader(entry.fullPath, data);
+            CachedStock& stock = found[i];
+            if (data.n >= kMinSeriesLength) {
+                AnalysisEngine::PyramidLayout(data.n, stock.levelOffsets);
+                stock.name = AnalysisEngine::InternName(entry.fullPath, entry.displayName);
+                stock.isFred = ContainsFred(entry.fullPath);
+            } else if (!headersOnly) {
+                stamps[i].hash = DspLibrary::HashFile(entry.fullPath);
+            }
+        } catch (...) {
+        }
+    }
+
+    if (!headersOnly) {
+        std::vector<size_t> slots(entries.size(), 0);
+        size_t arenaSize = 0;
+        for (int i = 0; i < count; ++i) {
+            slots[i] = arenaSize;
+            arenaSize += AnalysisEngine::StockFootprint(found[i].levelOffsets);
+        }
+        auto arena = std::make_shared<StockArena>(arenaSize * sizeof(double));
 
-            CachedStock stock;
-            stock.symbol = entry.displayName; 
-            stock.fullPath = entry.fullPath;
-            stock.data = std::move(data.values);
-            stock.isFred = ContainsFred(entry.fullPath);
+        #pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < count; ++i) {
+            CachedStock& stock = found[i];
+            if (stock.LevelCount() == 0) continue;
+            thread_local DspData data;
 
-            std::lock_guard<std::mutex> lock(cacheMutex);
-            m_Cache.push_back(std::move(stock));
-        } catch (...) { }
+            try {
+                DspReader::LoadInto(entries[i].fullPath, data);
+                stamps[i].hash = DspLibrary::HashFile(entries[i].fullPath); // Just read, so it comes from the OS cache
+            } catch (...) {
+                stock.levelOffsets.clear();
+                continue;
+            }
+            // Rewritten since its header was read: its slot no longer fits, leave it to the next refresh
+            if (data.values.size() != stock.LevelSize(0)) {
+                stock.levelOffsets.clear();
+                continue;
+            }
+            AnalysisEngine::BuildStockInto(data.values, stock, arena->As<double>() + slots[i]);
+            stock.storage = arena;
+        }
     }
 
-    m_Loaded = true;
-    std::cout << "AnalysisEngine: Loaded " << m_Cache.size() << " valid stocks." << std::endl;
-    return m_Cache.size();
+    // Entry order, whatever the thread timing
+    for (int i = 0; i < count; ++i) {
+        if (stamped[i]) manifest.push_back(stamps[i]);
+        if (found[i].LevelCount() > 0) stocks.push_back(std::move(found[i]));
+    }
+    std::sort(manifest.begin(), manifest.end(), [](const DspFileStamp& a, const DspFileStamp& b) {
+        return a.path < b.path;
+    });
+}
+
+static void WriteSnapshot(const std::string& snapshotPath, const StockLibrary& library) {
+    if (snapshotPath.empty()) return;
+    if (LibrarySnapshot::Write(snapshotPath, library.stocks, library.manifest)) {
+        std::cout << "AnalysisEngine: Wrote snapshot " << snapshotPath << std::endl;
+    } else {
+        std::cout << "AnalysisEngine: Could not write snapshot " << snapshotPath << std::endl;
+    }
+}
+
+AnalysisEngine::AnalysisEngine() : m_ResultCache(std::make_unique<ResultCache>(kDefaultResultCacheSize)) {}
+
+AnalysisEngine::~AnalysisEngine() {
+    StopWatching();
+    std::unique_lock<std::mutex> lock(m_TaskMutex);
+    for (SearchTask* task : m_Tasks) task->Cancel();
+    m_TaskDone.wait(lock, [this] { return m_Tasks.empty(); });
+}
+
+size_t AnalysisEngine::LoadLibrary(const std::string& rootPath, const std::string& snapshotPath) {
+    std::lock_guard<std::mutex> guard(m_LoadMutex);
+    if (auto current = GetLibrary()) return current->stocks.size();
+    m_RootPath = rootPath;
+    m_SnapshotPath = snapshotPath;
+    m_LazyBudget = 0;
+
+    std::vector<DspFileEntry> entries = DspLibrary::Scan(rootPath);
+    DspReader::RegisterDictionaries(rootPath); // <id>.zdict files that dictionary-compressed .dsp need
+    std::cout << "AnalysisEngine: Scanned " << entries.size() << " candidates." << std::endl;
+
+    // Fast path: map the snapshot from a previous run if none of the files changed
+    auto library = std::make_shared<StockLibrary>();
+    if (!snapshotPath.empty() && LibrarySnapshot::Open(snapshotPath, entries, library->stocks, library->manifest)) {
+        std::cout << "AnalysisEngine: Mapped " << library->stocks.size() << " stocks from snapshot." << std::endl;
+    } else {
+        library->stocks.reserve(entries.size());
+        LoadEntries(entries, false, library->stocks, library->manifest);
+        std::cout << "AnalysisEngine: Loaded " << library->stocks.size() << " valid stocks." << std::endl;
+        WriteSnapshot(snapshotPath, *library);
+    }
+
+    size_t count = library->stocks.size();
+    Publish(std::move(library));
+    return count;
+}
+
+size_t AnalysisEngine::LoadLibraryLazy(const std::string& rootPath, size_t budgetBytes, int prefetchDepth) {
+    std::lock_guard<std::mutex> guard(m_LoadMutex);
+    if (auto current = GetLibrary()) return current->stocks.size();
+    m_RootPath = rootPath;
+    m_SnapshotPath.clear();
+    m_LazyBudget = std::max<size_t>(budgetBytes, 1);
+    m_PrefetchDepth = prefetchDepth;
+
+    std::vector<DspFileEntry> entries = DspLibrary::Scan(rootPath);
+    DspReader::RegisterDictionaries(rootPath);
+    std::cout << "AnalysisEngine: Scanned " << entries.size() << " candidates." << std::endl;
+
+    auto library = std::make_shared<StockLibrary>();
+    library->stocks.reserve(entries.size());
+    LoadEntries(entries, true, library->stocks, library->manifest);
+    std::cout << "AnalysisEngine: Indexed " << library->stocks.size() << " stocks (lazy, budget "
+              << budgetBytes / (1024 * 1024) << " MB)." << std::endl;
+
+    size_t count = library->stocks.size();
+    Publish(std::move(library));
+    return count;
+}
+
+void AnalysisEngine::Publish(std::shared_ptr<StockLibrary> library) {
+    std::shared_ptr<const StockLibrary> previous = GetLibrary();
+    library->version = previous ? previous->version + 1 : 1;
+    const bool float32 = m_Float32;
+    const size_t dftWindow = m_DftWindow;
+    if (m_LazyBudget > 0) {
+        // The cache is owned by the library it decodes for, so a raw pointer is enough
+        const StockLibrary* headers = library.get();
+        library->stockCache = std::make_shared<StockCache>(library->stocks.size(), m_LazyBudget, [headers, float32, dftWindow](size_t index) {
+            return DecodeStock(headers->stocks[index], float32, dftWindow);
+        });
+    } else {
+        // Stocks carried over by a refresh keep theirs
+        if (float32) AttachFloat32(library->stocks.data(), library->stocks.size());
+        if (dftWindow > 0) AttachDft(library->stocks.data(), library->stocks.size(), dftWindow);
+    }
+    std::atomic_store(&m_Library, std::shared_ptr<const StockLibrary>(std::move(library)));
+}
+
+void AnalysisEngine::EnableFloat32(bool enabled) {
+    std::lock_guard<std::mutex> guard(m_LoadMutex);
+    if (m_Float32 == enabled) return;
+    m_Float32 = enabled;
+
+    std::shared_ptr<const StockLibrary> current = GetLibrary();
+    if (!current) return;
+    // Same stocks as a new version: Publish adds the copies (or a fresh lazy cache builds them)
+    auto next = std::make_shared<StockLibrary>(*current);
+    next->stockCache.reset();
+    if (!enabled) {
+        for (CachedStock& stock : next->stocks) {
+            stock.pyramid32 = nullptr;
+            stock.storage32.reset();
+        }
+    }
+    Publish(std::move(next));
+}
+
+void AnalysisEngine::EnableDftFeatures(size_t windowLength) {
+    std::lock_guard<std::mutex> guard(m_LoadMutex);
+    if (windowLength > 0 && windowLength <= 2 * static_cast<size_t>(CachedStock::kDftCoefficients)) windowLength = 0;
+    if (m_DftWindow == windowLength) return;
+    m_DftWindow = windowLength;
+
+    std::shared_ptr<const StockLibrary> current = GetLibrary();
+    if (!current) return;
+    // As EnableFloat32; features of another window length are dropped first
+    auto next = std::make_shared<StockLibrary>(*current);
+    next->stockCache.reset();
+    for (CachedStock& stock : next->stocks) {
+        stock.dftFeatures = nullptr;
+        stock.dftWindow = 0;
+        stock.storageDft.reset();
+    }
+    const double start = omp_get_wtime();
+    Publish(std::move(next));
+    if (windowLength > 0 && !IsLazy()) {
+        std::cout << "AnalysisEngine: DFT features for " << windowLength << "-point windows built in "
+                  << omp_get_wtime() - start << " s." << std::endl;
+    }
+}
+
+bool AnalysisEngine::BuildIndex(const std::string& path, size_t windowLength) {
+    std::shared_ptr<const StockLibrary> library = GetLibrary();
+    if (!library || path.empty()) return false;
+    const double start = omp_get_wtime();
+    if (!SaxIndex::Build(library, windowLength, path)) {
+        std::cout << "AnalysisEngine: Could not build index " << path << "." << std::endl;
+        return false;
+    }
+    std::cout << "AnalysisEngine: Index built in " << omp_get_wtime() - start << " s." << std::endl;
+    return LoadIndex(path);
+}
+
+bool AnalysisEngine::LoadIndex(const std::string& path) {
+    std::shared_ptr<const SaxIndex> index = SaxIndex::Open(path);
+    if (!index) return false;
+    std::atomic_store(&m_Index, index);
+    // Indexed results depend on the index, not just the library version. Searches still running
+    // on the old index started in the previous generation, so they do not store theirs.
+    m_ResultCache->Clear();
+    std::cout << "AnalysisEngine: Using index " << path << " for " << index->WindowLength() << "-point queries ("
+              << index->EntryCount() << " windows, " << index->LeafCount() << " leaves)." << std::endl;
+    return true;
+}
+
+size_t AnalysisEngine::RefreshLibrary() {
+    std::lock_guard<std::mutex> guard(m_LoadMutex);
+    std::shared_ptr<const StockLibrary> current = GetLibrary();
+    if (!current) return 0;
+    const double start = omp_get_wtime();
+
+    std::unordered_map<std::string, const DspFileStamp*> known;
+    for (const DspFileStamp& stamp : current->manifest) known[stamp.path] = &stamp;
+
+    // Sort the scan into unchanged files (manifest entry carried over) and ones to decode
+    std::vector<DspFileEntry> entries = DspLibrary::Scan(m_RootPath);
+    DspReader::RegisterDictionaries(m_RootPath); // A rewrite may have added a dictionary
+    auto next = std::make_shared<StockLibrary>();
+    std::vector<DspFileEntry> changed;
+    std::unordered_set<std::string> present;
+    bool restamped = false; // Touched but identical files: only the manifest moves
+    for (const DspFileEntry& entry : entries) {
+        DspFileStamp stamp;
+        if (!DspLibrary::Stamp(entry.fullPath, stamp)) continue;
+        present.insert(entry.fullPath);
+
+        auto it = known.find(entry.fullPath);
+        if (it != known.end()) {
+            const DspFileStamp& old = *it->second;
+            if (stamp.size == old.size && stamp.mtime == old.mtime) {
+                next->manifest.push_back(old);
+                continue;
+            }
+            // Rewritten with the same contents (e.g. copied in again) is not worth a decode
+            if (old.hash != 0 && stamp.size == old.size) {
+                stamp.hash = DspLibrary::HashFile(entry.fullPath);
+                if (stamp.hash == old.hash) {
+                    next->manifest.push_back(stamp);
+                    restamped = true;
+                    continue;
+                }
+            }
+        }
+        changed.push_back(entry);
+    }
+    size_t dropped = 0;
+    for (const DspFileStamp& stamp : current->manifest) {
+        if (!present.count(stamp.path)) ++dropped;
+    }
+    if (changed.empty() && dropped == 0 && !restamped) return 0;
+
+    std::vector<CachedStock> decoded;
+    LoadEntries(changed, m_LazyBudget > 0, decoded, next->manifest);
+
+    // Unchanged stocks keep their place (and share their data), updated ones are replaced in place
+    std::unordered_map<std::string, size_t> decodedIndex;
+    for (size_t i = 0; i < decoded.size(); ++i) decodedIndex[decoded[i].FullPath()] = i;
+    std::unordered_set<std::string> changedPaths;
+    for (const DspFileEntry& entry : changed) changedPaths.insert(entry.fullPath);
+
+    size_t added = 0, updated = 0, removed = 0;
+    std::vector<bool> used(decoded.size(), false);
+    next->stocks.reserve(current->stocks.size() + decoded.size());
+    for (const CachedStock& stock : current->stocks) {
+        auto it = decodedIndex.find(stock.FullPath());
+        if (it != decodedIndex.end()) {
+            next->stocks.push_back(std::move(decoded[it->second]));
+            used[it->second] = true;
+            ++updated;
+        } else if (!present.count(stock.FullPath()) || changedPaths.count(stock.FullPath())) {
+            ++removed; // Deleted, or no longer decodes into a searchable stock
+        } else {
+            next->stocks.push_back(stock);
+        }
+    }
+    for (size_t i = 0; i < decoded.size(); ++i) {
+        if (used[i]) continue;
+        next->stocks.push_back(std::move(decoded[i]));
+        ++added;
+    }
+
+    std::sort(next->manifest.begin(), next->manifest.end(), [](const DspFileStamp& a, const DspFileStamp& b) {
+        return a.path < b.path;
+    });
+    WriteSnapshot(m_SnapshotPath, *next);
+    Publish(next);
+    std::cout << "AnalysisEngine: Refreshed library: " << added << " added, " << updated << " updated, "
+              << removed << " removed in " << omp_get_wtime() - start << " s (version " << next->version
+              << ")." << std::endl;
+    return added + updated + removed;
+}
+
+void AnalysisEngine::StartWatching(int intervalSeconds) {
+    std::lock_guard<std::mutex> lock(m_WatchMutex);
+    if (m_Watcher.joinable()) return;
+    m_WatchStop = false;
+    m_Watcher = std::thread([this, intervalSeconds]() {
+        std::unique_lock<std::mutex> watchLock(m_WatchMutex);
+        while (!m_WatchWake.wait_for(watchLock, std::chrono::seconds(intervalSeconds), [this]() { return m_WatchStop; })) {
+            watchLock.unlock();
+            try {
+                RefreshLibrary();
+            } catch (const std::exception& e) {
+                std::cout << "AnalysisEngine: Library refresh failed: " << e.what() << std::endl;
+            }
+            watchLock.lock();
+        }
+    });
+}
+
+void AnalysisEngine::StopWatching() {
+    std::thread watcher;
+    {
+        std::lock_guard<std::mutex> lock(m_WatchMutex);
+        m_WatchStop = true;
+        watcher.swap(m_Watcher);
+    }
+    m_WatchWake.notify_all();
+    if (watcher.joinable()) watcher.join();
+}
+
+std::shared_ptr<const CachedStock> AnalysisEngine::AcquireStock(const std::shared_ptr<const StockLibrary>& library, size_t index) {
+    if (library->stockCache) return library->stockCache->Pin(index);
+    // Eager stocks live as long as their library version: share its ownership
+    return std::shared_ptr<const CachedStock>(library, &library->stocks[index]);
+}
+
+bool AnalysisEngine::IsLazy() const {
+    std::shared_ptr<const StockLibrary> library = GetLibrary();
+    return library && library->stockCache;
+}
+
+uint64_t AnalysisEngine::LibraryVersion() const {
+    std::shared_ptr<const StockLibrary> library = GetLibrary();
+    return library ? library->version : 0;
 }
 
 double AnalysisEngine::CalculatePearson(const double* a, const double* b, size_t size) {
@@ -54,10 +689,7 @@ double AnalysisEngine::CalculatePearson(const double* a, const double* b, size_t
     // Pass 1: Means
     double mean_a = 0.0;
     double mean_b = 0.0;
-    for (size_t i = 0; i < size; ++i) {
-        mean_a += a[i];
-        mean_b += b[i];
-    }
+    SimdKernels::Sums(a, b, size, mean_a, mean_b);
     mean_a /= size;
     mean_b /= size;
 
@@ -65,14 +697,7 @@ double AnalysisEngine::CalculatePearson(const double* a, const double* b, size_t
     double num = 0.0;
     double sum_sq_a = 0.0;
     double sum_sq_b = 0.0;
-
-    for (size_t i = 0; i < size; ++i) {
-        double diff_a = a[i] - mean_a;
-        double diff_b = b[i] - mean_b;
-        num += diff_a * diff_b;
-        sum_sq_a += diff_a * diff_a;
-        sum_sq_b += diff_b * diff_b;
-    }
+    SimdKernels::CenteredSums(a, b, size, mean_a, mean_b, num, sum_sq_a, sum_sq_b);
 
     double den = std::sqrt(sum_sq_a * sum_sq_b);
     if (den == 0.0) return 0.0;
@@ -83,13 +708,7 @@ double AnalysisEngine::CalculatePearson(const double* a, const double* b, size_t
 double AnalysisEngine::CalculateHyperspherical(const double* a, const double* b, size_t size) {
     if (size == 0) return 3.14159; 
     double dot = 0.0, norm_a = 0.0, norm_b = 0.0;
-    for (size_t i = 0; i < size; ++i) {
-        double val_a = a[i];
-        double val_b = b[i];
-        dot += val_a * val_b;
-        norm_a += val_a * val_a;
-        norm_b += val_b * val_b;
-    }
+    SimdKernels::DotAndNorms(a, b, size, dot, norm_a, norm_b);
     if (norm_a == 0.0 || norm_b == 0.0) return 1.570796;
     double cosine = dot / (std::sqrt(norm_a) * std::sqrt(norm_b));
     if (cosine > 1.0) cosine = 1.0;
@@ -107,104 +726,572 @@ std::vector<double> AnalysisEngine::Downsample(const std::vector<double>& in) {
     return out;
 }
 
-std::vector<SearchResult> AnalysisEngine::Search(const std::vector<double>& query, bool useFred, int topK, int lookahead) {
-    std::vector<SearchResult> results;
-    
-    // Use entire query as pattern
-    const size_t patternSize = query.size();
-    if (patternSize < 10) return results; // Minimum safety checks
+void AnalysisEngine::PyramidLayout(size_t n, std::vector<size_t>& levelOffsets) {
+    levelOffsets.clear();
+    levelOffsets.push_back(0);
+    levelOffsets.push_back(n);
+    for (size_t size = n / 2; size >= kMinLevelSize; size /= 2) {
+        levelOffsets.push_back(levelOffsets.back() + size);
+    }
+}
 
-    // Log if verbose? 
-    // std::cout << "AnalysisEngine: Starting search. Query=" << patternSize << ", Lookahead=" << lookahead << std::endl;
+void AnalysisEngine::BuildPyramid(const std::vector<double>& data, std::vector<double>& pyramid, std::vector<size_t>& levelOffsets) {
+    // Size everything first so the buffer never reallocates while levels read from it
+    PyramidLayout(data.size(), levelOffsets);
+    pyramid.clear();
+    pyramid.reserve(levelOffsets.back());
+    pyramid.insert(pyramid.end(), data.begin(), data.end());
+
+    // Same pairwise averaging as Downsample, reading the previous level in place
+    for (size_t level = 1; level + 1 < levelOffsets.size(); ++level) {
+        size_t prevStart = levelOffsets[level - 1];
+        size_t prevEnd = levelOffsets[level];
+        for (size_t i = prevStart; i + 1 < prevEnd; i += 2) {
+            pyramid.push_back((pyramid[i] + pyramid[i + 1]) * 0.5);
+        }
+    }
+}
 
-    const std::vector<double>& pattern = query;
+size_t AnalysisEngine::StockFootprint(const std::vector<size_t>& levelOffsets) {
+    if (levelOffsets.size() < 2) return 0;
+    size_t pyramidSize = levelOffsets.back();
+    size_t statsSize = pyramidSize + levelOffsets.size() - 1;
+    return AlignDoubles(pyramidSize) + 2 * AlignDoubles(statsSize);
+}
 
-    // Thread-local storage for gathering results
-    std::vector<std::vector<SearchResult>> threadResults(omp_get_max_threads());
+// Fills the prefix-sum tables for every pyramid level of 'stock' into 'sum' and 'sumSq'
+static void BuildRollingStats(CachedStock& stock, double* sum, double* sumSq) {
+    const int levels = stock.LevelCount();
+    std::fill(sum, sum + stock.StatsSize(), 0.0);
+    std::fill(sumSq, sumSq + stock.StatsSize(), 0.0);
+    stock.levelShift.assign(levels, 0.0);
 
-    #pragma omp parallel for schedule(dynamic)
-    for (int i = 0; i < static_cast<int>(m_Cache.size()); ++i) {
-        const auto& stock = m_Cache[i];
-        if (!useFred && stock.isFred) continue;
-        
-        // Multi-Scale Search Variables
-        double globalBestPearson = -1.0;
-        int globalBestOffset = -1;
-        int globalBestScale = 1;
-        
-        // Create a copy for downsampling
-        std::vector<double> currentData = stock.data;
-        int currentScale = 1;
-
-        // Loop through scales
-        // Condition: we need patternSize + lookahead points.
-        while (currentData.size() >= patternSize + lookahead) {
-            
-            const int searchLimit = static_cast<int>(currentData.size()) - lookahead - static_cast<int>(patternSize);
-
-            if (searchLimit >= 0) {
-                double localBestPearson = -1.0;
-                int localBestOffset = -1;
-
-                // Search at this scale
-                for (int j = 0; j <= searchLimit; ++j) {
-                    double p = CalculatePearson(pattern.data(), currentData.data() + j, patternSize);
-                    if (p > localBestPearson) {
-                        localBestPearson = p;
-                        localBestOffset = j;
-                    }
+    for (int level = 0; level < levels; ++level) {
+        SeriesView view = stock.Level(level);
+        if (view.empty()) continue;
+
+        double shift = 0.0;
+        for (double v : view) shift += v;
+        shift /= static_cast<double>(view.size());
+        stock.levelShift[level] = shift;
+
+        size_t start = stock.levelOffsets[level] + static_cast<size_t>(level);
+        double* levelSum = sum + start;
+        double* levelSumSq = sumSq + start;
+        for (size_t i = 0; i < view.size(); ++i) {
+            double d = view[i] - shift;
+            levelSum[i + 1] = levelSum[i] + d;
+            levelSumSq[i + 1] = levelSumSq[i] + d * d;
+        }
+    }
+    stock.prefixSum = sum;
+    stock.prefixSumSq = sumSq;
+}
+
+void AnalysisEngine::BuildStockInto(const std::vector<double>& data, CachedStock& stock, double* slot) {
+    // Same levels as BuildPyramid, written in place
+    double* pyramid = slot;
+    std::copy(data.begin(), data.end(), pyramid);
+    for (size_t level = 1; level + 1 < stock.levelOffsets.size(); ++level) {
+        const double* prev = pyramid + stock.levelOffsets[level - 1];
+        double* out = pyramid + stock.levelOffsets[level];
+        size_t size = stock.levelOffsets[level + 1] - stock.levelOffsets[level];
+        for (size_t i = 0; i < size; ++i) {
+            out[i] = (prev[2 * i] + prev[2 * i + 1]) * 0.5;
+        }
+    }
+    stock.pyramid = { pyramid, stock.PyramidSize() };
+
+    double* sum = slot + AlignDoubles(stock.PyramidSize());
+    BuildRollingStats(stock, sum, sum + AlignDoubles(stock.StatsSize()));
+}
+
+void AnalysisEngine::BuildStock(const std::vector<double>& data, CachedStock& stock) {
+    PyramidLayout(data.size(), stock.levelOffsets);
+    auto arena = std::make_shared<StockArena>(StockFootprint(stock.levelOffsets) * sizeof(double));
+    BuildStockInto(data, stock, arena->As<double>());
+    stock.storage = std::move(arena);
+}
+
+std::vector<double> AnalysisEngine::ScaleGrid(double from, double to, int perOctave) {
+    std::vector<double> factors;
+    if (!(from > 0.0) || !(to >= from) || perOctave < 1) return factors;
+    const int steps = static_cast<int>(std::floor(std::log2(to / from) * perOctave + 1e-9));
+    for (int k = 0; k <= steps; ++k) {
+        factors.push_back(from * std::exp2(static_cast<double>(k) / perOctave));
+    }
+    return factors;
+}
+
+std::vector<double> AnalysisEngine::MatchSegment(const SearchResult& result, size_t count) {
+    std::vector<double> segment;
+    if (!result.stockPin || result.offset < 0) return segment;
+
+    if (!result.resampled) {
+        SeriesView level = result.stockPin->AtScale(result.scale);
+        if (static_cast<size_t>(result.offset) >= level.size()) return segment;
+        size_t len = std::min(count, level.size() - result.offset);
+        segment.assign(level.begin() + result.offset, level.begin() + result.offset + len);
+        return segment;
+    }
+
+    // Query point k sits timeScale * k raw points into the match
+    SeriesView data = result.stockPin->Data();
+    const double last = static_cast<double>(data.size()) - 1.0;
+    segment.reserve(count);
+    for (size_t k = 0; k < count; ++k) {
+        const double pos = result.offset + result.timeScale * static_cast<double>(k);
+        if (pos > last + 1e-9) break;
+        const size_t i = static_cast<size_t>(pos);
+        if (i + 1 >= data.size()) {
+            segment.push_back(data[data.size() - 1]);
+            break;
+        }
+        segment.push_back(data[i] + (data[i + 1] - data[i]) * (pos - static_cast<double>(i)));
+    }
+    return segment;
+}
+
+namespace {
+
+void LogPruneCounters(SearchMode mode, const std::vector<PruneCounters>& threadCounters) {
+    PruneCounters total;
+    for (const auto& c : threadCounters) total.Add(c);
+    if (mode == SearchMode::Float32) {
+        std::cout << "AnalysisEngine: Float32 screening rescored " << total.full << " of " << total.windows
+                  << " windows in double." << std::endl;
+        return;
+    }
+    if (mode == SearchMode::Hierarchical) {
+        std::cout << "AnalysisEngine: Hierarchical search refined " << total.full << " of " << total.windows
+                  << " windows." << std::endl;
+        return;
+    }
+    if (mode == SearchMode::Dft) {
+        std::cout << "AnalysisEngine: DFT filter rescored " << total.full << " of " << total.windows
+                  << " windows (" << total.lowerBound << " rejected by the feature bound)." << std::endl;
+        return;
+    }
+    std::cout << "AnalysisEngine: Pruning evaluated " << total.full << " of " << total.windows
+              << " windows in full (LB: " << total.lowerBound << ", abandoned: " << total.abandoned << ")." << std::endl;
+}
+
+int ExclusionZone(const SearchOptions& options, size_t patternSize) {
+    return options.exclusionZone >= 0 ? options.exclusionZone : static_cast<int>(patternSize);
+}
+
+// Hierarchical mode calibrates on every kCalibrationDivisor-th stock to search, at least
+// kMinCalibrationStocks of them: the exhaustive pass over the sample is the price of a known recall
+constexpr size_t kCalibrationDivisor = 20;
+constexpr size_t kMinCalibrationStocks = 8;
+
+// Hierarchical mode: builds the coarse query of every variant and calibrates its slack on an
+// evenly spread sample of 'candidates' (library indices)
+void CalibrateHierarchical(QueryVariants& variants, const std::shared_ptr<const StockLibrary>& library,
+                           const std::vector<int>& candidates, int lookahead, const SearchOptions& options) {
+    std::vector<std::shared_ptr<const CachedStock>> sample;
+    size_t count = std::min(candidates.size(), std::max(kMinCalibrationStocks, candidates.size() / kCalibrationDivisor));
+    for (PreparedQuery& prepared : variants.prepared) {
+        PrepareCoarse(prepared, options.coarseLevels);
+        if (prepared.coarseShift == 0 || count == 0) continue;
+
+        if (sample.empty()) {
+            for (size_t i = 0; i < count; ++i) {
+                if (auto stock = AnalysisEngine::AcquireStock(library, candidates[i * candidates.size() / count])) {
+                    sample.push_back(std::move(stock));
                 }
+            }
+        }
+        size_t measured = 0;
+        double recall = CalibrateCoarse(prepared, sample, lookahead, options.minPearson, options.recallTarget, measured);
+        std::cout << "AnalysisEngine: Hierarchical slack " << prepared.coarseSlack << " at 1/" << (1 << prepared.coarseShift)
+                  << " scale keeps " << recall * 100.0 << "% of " << measured << " sampled best matches (target "
+                  << options.recallTarget * 100.0 << "%";
+        if (prepared.stretch > 0.0) std::cout << ", query stretched " << prepared.stretch << "x";
+        std::cout << ")." << std::endl;
+    }
+}
+
+// Library blocks for SearchBatch are sized to stay resident in a typical per-core L2
+constexpr size_t kBatchBlockBytes = 512 * 1024;
+
+// Search splits the library into roughly this many chunks per thread, but never into
+// pieces smaller than kMinChunkWindows (per-chunk setup would dominate)
+constexpr int kChunksPerThread = 16;
+constexpr int kMinChunkWindows = 1024;
+
+// A run of window offsets [first, last] of one query variant on one level of one stock
+struct SearchChunk {
+    int slot;  // Index into the per-stock merge state
+    int variant;
+    int level;
+    int first;
+    int last;
+    double cost;
+};
+
+// Matches of one stock, gathered from all of its chunks
+struct StockMerge {
+    StockMerge(int stockIndex, int capacity, int exclusionZone)
+        : stock(stockIndex), matches(capacity, exclusionZone) {}
+
+    int stock;
+    std::mutex lock;
+    MatchSet matches;
+    int remaining = 0; // Chunks still running; the last one publishes the stock
+    int rank = 0;      // Position of the stock's first chunk in the schedule
+    bool started = false;
+};
+
+// Cuts every level (and query variant) of every eligible stock into chunks of about equal estimated cost,
+// ordered most expensive first so long series start early and short ones fill the gaps.
+// With groupByStock (lazy library) the order is by whole stock instead, so each stock is
+// decoded once and 'slotOrder' lists the stocks in the order they will be needed.
+void PlanChunks(const std::vector<CachedStock>& cache, bool useFred, const QueryVariants& variants, int lookahead,
+                const SearchOptions& options, int exclusionZone, int threads, bool groupByStock,
+                std::vector<SearchChunk>& chunks, std::vector<std::unique_ptr<StockMerge>>& merges,
+                std::vector<int>& slotOrder) {
+    std::vector<double> windowCost;
+    for (const PreparedQuery& prepared : variants.prepared) {
+        windowCost.push_back(EstimateWindowCost(options.mode, prepared.centered.size()));
+    }
+
+    double totalCost = 0.0;
+    for (int i = 0; i < static_cast<int>(cache.size()); ++i) {
+        const auto& stock = cache[i];
+        if (!useFred && stock.isFred) continue;
 
-                if (localBestPearson > globalBestPearson) {
-                    globalBestPearson = localBestPearson;
-                    globalBestOffset = localBestOffset;
-                    globalBestScale = currentScale;
+        int slot = -1;
+        for (int v = 0; v < static_cast<int>(variants.prepared.size()); ++v) {
+            for (int level = 0; level < stock.LevelCount(); ++level) {
+                const int searchLimit = SearchLimit(variants.prepared[v], stock, level, lookahead);
+                if (searchLimit < 0) break;
+                if (slot < 0) {
+                    slot = static_cast<int>(merges.size());
+                    merges.push_back(std::make_unique<StockMerge>(i, options.matchesPerStock, exclusionZone));
                 }
+                const double cost = (searchLimit + 1) * windowCost[v];
+                chunks.push_back({ slot, v, level, 0, searchLimit, cost });
+                totalCost += cost;
             }
+        }
+    }
 
-            // Prepare next scale
-            currentData = Downsample(currentData);
-            currentScale *= 2;
+    const double target = totalCost / (static_cast<double>(threads) * kChunksPerThread);
+    std::vector<SearchChunk> split;
+    split.reserve(chunks.size());
+    for (const SearchChunk& chunk : chunks) {
+        const int windows = chunk.last + 1;
+        int pieces = (target > 0.0) ? static_cast<int>(std::ceil(chunk.cost / target)) : 1;
+        pieces = std::max(1, std::min(pieces, windows / kMinChunkWindows));
+        for (int p = 0; p < pieces; ++p) {
+            int first = static_cast<int>(static_cast<long long>(windows) * p / pieces);
+            int last = static_cast<int>(static_cast<long long>(windows) * (p + 1) / pieces) - 1;
+            split.push_back({ chunk.slot, chunk.variant, chunk.level, first, last,
+                              (last - first + 1) * windowCost[chunk.variant] });
+            ++merges[chunk.slot]->remaining;
         }
+    }
+
+    if (groupByStock) {
+        std::vector<double> stockCost(merges.size(), 0.0);
+        for (const SearchChunk& chunk : split) stockCost[chunk.slot] += chunk.cost;
+        std::stable_sort(split.begin(), split.end(), [&](const SearchChunk& a, const SearchChunk& b) {
+            if (a.slot != b.slot) {
+                if (stockCost[a.slot] != stockCost[b.slot]) return stockCost[a.slot] > stockCost[b.slot];
+                return a.slot < b.slot;
+            }
+            return a.cost > b.cost;
+        });
+    } else {
+        std::stable_sort(split.begin(), split.end(), [](const SearchChunk& a, const SearchChunk& b) {
+            return a.cost > b.cost;
+        });
+    }
+    chunks.swap(split);
 
-        // Check Threshold logic (User requirement: discard if < 0.7)
-        if (globalBestOffset != -1 && globalBestPearson >= 0.7) {
-            
-            // "Invariant to Y stretching" Distance is simply derived from Pearson.
-            // Pearson = Cosine of Centered Vectors.
-            // Distance = acos(Pearson).
-            double dist = std::acos(std::max(-1.0, std::min(1.0, globalBestPearson)));
-            
-            SearchResult res;
-            res.symbol = stock.symbol;
-            res.offset = globalBestOffset;
-            res.scale = globalBestScale;
-            res.pearson = globalBestPearson;
-            res.distance = dist;
-            res.stockPtr = &stock;
+    slotOrder.clear();
+    std::vector<bool> seen(merges.size(), false);
+    for (const SearchChunk& chunk : chunks) {
+        if (seen[chunk.slot]) continue;
+        seen[chunk.slot] = true;
+        merges[chunk.slot]->rank = static_cast<int>(slotOrder.size());
+        slotOrder.push_back(chunk.slot);
+    }
+}
 
-            int tid = omp_get_thread_num();
-            threadResults[tid].push_back(res);
+void LogCacheStats(const StockCache& cache) {
+    StockCache::Stats stats = cache.GetStats();
+    std::cout << "AnalysisEngine: Stock cache hits " << stats.hits << ", misses " << stats.misses
+              << ", evictions " << stats.evictions << ", resident " << stats.residentBytes / (1024 * 1024)
+              << " MB." << std::endl;
+}
+
+} // namespace
+
+SearchTask::SearchTask(int topK) : m_TopK(topK), m_Future(m_Promise.get_future().share()) {}
+
+namespace {
+
+bool ByPearson(const SearchResult& a, const SearchResult& b) {
+    return a.pearson > b.pearson;
+}
+
+bool SameMatches(const std::vector<SearchResult>& a, const std::vector<SearchResult>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].offset != b[i].offset || a[i].scale != b[i].scale || a[i].pearson != b[i].pearson ||
+            a[i].timeScale != b[i].timeScale) {
+            return false;
         }
     }
+    return true;
+}
+
+} // namespace
 
-    // Merge results
-    for (const auto& local : threadResults) {
-        results.insert(results.end(), local.begin(), local.end());
+std::vector<SearchResult> SearchTask::Snapshot() const {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (m_Finished) return m_Final;
+    std::vector<SearchResult> best;
+    for (const auto& stock : m_Provisional) best.insert(best.end(), stock.second.begin(), stock.second.end());
+    const size_t keep = std::min(best.size(), static_cast<size_t>(std::max(m_TopK, 0)));
+    std::partial_sort(best.begin(), best.begin() + keep, best.end(), ByPearson);
+    best.resize(keep);
+    return best;
+}
+
+double SearchTask::Progress() const {
+    if (IsDone()) return 1.0;
+    const size_t count = m_ChunkCount;
+    return count > 0 ? static_cast<double>(m_ChunksDone) / static_cast<double>(count) : 0.0;
+}
+
+void SearchTask::Update(uint32_t stockId, std::vector<SearchResult> results) {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    auto it = m_Provisional.find(stockId);
+    if (it == m_Provisional.end() ? results.empty() : SameMatches(it->second, results)) return;
+    if (results.empty()) {
+        m_Provisional.erase(it);
+    } else {
+        m_Provisional[stockId] = std::move(results);
     }
-    
-    std::cout << "AnalysisEngine: Merged " << results.size() << " results." << std::endl;
+    ++m_Revision;
 
-    // Sort by Hyperspherical Distance (Ascending: 0 is best)
-    // Note: Since Distance = acos(Pearson), Sorting by Distance Ascending is IDENTICAL to Pearson Descending.
-    std::sort(results.begin(), results.end(), [](const SearchResult& a, const SearchResult& b) {
-        return a.distance < b.distance;
-    });
+    // Keep the candidates (and pinned stocks) near the Top K
+    if (m_TopK <= 0 || m_Provisional.size() <= 2 * static_cast<size_t>(m_TopK)) return;
+    std::vector<double> scores;
+    for (const auto& stock : m_Provisional) {
+        for (const SearchResult& r : stock.second) scores.push_back(r.pearson);
+    }
+    if (scores.size() < static_cast<size_t>(m_TopK)) return;
+    std::nth_element(scores.begin(), scores.begin() + (m_TopK - 1), scores.end(), std::greater<double>());
+    const double kth = scores[m_TopK - 1];
+    for (auto stock = m_Provisional.begin(); stock != m_Provisional.end();) {
+        if (stock->second.front().pearson < kth) {
+            stock = m_Provisional.erase(stock);
+        } else {
+            ++stock;
+        }
+    }
+}
+
+void SearchTask::Finish(std::vector<SearchResult> results) {
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Final = results;
+        m_Provisional.clear();
+        m_Finished = true;
+        ++m_Revision;
+    }
+    m_Promise.set_value(std::move(results));
+}
 
-    // Keep Top K
-    if (results.size() > static_cast<size_t>(topK)) {
-        results.resize(topK);
+std::shared_ptr<SearchTask> AnalysisEngine::SearchAsync(const std::vector<double>& query, bool useFred, int topK,
+                                                        int lookahead, const SearchOptions& options) {
+    std::shared_ptr<SearchTask> task(new SearchTask(topK));
+    {
+        std::lock_guard<std::mutex> lock(m_TaskMutex);
+        m_Tasks.push_back(task.get());
     }
+    // Detached; the destructor waits for it through m_Tasks
+    std::thread([this, task, query, useFred, topK, lookahead, options]() {
+        try {
+            task->Finish(RunSearch(query, useFred, topK, lookahead, options, task.get()));
+        } catch (...) {
+            task->m_Promise.set_exception(std::current_exception());
+        }
+        std::lock_guard<std::mutex> lock(m_TaskMutex);
+        m_Tasks.erase(std::find(m_Tasks.begin(), m_Tasks.end(), task.get()));
+        m_TaskDone.notify_all();
+    }).detach();
+    return task;
+}
+
+std::vector<SearchResult> AnalysisEngine::Search(const std::vector<double>& query, bool useFred, int topK, int lookahead,
+                                                 const SearchOptions& options) {
+    return RunSearch(query, useFred, topK, lookahead, options, nullptr);
+}
+
+std::vector<SearchResult> AnalysisEngine::RunSearch(const std::vector<double>& query, bool useFred, int topK,
+                                                    int lookahead, const SearchOptions& options, SearchTask* task) {
+    std::vector<SearchResult> results;
+    // The whole search runs on this version, even if a refresh swaps in a newer one meanwhile
+    std::shared_ptr<const StockLibrary> library = GetLibrary();
+    if (!library) return results;
+
+    const double start = omp_get_wtime();
+    const uint64_t generation = m_ResultCache->Generation(); // Before the search picks its index
+    if (m_ResultCache->Find(library, query, useFred, topK, lookahead, options, results)) {
+        std::cout << "AnalysisEngine: " << results.size() << " cached results (library version " << library->version
+                  << ") in " << (omp_get_wtime() - start) * 1e6 << " us." << std::endl;
+        return results;
+    }
+    results = SearchLibrary(library, query, useFred, topK, lookahead, options, task);
+    if (task && task->IsCancelled()) {
+        std::cout << "AnalysisEngine: Search cancelled at " << task->Progress() * 100.0 << "%." << std::endl;
+        return results;
+    }
+    m_ResultCache->Store(library, query, useFred, topK, lookahead, options, results, generation);
+    return results;
+}
+
+void AnalysisEngine::SetResultCacheSize(size_t entries) {
+    m_ResultCache->SetCapacity(entries);
+}
+
+std::vector<SearchResult> AnalysisEngine::SearchLibrary(const std::shared_ptr<const StockLibrary>& library,
+                                                        const std::vector<double>& query, bool useFred, int topK,
+                                                        int lookahead, const SearchOptions& options, SearchTask* task) {
+    std::vector<SearchResult> results;
+    StockCache* stockCache = library->stockCache.get();
+
+    if (options.mode == SearchMode::Indexed || options.mode == SearchMode::IndexedExact) {
+        std::shared_ptr<const SaxIndex> index = std::atomic_load(&m_Index);
+        if (index && index->WindowLength() == query.size() && options.scaleFactors.empty()) {
+            results = index->Search(library, query, useFred, topK, lookahead, options);
+            if (!results.empty()) {
+                std::cout << "AnalysisEngine: Top Match: " << results[0].symbol << " (Dist: " << results[0].distance << ", Pearson: " << results[0].pearson << ")" << std::endl;
+            }
+            return results;
+        }
+        std::cout << "AnalysisEngine: No index for this query, scanning instead." << std::endl;
+        SearchOptions scan = options;
+        scan.mode = SearchMode::Mass;
+        return SearchLibrary(library, query, useFred, topK, lookahead, scan, task);
+    }
+    if (options.mode == SearchMode::Dft && (m_DftWindow != query.size() || !options.scaleFactors.empty())) {
+        std::cout << "AnalysisEngine: No DFT features for this query, patterns of other lengths are scanned." << std::endl;
+    }
+
+    // Use entire query as pattern (or its resampled copies)
+    QueryVariants variants;
+    if (!PrepareVariants(query, options, variants)) return results;
+
+    // Log if verbose? 
+    // std::cout << "AnalysisEngine: Starting search. Query=" << query.size() << ", Lookahead=" << lookahead << std::endl;
+
+    SharedThreshold threshold(options.minPearson);
+    const int exclusionZone = ExclusionZone(options, query.size());
+
+    // Thread-local bounded heaps, merged once at the end
+    const int threads = omp_get_max_threads();
+    std::vector<TopKHeap> threadHeaps(threads, TopKHeap(topK));
+    std::vector<PruneCounters> threadCounters(threads);
+    std::vector<size_t> threadQualified(threads, 0);
+
+    // Long series are split across threads instead of pinning one thread per stock
+    std::vector<SearchChunk> chunks;
+    std::vector<std::unique_ptr<StockMerge>> merges;
+    std::vector<int> slotOrder;
+    PlanChunks(library->stocks, useFred, variants, lookahead, options, exclusionZone, threads, stockCache != nullptr,
+               chunks, merges, slotOrder);
+    if (options.mode == SearchMode::Hierarchical) {
+        std::vector<int> candidates;
+        for (int slot : slotOrder) candidates.push_back(merges[slot]->stock);
+        std::sort(candidates.begin(), candidates.end());
+        CalibrateHierarchical(variants, library, candidates, lookahead, options);
+    }
+    if (task) task->m_ChunkCount = chunks.size();
+    std::atomic<int> nextChunk(0);
+
+    #pragma omp parallel
+    {
+        int tid = omp_get_thread_num();
+        MatchSet matches(options.matchesPerStock, exclusionZone);
+
+        // Threads pull chunks off the shared cost-ordered list until it runs dry
+        for (int c = nextChunk.fetch_add(1); c < static_cast<int>(chunks.size()); c = nextChunk.fetch_add(1)) {
+            if (task && task->IsCancelled()) break;
+            const SearchChunk& chunk = chunks[c];
+            StockMerge& merge = *merges[chunk.slot];
+
+            // Start from what other chunks of this stock already found, so the bar is as high as possible
+            bool firstChunk;
+            {
+                std::lock_guard<std::mutex> guard(merge.lock);
+                matches = merge.matches;
+                firstChunk = !merge.started;
+                merge.started = true;
+            }
+            matches.SetVariant(chunk.variant);
+            // Lazy library: get the next stocks decoding in the background while this one is searched
+            if (firstChunk && stockCache) {
+                for (int r = merge.rank + 1; r <= merge.rank + m_PrefetchDepth && r < static_cast<int>(slotOrder.size()); ++r) {
+                    stockCache->Prefetch(merges[slotOrder[r]]->stock);
+                }
+            }
+
+            std::shared_ptr<const CachedStock> stock = AcquireStock(library, merge.stock);
+            if (stock) {
+                ScoreRange(variants.prepared[chunk.variant], *stock, chunk.level, chunk.first, chunk.last, options.mode,
+                           threshold, matches, threadCounters[tid]);
+            }
+
+            bool lastChunk;
+            std::vector<Match> found; // Async searches: this stock's matches so far
+            {
+                std::lock_guard<std::mutex> guard(merge.lock);
+                merge.matches.Merge(matches);
+                lastChunk = (--merge.remaining == 0);
+                if (task && stock) found = merge.matches.Matches();
+            }
+            if (task) {
+                ++task->m_ChunksDone;
+                std::vector<SearchResult> preview;
+                for (const Match& m : found) {
+                    if (m.pearson < std::max(options.minPearson, threshold.Get())) continue;
+                    preview.push_back(MakeResult(*stock, m, variants));
+                    preview.back().stockPin = stock;
+                }
+                std::sort(preview.begin(), preview.end(), ByPearson);
+                if (stock) task->Update(stock->Id(), std::move(preview));
+            }
+            if (!lastChunk || !stock) continue;
+
+            // Check Threshold logic (User requirement: discard if < 0.7)
+            for (const Match& m : merge.matches.Matches()) {
+                if (m.pearson < options.minPearson) continue;
+                ++threadQualified[tid];
+                SearchResult result = MakeResult(*stock, m, variants);
+                result.stockPin = stock;
+                if (threadHeaps[tid].Push(result)) {
+                    threshold.Publish(threadHeaps[tid].Kth());
+                }
+            }
+        }
+    }
+
+    size_t qualified = 0;
+    for (size_t n : threadQualified) qualified += n;
+    std::cout << "AnalysisEngine: Merged " << qualified << " results." << std::endl;
+    if (options.mode == SearchMode::Pruned || options.mode == SearchMode::Float32 || options.mode == SearchMode::Hierarchical ||
+        options.mode == SearchMode::Dft) {
+        LogPruneCounters(options.mode, threadCounters);
+    }
+    if (stockCache) LogCacheStats(*stockCache);
+
+    results = MergeTopK(threadHeaps, topK);
     
     if (!results.empty()) {
         std::cout << "AnalysisEngine: Top Match: " << results[0].symbol << " (Dist: " << results[0].distance << ", Pearson: " << results[0].pearson << ")" << std::endl;
@@ -212,3 +1299,112 @@ std::vector<SearchResult> AnalysisEngine::Search(const std::vector<double>& quer
 
     return results;
 }
+
+std::vector<std::vector<SearchResult>> AnalysisEngine::SearchBatch(const std::vector<std::vector<double>>& queries, bool useFred,
+                                                                   int topK, int lookahead, const SearchOptions& options) {
+    const int queryCount = static_cast<int>(queries.size());
+    std::vector<std::vector<SearchResult>> results(queryCount);
+    std::shared_ptr<const StockLibrary> library = GetLibrary();
+    if (!library) return results;
+
+    // Index searches read only a few leaves each, so there is no scan to share
+    if (options.mode == SearchMode::Indexed || options.mode == SearchMode::IndexedExact) {
+        for (int q = 0; q < queryCount; ++q) results[q] = Search(queries[q], useFred, topK, lookahead, options);
+        return results;
+    }
+    const std::vector<CachedStock>& stocks = library->stocks;
+    StockCache* stockCache = library->stockCache.get();
+
+    std::vector<QueryVariants> prepared(queryCount);
+    std::vector<int> active; // Queries that can produce matches
+    for (int q = 0; q < queryCount; ++q) {
+        if (PrepareVariants(queries[q], options, prepared[q])) active.push_back(q);
+    }
+    if (active.empty()) return results;
+
+    std::vector<std::unique_ptr<SharedThreshold>> thresholds(queryCount);
+    for (int q : active) thresholds[q] = std::make_unique<SharedThreshold>(options.minPearson);
+
+    if (options.mode == SearchMode::Hierarchical) {
+        std::vector<int> candidates;
+        for (int i = 0; i < static_cast<int>(stocks.size()); ++i) {
+            if (useFred || !stocks[i].isFred) candidates.push_back(i);
+        }
+        for (int q : active) CalibrateHierarchical(prepared[q], library, candidates, lookahead, options);
+    }
+
+    // Tile the library into blocks of whole stocks that fit in L2
+    std::vector<int> blockStarts;
+    size_t blockBytes = 0;
+    for (int i = 0; i < static_cast<int>(stocks.size()); ++i) {
+        const auto& stock = stocks[i];
+        if (!useFred && stock.isFred) continue;
+        size_t bytes = (stock.PyramidSize() + 2 * stock.StatsSize()) * sizeof(double);
+        if (blockStarts.empty() || blockBytes + bytes > kBatchBlockBytes) {
+            blockStarts.push_back(i);
+            blockBytes = 0;
+        }
+        blockBytes += bytes;
+    }
+    blockStarts.push_back(static_cast<int>(stocks.size()));
+
+    const int threads = omp_get_max_threads();
+    std::vector<std::vector<TopKHeap>> queryHeaps(queryCount, std::vector<TopKHeap>(threads, TopKHeap(topK)));
+    std::vector<PruneCounters> threadCounters(threads);
+
+    // Each block is streamed from memory once and scored against every query while hot
+    #pragma omp parallel
+    {
+        std::vector<MatchSet> matches;
+        for (int q = 0; q < queryCount; ++q) {
+            matches.emplace_back(options.matchesPerStock, ExclusionZone(options, queries[q].size()));
+        }
+        std::vector<std::shared_ptr<const CachedStock>> blockStocks;
+
+        #pragma omp for schedule(dynamic)
+        for (int b = 0; b < static_cast<int>(blockStarts.size()) - 1; ++b) {
+            int tid = omp_get_thread_num();
+
+            // Lazy library: queue the following block, then pin this one for all queries
+            if (stockCache && b + 2 < static_cast<int>(blockStarts.size())) {
+                for (int i = blockStarts[b + 1]; i < blockStarts[b + 2]; ++i) {
+                    if (useFred || !stocks[i].isFred) stockCache->Prefetch(i);
+                }
+            }
+            blockStocks.clear();
+            for (int i = blockStarts[b]; i < blockStarts[b + 1]; ++i) {
+                if (!useFred && stocks[i].isFred) continue;
+                if (auto stock = AcquireStock(library, i)) blockStocks.push_back(std::move(stock));
+            }
+
+            for (int q : active) {
+                for (const auto& stock : blockStocks) {
+                    matches[q].Clear();
+                    ScoreStock(prepared[q], *stock, lookahead, options.mode, *thresholds[q], matches[q], threadCounters[tid]);
+                    for (const Match& m : matches[q].Matches()) {
+                        if (m.pearson < options.minPearson) continue;
+                        SearchResult result = MakeResult(*stock, m, prepared[q]);
+                        result.stockPin = stock;
+                        if (queryHeaps[q][tid].Push(result)) {
+                            thresholds[q]->Publish(queryHeaps[q][tid].Kth());
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    for (int q : active) {
+        results[q] = MergeTopK(queryHeaps[q], topK);
+    }
+
+    std::cout << "AnalysisEngine: Batch of " << queryCount << " queries over " << blockStarts.size() - 1
+              << " library blocks." << std::endl;
+    if (options.mode == SearchMode::Pruned || options.mode == SearchMode::Float32 || options.mode == SearchMode::Hierarchical ||
+        options.mode == SearchMode::Dft) {
+        LogPruneCounters(options.mode, threadCounters);
+    }
+    if (stockCache) LogCacheStats(*stockCache);
+
+    return results;
+}
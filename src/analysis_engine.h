@@ -3,22 +3,190 @@
 #include <vector>
 #include <string>
 #include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <condition_variable>
+#include <future>
+#include <unordered_map>
 #include "dsp_reader.h"
+#include "dsp_library.h"
 
-struct CachedStock {
-    std::string symbol;
+class MappedFile;
+class ResultCache;
+class SaxIndex;
+class StockCache;
+
+// Non-owning view of one pyramid level
+struct SeriesView {
+    const double* ptr = nullptr;
+    size_t length = 0;
+
+    const double* data() const { return ptr; }
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+    double operator[](size_t i) const { return ptr[i]; }
+    const double* begin() const { return ptr; }
+    const double* end() const { return ptr + length; }
+};
+
+// Rolling-moment tables for one pyramid level: O(1) mean/variance of any window
+struct LevelStats {
+    const double* prefixSum = nullptr;   // prefixSum[i] = sum of (x[k] - shift) for k < i
+    const double* prefixSumSq = nullptr; // Same, for squares
+    double shift = 0.0;                  // Level mean, subtracted to limit cancellation
+
+    // Mean and centered sum of squares of x[offset, offset + length).
+    // Windows flat to rounding report centeredSumSq == 0.
+    void Window(size_t offset, size_t length, double& mean, double& centeredSumSq) const;
+};
+
+// Interned name of a library file. Entries are never freed or moved, so stocks refer to
+// them by pointer and results by id; the same path keeps its id across refreshes.
+struct StockName {
+    uint32_t id = 0;
+    std::string symbol;   // Path relative to the library root
     std::string fullPath;
-    std::vector<double> data;
-    bool isFred;
+};
+
+struct CachedStock {
+    const StockName* name = nullptr;     // See AnalysisEngine::InternName
+    SeriesView pyramid;                  // Power-of-two levels back to back, level 0 = raw data
+    std::vector<size_t> levelOffsets;    // Start of each level in 'pyramid', plus one end marker
+    const double* prefixSum = nullptr;   // Rolling-moment tables (StatsSize() each), level l starts at levelOffsets[l] + l
+    const double* prefixSumSq = nullptr;
+    std::vector<double> levelShift;      // Per-level mean used by the tables
+    bool isFred = false;
+    // Float copy of 'pyramid' with each level's levelShift subtracted (same offsets), for
+    // SearchMode::Float32. nullptr unless AnalysisEngine::EnableFloat32 is on.
+    const float* pyramid32 = nullptr;
+    // First kDftCoefficients DFT coefficients (re, im; from coefficient 1) of every z-normalized
+    // window of dftWindow points, for SearchMode::Dft. Window j of a level sits at
+    // 2 * kDftCoefficients * (levelOffsets[level] + j); flat windows hold NaN. nullptr unless
+    // AnalysisEngine::EnableDftFeatures is on.
+    static constexpr int kDftCoefficients = 4;
+    const float* dftFeatures = nullptr;
+    size_t dftWindow = 0;
+
+    // Owner of the arrays the views point into: the aligned arena of the load that decoded the
+    // stock, or a mapped library snapshot. Both lay a stock out the same way (pyramid, prefixSum,
+    // prefixSumSq, each on a 64-byte boundary). Shared, so copying a stock (a library refresh
+    // carries unchanged ones over) copies no data.
+    std::shared_ptr<const void> storage;
+    std::shared_ptr<const void> storage32; // Owner of pyramid32
+    std::shared_ptr<const void> storageDft; // Owner of dftFeatures
+
+    uint32_t Id() const { return name ? name->id : 0; }
+    const std::string& Symbol() const;
+    const std::string& FullPath() const;
+
+    size_t PyramidSize() const { return levelOffsets.empty() ? 0 : levelOffsets.back(); }
+    size_t StatsSize() const { return PyramidSize() + LevelCount(); }
+    int LevelCount() const { return levelOffsets.empty() ? 0 : static_cast<int>(levelOffsets.size()) - 1; }
+    // Points in a level; known from the layout alone, also for lazy (header-only) stocks
+    size_t LevelSize(int level) const;
+    SeriesView Level(int level) const;
+    SeriesView Data() const { return Level(0); }
+    SeriesView AtScale(int scale) const; // Scale 1, 2, 4... ; empty if not built
+    const float* Level32(int level) const; // nullptr without a float copy
+    const float* LevelDft(int level) const; // nullptr without DFT features
+    LevelStats Stats(int level) const;
 };
 
 struct SearchResult {
     std::string symbol;
     int offset; // Starting index in the target stock
-    int scale;  // Downsampling scale (1, 2, 4...)
+    int scale;  // Downsampling scale (1, 2, 4...); 1 for resampled matches
     double pearson;
     double distance; // Hyperspherical distance
-    const CachedStock* stockPtr; // Fast access to data
+    uint32_t stockId = 0; // StockName id, stable across library versions
+    double timeScale = 1.0; // Data points per query point: 'scale', or the stretch of a resampled match
+    bool resampled = false; // Matched by a resampled query on level 0 (see SearchOptions::scaleFactors)
+    std::shared_ptr<const CachedStock> stockPin; // The matched stock; keeps its data alive while the result is held
+};
+
+// One published version of the library. It is never modified once published: a search
+// keeps the version it started with while a refresh builds the next one and swaps it in.
+struct StockLibrary {
+    std::vector<CachedStock> stocks;        // Headers without data in lazy mode
+    std::vector<DspFileStamp> manifest;     // Every scanned file, sorted by path
+    std::shared_ptr<StockCache> stockCache; // Lazy mode only; decodes 'stocks' on demand
+    uint64_t version = 0;                   // Increases with every published refresh
+};
+
+enum class SearchMode {
+    BruteForce, // Reference: CalculatePearson at every offset
+    Rolling,    // One dot product per offset, O(1) window stats from the rolling tables
+    Mass,       // FFT sliding dot product + rolling mean/std
+    Pruned,     // z-normalized distance with lower bounds and early abandoning (UCR-suite style)
+    Float32,    // Rolling on the float copies (half the bandwidth, twice the SIMD lanes); windows within
+                // the float error bound of the bar are rescored in double. Rolling for stocks without one.
+    Hierarchical, // Coarse to fine: a downsampled query scores each level's coarser copy, and only the
+                  // regions around promising coarse offsets are scored in full (approximate, see recallTarget)
+    Indexed,      // iSAX index (AnalysisEngine::BuildIndex): only the indexLeaves most promising leaves (approximate).
+                  // Queries the index was not built for are scanned with Mass.
+    IndexedExact, // iSAX index: every leaf whose lower bound can still reach the Top K (exact for minPearson > 0)
+    Dft           // GEMINI filter and refine on the DFT features (AnalysisEngine::EnableDftFeatures): windows whose
+                  // feature distance can still reach the bar are rescored exactly. Rolling for other query lengths.
+};
+
+struct SearchOptions {
+    SearchMode mode = SearchMode::Mass;
+    double minPearson = 0.7; // Matches below this are discarded
+    int matchesPerStock = 1; // Best N non-overlapping matches per stock, picked greedily by score
+    int exclusionZone = -1;  // Min distance between match starts, in level-0 points (-1 = query length)
+
+    // Hierarchical mode
+    int coarseLevels = 2;       // The coarse pass runs on data and query halved this many times
+    double recallTarget = 0.95; // Share of per-stock best matches the coarse pass must keep, measured
+                                // against an exhaustive pass over a sample of stocks (1.0 = keep all seen)
+
+    // Time scales to match at instead of the pyramid's 1x, 2x, 4x... The query is resampled to
+    // each factor times its length (0.5 = analogs running twice as fast) and every copy is
+    // searched on the raw data, so any grid works (e.g. ScaleGrid(0.5, 4.0, 4)). Empty = pyramid.
+    std::vector<double> scaleFactors;
+
+    // SearchMode::Indexed
+    int indexLeaves = 64; // Index leaves visited, best lower bound first
+};
+
+// A search started by AnalysisEngine::SearchAsync, shared by its worker thread and the caller.
+// Dropping the handle does not stop the search; Cancel does, at the next chunk boundary.
+class SearchTask {
+public:
+    // Final Top K, best first. A cancelled search delivers the stocks it had finished.
+    const std::shared_future<std::vector<SearchResult>>& Future() const { return m_Future; }
+    bool IsDone() const { return m_Future.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }
+    void Cancel() { m_Cancelled = true; }
+    bool IsCancelled() const { return m_Cancelled; }
+
+    // Best matches found so far, best first: each stock's matches as of its last searched chunk
+    // (they can still improve or move), and the final list once done. Revision changes whenever
+    // the snapshot may have.
+    std::vector<SearchResult> Snapshot() const;
+    uint64_t Revision() const { return m_Revision; }
+    // Share of the planned work done, 0 to 1
+    double Progress() const;
+
+private:
+    friend class AnalysisEngine;
+    explicit SearchTask(int topK);
+    // Replaces the provisional matches of one stock
+    void Update(uint32_t stockId, std::vector<SearchResult> results);
+    void Finish(std::vector<SearchResult> results);
+
+    int m_TopK;
+    std::promise<std::vector<SearchResult>> m_Promise;
+    std::shared_future<std::vector<SearchResult>> m_Future;
+    std::atomic<bool> m_Cancelled{ false };
+    std::atomic<uint64_t> m_Revision{ 0 };
+    std::atomic<size_t> m_ChunksDone{ 0 };
+    std::atomic<size_t> m_ChunkCount{ 0 };
+    mutable std::mutex m_Mutex;
+    // Stocks that may hold a Top K match (others are dropped, releasing their pins)
+    std::unordered_map<uint32_t, std::vector<SearchResult>> m_Provisional;
+    std::vector<SearchResult> m_Final;
+    bool m_Finished = false;
 };
 
 class AnalysisEngine {
@@ -30,20 +198,129 @@ public:
     }
 
     static std::vector<double> Downsample(const std::vector<double>& in);
-    size_t LoadLibrary(const std::string& rootPath);
-    const std::vector<CachedStock>& GetCache() const { return m_Cache; }
-    bool IsLoaded() const { return m_Loaded; }
+    // Builds every level down to kMinLevelSize points into one contiguous buffer
+    static void BuildPyramid(const std::vector<double>& data, std::vector<double>& pyramid, std::vector<size_t>& levelOffsets);
+    // Level boundaries BuildPyramid produces for a series of n points
+    static void PyramidLayout(size_t n, std::vector<size_t>& levelOffsets);
+    static constexpr size_t kMinLevelSize = 10; // Smallest query Search accepts
+    // Builds the pyramid and rolling-moment tables of 'data' into new storage owned by 'stock'
+    static void BuildStock(const std::vector<double>& data, CachedStock& stock);
+    // Doubles a stock with these levels takes in an arena or snapshot, alignment padding included
+    static size_t StockFootprint(const std::vector<size_t>& levelOffsets);
+    // Builds into 'slot' (StockFootprint doubles, 64-byte aligned); levelOffsets must already be
+    // set. The caller attaches the slot's owner as the stock's storage.
+    static void BuildStockInto(const std::vector<double>& data, CachedStock& stock, double* slot);
+    // Shared name entry for a library file, created on first use
+    static const StockName* InternName(const std::string& fullPath, const std::string& symbol);
+    static const StockName* FindName(uint32_t id); // nullptr if unknown
+    // Factors from 'from' to 'to' spaced evenly in log scale, 'perOctave' per doubling
+    static std::vector<double> ScaleGrid(double from, double to, int perOctave);
+    // The matched window of 'result' and what followed it, 'count' points in the query's time
+    // base (fewer where the series ends). Resampled matches are interpolated from the raw data.
+    static std::vector<double> MatchSegment(const SearchResult& result, size_t count);
+    // Decodes every .dsp under rootPath. With a snapshotPath, a snapshot that is still current
+    // is mapped and used in place instead, and a fresh one is written after a full decode.
+    size_t LoadLibrary(const std::string& rootPath, const std::string& snapshotPath = "");
+    static std::string DefaultSnapshotPath(const std::string& rootPath) { return rootPath.empty() ? "" : rootPath + ".snapshot"; }
+    static std::string DefaultIndexPath(const std::string& rootPath, size_t windowLength) {
+        return rootPath.empty() ? "" : rootPath + ".isax" + std::to_string(windowLength);
+    }
+    // Lazy mode: only file headers are read now. Series are decoded on first use into an LRU
+    // cache holding at most budgetBytes, and searches prefetch the next few stocks they need.
+    size_t LoadLibraryLazy(const std::string& rootPath, size_t budgetBytes, int prefetchDepth = 4);
+
+    // Rescans the loaded root and decodes only files that are new or whose size, mtime and
+    // content hash changed, then publishes the result as a new library version (and snapshot).
+    // Searches already running finish on the version they started with.
+    // Returns the number of stocks added, updated or removed.
+    size_t RefreshLibrary();
+    // Calls RefreshLibrary every intervalSeconds on a background thread until StopWatching.
+    // No-op if already watching.
+    void StartWatching(int intervalSeconds);
+    void StopWatching();
 
-    // Math Kernels
+    // Current library version (nullptr before the first load). Hold on to it for as long as
+    // its stocks are used; in lazy mode they are headers, use AcquireStock to reach the series.
+    std::shared_ptr<const StockLibrary> GetLibrary() const { return std::atomic_load(&m_Library); }
+    // Stock 'index' of 'library' with its data, decoding it if needed (nullptr if that fails).
+    // The pointer keeps the data alive.
+    static std::shared_ptr<const CachedStock> AcquireStock(const std::shared_ptr<const StockLibrary>& library, size_t index);
+    // Keeps float32 copies of every stock's pyramid (50% more memory) for SearchMode::Float32.
+    // Applies to the loaded library right away (as a new version) and to later loads.
+    void EnableFloat32(bool enabled);
+    bool IsFloat32() const { return m_Float32; }
+    // Keeps the first CachedStock::kDftCoefficients DFT coefficients of every z-normalized window
+    // of windowLength points (0 = off, about 64 bytes per data point) for SearchMode::Dft. They are
+    // computed with a sliding DFT as stocks are loaded; applies to the loaded library right away.
+    void EnableDftFeatures(size_t windowLength);
+    size_t DftWindow() const { return m_DftWindow; }
+    // Builds an iSAX index of the current library for queries of windowLength points (see
+    // SaxIndex), writes it to 'path' and uses it for the Indexed search modes. Stocks added or
+    // changed by later refreshes are scanned until the index is rebuilt.
+    bool BuildIndex(const std::string& path, size_t windowLength);
+    // Uses an index written by BuildIndex; false if it is missing or malformed
+    bool LoadIndex(const std::string& path);
+    bool IsLoaded() const { return GetLibrary() != nullptr; }
+    bool IsLazy() const;
+    uint64_t LibraryVersion() const;
+
+    // Math Kernels (vectorized, see SimdKernels for the CPU dispatch)
     static double CalculatePearson(const double* a, const double* b, size_t size);
     static double CalculateHyperspherical(const double* a, const double* b, size_t size);
 
     // Step 3: Search
     // Query: Uses entire query as pattern.
-    // Returns Top K matches from the library.
-    std::vector<SearchResult> Search(const std::vector<double>& query, bool useFred, int topK = 10, int lookahead = 100);
+    // Returns Top K matches from the library. Repeats of a recent call (same query values and
+    // arguments, same library version) are answered from the result cache.
+    std::vector<SearchResult> Search(const std::vector<double>& query, bool useFred, int topK = 10, int lookahead = 100,
+                                     const SearchOptions& options = SearchOptions());
+    // Runs Search on a background thread and returns at once. The task's snapshot fills in as
+    // stocks finish, so a UI can draw matches while the search runs and cancel it when stale.
+    // Cancelled searches are not cached.
+    std::shared_ptr<SearchTask> SearchAsync(const std::vector<double>& query, bool useFred, int topK = 10,
+                                            int lookahead = 100, const SearchOptions& options = SearchOptions());
+    // Result lists the cache keeps, least recently used dropped first (0 = off)
+    void SetResultCacheSize(size_t entries);
+    static constexpr size_t kDefaultResultCacheSize = 32;
+
+    // Scores many queries in one pass over the library: blocks of stocks sized for L2
+    // are scored against every query before moving on. Returns one Top K list per query.
+    std::vector<std::vector<SearchResult>> SearchBatch(const std::vector<std::vector<double>>& queries, bool useFred,
+                                                       int topK = 10, int lookahead = 100,
+                                                       const SearchOptions& options = SearchOptions());
+
+    AnalysisEngine();
+    ~AnalysisEngine();
 
 private:
-    std::vector<CachedStock> m_Cache;
-    bool m_Loaded = false;
+    // Numbers 'library', gives it a stock cache in lazy mode and makes it current
+    void Publish(std::shared_ptr<StockLibrary> library);
+    // Search through the result cache; 'task' (optional) gets progress and is checked for cancellation
+    std::vector<SearchResult> RunSearch(const std::vector<double>& query, bool useFred, int topK, int lookahead,
+                                        const SearchOptions& options, SearchTask* task);
+    // Search without the result cache, on the given version
+    std::vector<SearchResult> SearchLibrary(const std::shared_ptr<const StockLibrary>& library,
+                                            const std::vector<double>& query, bool useFred, int topK, int lookahead,
+                                            const SearchOptions& options, SearchTask* task);
+
+    std::shared_ptr<const StockLibrary> m_Library; // Swapped with std::atomic_store
+    std::mutex m_LoadMutex;                        // One load or refresh at a time
+    std::string m_RootPath;
+    std::string m_SnapshotPath;
+    size_t m_LazyBudget = 0;                       // 0 = eager
+    int m_PrefetchDepth = 0;
+    std::atomic<bool> m_Float32{ false };
+    std::atomic<size_t> m_DftWindow{ 0 };
+    std::shared_ptr<const SaxIndex> m_Index; // Swapped with std::atomic_store
+    std::unique_ptr<ResultCache> m_ResultCache;
+
+    // Async searches still running; the destructor cancels them and waits
+    std::mutex m_TaskMutex;
+    std::condition_variable m_TaskDone;
+    std::vector<SearchTask*> m_Tasks;
+
+    std::thread m_Watcher;
+    std::mutex m_WatchMutex;
+    std::condition_variable m_WatchWake;
+    bool m_WatchStop = false;
 };
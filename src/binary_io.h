@@ -0,0 +1,61 @@
+#pragma once
+
+// Little helpers shared by the binary files the engine writes and maps back (the library
+// snapshot and the iSAX index): native-endian values appended to a byte buffer, read back
+// through a bounds-checked cursor, with data arrays aligned to kAlignment bytes.
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace BinaryIo {
+
+constexpr uint64_t kAlignment = 64;
+
+inline uint64_t AlignUp(uint64_t n) {
+    return (n + kAlignment - 1) & ~(kAlignment - 1);
+}
+
+template <typename T>
+void Put(std::vector<unsigned char>& out, const T& value) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+inline void PutString(std::vector<unsigned char>& out, const std::string& s) {
+    Put(out, static_cast<uint32_t>(s.size()));
+    out.insert(out.end(), s.begin(), s.end());
+}
+
+// Reads values back in order; 'ok' turns false (and stays false) once a read runs past 'end'
+struct Cursor {
+    const unsigned char* p;
+    const unsigned char* end;
+    bool ok = true;
+
+    template <typename T>
+    T Get() {
+        T value{};
+        if (static_cast<size_t>(end - p) < sizeof(T)) {
+            ok = false;
+            return value;
+        }
+        std::memcpy(&value, p, sizeof(T));
+        p += sizeof(T);
+        return value;
+    }
+
+    std::string GetString() {
+        uint32_t length = Get<uint32_t>();
+        if (!ok || static_cast<size_t>(end - p) < length) {
+            ok = false;
+            return std::string();
+        }
+        std::string s(reinterpret_cast<const char*>(p), length);
+        p += length;
+        return s;
+    }
+};
+
+} // namespace BinaryIo
@@ -0,0 +1,65 @@
+#include "dsp_dictionary.h"
+#include <zdict.h>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+namespace fs = std::filesystem;
+
+DspDictionary::DspDictionary(std::vector<uint8_t> bytes)
+    : m_Bytes(std::move(bytes)) {
+    m_Id = ZDICT_getDictID(m_Bytes.data(), m_Bytes.size()); // 0 for anything that is not a dictionary
+}
+
+DspDictionary::~DspDictionary() {
+    for (auto& entry : m_CDicts) ZSTD_freeCDict(entry.second);
+    ZSTD_freeDDict(m_DDict);
+}
+
+std::shared_ptr<DspDictionary> DspDictionary::Train(const std::vector<std::vector<uint8_t>>& samples, size_t maxBytes) {
+    std::vector<uint8_t> joined;
+    std::vector<size_t> sizes;
+    for (const auto& sample : samples) {
+        if (sample.empty()) continue;
+        joined.insert(joined.end(), sample.begin(), sample.end());
+        sizes.push_back(sample.size());
+    }
+    if (sizes.empty()) return nullptr;
+
+    std::vector<uint8_t> bytes(maxBytes);
+    size_t size = ZDICT_trainFromBuffer(bytes.data(), bytes.size(), joined.data(), sizes.data(),
+                                        static_cast<unsigned>(sizes.size()));
+    if (ZDICT_isError(size)) return nullptr;
+    bytes.resize(size);
+
+    auto dictionary = std::make_shared<DspDictionary>(std::move(bytes));
+    return dictionary->Id() != 0 ? dictionary : nullptr;
+}
+
+std::shared_ptr<DspDictionary> DspDictionary::Load(const std::string& path) {
+    std::ifstream in(fs::u8path(path), std::ios::binary);
+    if (!in) return nullptr;
+    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    auto dictionary = std::make_shared<DspDictionary>(std::move(bytes));
+    return dictionary->Id() != 0 ? dictionary : nullptr;
+}
+
+bool DspDictionary::Save(const std::string& path) const {
+    std::ofstream out(fs::u8path(path), std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+    out.write(reinterpret_cast<const char*>(m_Bytes.data()), static_cast<std::streamsize>(m_Bytes.size()));
+    return static_cast<bool>(out.flush());
+}
+
+const ZSTD_CDict* DspDictionary::CDict(int level) const {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    ZSTD_CDict*& cdict = m_CDicts[level];
+    if (!cdict) cdict = ZSTD_createCDict(m_Bytes.data(), m_Bytes.size(), level);
+    return cdict;
+}
+
+const ZSTD_DDict* DspDictionary::DDict() const {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (!m_DDict) m_DDict = ZSTD_createDDict(m_Bytes.data(), m_Bytes.size());
+    return m_DDict;
+}
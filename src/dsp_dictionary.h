@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <zstd.h>
+
+// Shared zstd dictionary for the SLEB128 delta streams inside .dsp files. Files compressed
+// with one carry its id as "dict_id" in their metadata, and DspReader looks it up in its
+// registry. Dictionaries are saved as <id>.zdict in the library root.
+class DspDictionary {
+public:
+    // 'bytes' must be a zstd dictionary (as produced by Train); check Id() != 0
+    explicit DspDictionary(std::vector<uint8_t> bytes);
+    ~DspDictionary();
+    DspDictionary(const DspDictionary&) = delete;
+    DspDictionary& operator=(const DspDictionary&) = delete;
+
+    // Trains on sample streams (what the writer hands to zstd). nullptr if zstd cannot
+    // build a dictionary from them, e.g. too few samples.
+    static std::shared_ptr<DspDictionary> Train(const std::vector<std::vector<uint8_t>>& samples, size_t maxBytes);
+    // nullptr if the file is missing or not a zstd dictionary
+    static std::shared_ptr<DspDictionary> Load(const std::string& path);
+    bool Save(const std::string& path) const;
+    static std::string FileName(uint32_t id) { return std::to_string(id) + ".zdict"; }
+
+    uint32_t Id() const { return m_Id; }
+    size_t Size() const { return m_Bytes.size(); }
+
+    // Digested forms, built on first use and shared by all threads (zstd only reads them)
+    const ZSTD_CDict* CDict(int level) const;
+    const ZSTD_DDict* DDict() const;
+
+private:
+    std::vector<uint8_t> m_Bytes;
+    uint32_t m_Id = 0;
+
+    mutable std::mutex m_Mutex;
+    mutable std::map<int, ZSTD_CDict*> m_CDicts; // By compression level
+    mutable ZSTD_DDict* m_DDict = nullptr;
+};
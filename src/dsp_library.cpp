@@ -1,6 +1,10 @@
 #include "dsp_library.h"
+#include "mapped_file.h"
 #include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <iterator>
+#include <omp.h>
 
 namespace fs = std::filesystem;
 
@@ -24,108 +28,150 @@ std::string PathToUtf8(const fs::path& path) {
     }
 }
 
-std::vector<DspFileEntry> DspLibrary::Scan(const std::string& rootPath) {
-    std::vector<DspFileEntry> entries;
-    
-    if (rootPath.empty() || !fs::exists(rootPath)) {
-        return entries;
+namespace {
+
+// UTF-8 path with forward slashes
+std::string NormalizedUtf8(const fs::path& path) {
+    std::string s;
+    try {
+        // C++20/C++17 mixed compatibility attempt
+        auto u8Str = path.u8string();
+        s = std::string(reinterpret_cast<const char*>(u8Str.c_str()));
+    } catch (...) {
+        // Fallback - might throw "No mapping", handled by the caller
+        s = path.string();
     }
+    std::replace(s.begin(), s.end(), '\\', '/');
+    return s;
+}
+
+// Library entry for 'entry' if it is a .dsp we search. The extension is checked before the
+// file type, which comes from the directory listing, so rejected names cost no stat.
+bool MakeEntry(const fs::directory_entry& entry, const std::string& rootPrefix, DspFileEntry& e) {
+    if (entry.path().extension() != ".dsp" || !entry.is_regular_file()) return false;
+
+    // Filter out unwanted prefixes
+    // "daily", "function", "f(x)"
+    // Check exact start match.
+    std::string filename = entry.path().filename().string();
+    if (filename.find("daily") == 0 ||
+        filename.find("function") == 0 ||
+        filename.find("f(x)") == 0) {
+        return false;
+    }
+
+    e.fullPath = NormalizedUtf8(entry.path());
+    // Paths come from iterating the root, so the relative name is a plain suffix (no fs::relative)
+    if (e.fullPath.compare(0, rootPrefix.size(), rootPrefix) == 0) {
+        e.displayName = e.fullPath.substr(rootPrefix.size());
+    } else {
+        e.displayName = NormalizedUtf8(entry.path().filename());
+    }
+    return true;
+}
 
-    // Reserve some space
-    entries.reserve(3000);
+// Immediate children of 'dir': .dsp files into 'files', real directories into 'subdirs'.
+// False if 'dir' could not be listed.
+bool ListDirectory(const fs::path& dir, const std::string& rootPrefix,
+                   std::vector<fs::path>& subdirs, std::vector<DspFileEntry>& files) {
+    try {
+        for (const auto& entry : fs::directory_iterator(dir, fs::directory_options::skip_permission_denied)) {
+            try {
+                if (entry.is_directory() && !entry.is_symlink()) {
+                    subdirs.push_back(entry.path());
+                    continue;
+                }
+                DspFileEntry e;
+                if (MakeEntry(entry, rootPrefix, e)) files.push_back(std::move(e));
+            } catch (const std::exception&) {
+                // Silenced unicode errors to prevent console spam
+            }
+        }
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
 
+// Everything below 'dir', on the calling thread
+void ScanTree(const fs::path& dir, const std::string& rootPrefix, std::vector<DspFileEntry>& files) {
     // Use a manual iterator loop to handle per-entry exceptions
     try {
-        auto it = fs::recursive_directory_iterator(rootPath, fs::directory_options::skip_permission_denied);
+        auto it = fs::recursive_directory_iterator(dir, fs::directory_options::skip_permission_denied);
         auto end = fs::recursive_directory_iterator();
 
         while (it != end) {
             try {
-                const auto& entry = *it;
-                
-                if (entry.is_regular_file() && entry.path().extension() == ".dsp") {
-                    std::string filename = entry.path().filename().string();
-                    
-                    // Filter out unwanted prefixes
-                    // "daily", "function", "f(x)"
-                    // Check exact start match. 
-                    if (filename.find("daily") == 0 || 
-                        filename.find("function") == 0 || 
-                        filename.find("f(x)") == 0) {
-                        ++it;
-                        continue;
-                    }
-
-                    DspFileEntry e;
-                    
-                    // Try to get UTF-8 string, fallback to sensitive string if fails
-                    try {
-                        // C++20/C++17 mixed compatibility attempt
-                        auto u8Str = entry.path().u8string(); 
-                        e.fullPath = std::string(reinterpret_cast<const char*>(u8Str.c_str()));
-                    } catch (...) {
-                         // Fallback - might throw "No mapping"
-                         e.fullPath = entry.path().string();
-                    }
-
-                    try {
-                        auto rel = fs::relative(entry.path(), rootPath);
-                        auto u8Rel = rel.u8string();
-                        e.displayName = std::string(reinterpret_cast<const char*>(u8Rel.c_str()));
-                    } catch (...) {
-                         e.displayName = entry.path().filename().string();
-                    }
-
-                    // Normalize slashes
-                    std::replace(e.displayName.begin(), e.displayName.end(), '\\', '/');
-                    std::replace(e.fullPath.begin(), e.fullPath.end(), '\\', '/');
-
-                    entries.push_back(e);
-                }
-                
-                // Increment iterator
-                // If increment throws (e.g. permission denied), we must handle it.
-                // However, standard iterator increment can throw.
-                // We need to catch exceptions during increment too.
+                DspFileEntry e;
+                if (MakeEntry(*it, rootPrefix, e)) files.push_back(std::move(e));
                 ++it;
-
-            } catch (const std::exception& e) {
-                // Silenced unicode errors to prevent console spam
-                // std::cerr << "Skipping entry due to error: " << e.what() << std::endl;
-                // If the error was in processing, we need to increment to continue.
-                // BUT if increment threw, we are in trouble.
-                // Usually skip_permission_denied handles directory access issues.
-                // The "unicode mapping" error usually happens on .string(), so inside the loop body.
-                // So we are safe to just catch and loop current iterator is valid?
-                // If we caught inside the body, 'it' is still valid. We need to increment it.
-                // But wait, if we are in the catch block, we haven't incremented.
-                // So we should try to increment if possible, or break if iterator is broken.
-                
-                // For simplicity, if we fail to process an entry, we try to increment.
-                // If increment fails, we might get stuck or crash.
-                // Let's assume standard increment is safe if we didn't corrupt state.
-                // Actually, if 'it' invalidates, we can't increment.
-                // simpler approach:
-                // recursive_directory_iterator increment can throw.
-                // We are inside the while loop.
+            } catch (const std::exception&) {
+                // Silenced unicode errors to prevent console spam. The body threw before the
+                // increment, so 'it' is still valid; if incrementing fails too, give up on this tree.
                 try {
-                     // If we are here, we processed (or failed to process) the current entry.
-                     // The increment was at the end of the try block.
-                     // If the exception happened BEFORE increment, we need to increment now.
-                     // BUT we don't know if we already incremented? 
-                     // No, current logic has ++it at end of try block.
-                     // So if exception hit, we did NOT increment.
-                     ++it; 
-                } catch(...) {
-                    // If increment fails, we probably can't continue safely.
-                    break; 
+                    ++it;
+                } catch (...) {
+                    break;
                 }
             }
         }
     } catch (const std::exception& e) {
         std::cerr << "Critical Scan error: " << e.what() << std::endl;
     }
-    
+}
+
+} // namespace
+
+std::vector<DspFileEntry> DspLibrary::Scan(const std::string& rootPath) {
+    std::vector<DspFileEntry> entries;
+
+    std::error_code ec;
+    if (rootPath.empty() || !fs::exists(rootPath, ec)) {
+        return entries;
+    }
+
+    const fs::path root(rootPath);
+    std::string rootPrefix = NormalizedUtf8(root);
+    if (!rootPrefix.empty() && rootPrefix.back() != '/') rootPrefix += '/';
+
+    // Fan out over the letter and ticker directories: list the top of the tree level by level
+    // until there is enough independent work for every thread, then walk the subtrees in parallel
+    std::vector<fs::path> dirs;
+    if (!ListDirectory(root, rootPrefix, dirs, entries)) {
+        std::cerr << "Critical Scan error: cannot list " << rootPath << std::endl;
+        return entries;
+    }
+    const size_t wanted = static_cast<size_t>(4 * omp_get_max_threads());
+    for (int depth = 0; depth < 2 && !dirs.empty() && dirs.size() < wanted; ++depth) {
+        std::vector<std::vector<fs::path>> subdirs(dirs.size());
+        std::vector<std::vector<DspFileEntry>> files(dirs.size());
+
+        #pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < static_cast<int>(dirs.size()); ++i) {
+            ListDirectory(dirs[i], rootPrefix, subdirs[i], files[i]);
+        }
+
+        std::vector<fs::path> next;
+        for (size_t i = 0; i < dirs.size(); ++i) {
+            next.insert(next.end(), subdirs[i].begin(), subdirs[i].end());
+            entries.insert(entries.end(), files[i].begin(), files[i].end());
+        }
+        dirs.swap(next);
+    }
+
+    std::vector<std::vector<DspFileEntry>> found(dirs.size());
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < static_cast<int>(dirs.size()); ++i) {
+        ScanTree(dirs[i], rootPrefix, found[i]);
+    }
+    for (auto& files : found) {
+        entries.insert(entries.end(), std::make_move_iterator(files.begin()), std::make_move_iterator(files.end()));
+    }
+
+    // Same list whatever the thread timing or directory order
+    std::sort(entries.begin(), entries.end(), [](const DspFileEntry& a, const DspFileEntry& b) {
+        return a.fullPath < b.fullPath;
+    });
     return entries;
 }
 
@@ -141,3 +187,36 @@ std::string DspLibrary::FindRoot(const std::string& target) {
     }
     return "";
 }
+
+bool DspLibrary::Stamp(const std::string& path, DspFileStamp& stamp) {
+    std::error_code ec;
+    fs::path p = fs::u8path(path);
+    stamp.path = path;
+    stamp.hash = 0;
+    stamp.size = static_cast<uint64_t>(fs::file_size(p, ec));
+    if (ec) return false;
+    auto time = fs::last_write_time(p, ec);
+    if (ec) return false;
+    stamp.mtime = static_cast<int64_t>(time.time_since_epoch().count());
+    return true;
+}
+
+uint64_t DspLibrary::HashFile(const std::string& path) {
+    MappedFile file;
+    if (!file.Open(path)) return 0;
+
+    // FNV-1a over 8-byte words (then the tail bytes): only has to spot changed content
+    const uint64_t prime = 0x100000001B3ULL;
+    uint64_t hash = 0xCBF29CE484222325ULL ^ file.Size();
+    const unsigned char* p = file.Data();
+    size_t words = file.Size() / 8;
+    for (size_t i = 0; i < words; ++i, p += 8) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        hash = (hash ^ word) * prime;
+    }
+    for (size_t i = words * 8; i < file.Size(); ++i, ++p) {
+        hash = (hash ^ *p) * prime;
+    }
+    return hash != 0 ? hash : 1;
+}
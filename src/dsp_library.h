@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <filesystem>
@@ -9,6 +10,14 @@ struct DspFileEntry {
     std::string displayName; // e.g. "REL2/src/save_files/A/AAPL/AAPL20(S1).dsp" or just "AAPL20(S1).dsp"
 };
 
+// Identity of a .dsp on disk, used to tell whether it changed since it was decoded
+struct DspFileStamp {
+    std::string path;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    uint64_t hash = 0; // Content hash (HashFile), 0 if not computed
+};
+
 class DspLibrary {
 public:
     // Recursively finds all .dsp files in the given directory
@@ -16,4 +25,10 @@ public:
 
     // Attempts to find a directory named 'target' by checking current path and parents
     static std::string FindRoot(const std::string& target = "src/save_files");
+
+    // Size and modification time of 'path' (hash left at 0). False if the file is gone.
+    static bool Stamp(const std::string& path, DspFileStamp& stamp);
+
+    // Hash of the file contents, never 0 for a readable file (0 = could not read it)
+    static uint64_t HashFile(const std::string& path);
 };
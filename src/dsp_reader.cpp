@@ -1,133 +1,434 @@
 #include "dsp_reader.h"
-#include <fstream>
+#include "dsp_dictionary.h"
+#include "mapped_file.h"
+#include "simd_kernels.h"
 #include <iostream>
 #include <stdexcept>
 #include <cmath>
 #include <zstd.h>
+#include <charconv>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include <algorithm>
+#include <cstring>
 #include <filesystem>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
 
 // Helper to read Big Endian uint32
-uint32_t ReadU32BE(std::ifstream& f) {
-    unsigned char bytes[4];
-    f.read(reinterpret_cast<char*>(bytes), 4);
-    if (!f) throw std::runtime_error("Failed to read 4 bytes");
-    return (static_cast<uint32_t>(bytes[0]) << 24) |
-           (static_cast<uint32_t>(bytes[1]) << 16) |
-           (static_cast<uint32_t>(bytes[2]) << 8) |
-           static_cast<uint32_t>(bytes[3]);
+static uint32_t ReadU32BE(const unsigned char*& p, const unsigned char* end) {
+    if (end - p < 4) throw std::runtime_error("Failed to read 4 bytes");
+    uint32_t v = (static_cast<uint32_t>(p[0]) << 24) |
+                 (static_cast<uint32_t>(p[1]) << 16) |
+                 (static_cast<uint32_t>(p[2]) << 8) |
+                 static_cast<uint32_t>(p[3]);
+    p += 4;
+    return v;
 }
 
+namespace {
+
+// Per-thread decode state, reused across files
+struct ReaderScratch {
+    ZSTD_DCtx* dctx = ZSTD_createDCtx();
+    std::vector<uint8_t> enc1;
+    std::vector<uint8_t> enc2;
+    std::vector<double> block; // Whole blocks (or a whole v1 series) behind a partial range
+
+    ~ReaderScratch() { ZSTD_freeDCtx(dctx); }
+};
+
+ReaderScratch& Scratch() {
+    thread_local ReaderScratch scratch;
+    return scratch;
+}
+
+// Dictionaries known to the reader, by id
+struct DictionaryRegistry {
+    std::mutex mutex;
+    std::unordered_map<uint32_t, std::shared_ptr<const DspDictionary>> byId;
+};
+
+DictionaryRegistry& Dictionaries() {
+    static DictionaryRegistry registry;
+    return registry;
+}
+
+// Decompresses one frame into 'dst', growing it only when a larger frame comes along.
+// Returns the decompressed size.
+size_t Decompress(ZSTD_DCtx* dctx, const ZSTD_DDict* ddict, const unsigned char* src, size_t srcSize,
+                  std::vector<uint8_t>& dst) {
+    if (srcSize == 0) return 0;
+    unsigned long long const rSize = ZSTD_getFrameContentSize(src, srcSize);
+    if (rSize == ZSTD_CONTENTSIZE_ERROR) throw std::runtime_error("Not a zstd file");
+    if (rSize == ZSTD_CONTENTSIZE_UNKNOWN) throw std::runtime_error("Original size unknown");
+
+    if (dst.size() < rSize) dst.resize(rSize);
+    size_t const dSize = ddict ? ZSTD_decompress_usingDDict(dctx, dst.data(), rSize, src, srcSize, ddict)
+                               : ZSTD_decompressDCtx(dctx, dst.data(), rSize, src, srcSize);
+    if (ZSTD_isError(dSize)) throw std::runtime_error(std::string("ZSTD decompress error: ") + ZSTD_getErrorName(dSize));
+    return dSize;
+}
+
+// Header fields every .dsp carries
+struct DspMeta {
+    int n = -1;
+    int version = 1;
+    uint32_t dictId = 0;
+    double totalInvestment = 0.0;
+    int smoothValue = 0;
+    bool hasInvestment = false;
+    bool hasSmooth = false;
+    const char* format = nullptr;
+    size_t formatLength = 0;
+};
+
+// Allocation-free scan of the flat {"key": number|string, ...} metadata our v1 writers produce.
+// Returns false on anything else (escapes, nesting such as the v2 block index, missing fields)
+// so the caller can fall back to the full JSON parser.
+bool ScanMetadata(const char* p, const char* end, DspMeta& meta) {
+    auto skipSpace = [&]() {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) ++p;
+    };
+    auto readString = [&](const char*& str, size_t& length) {
+        if (p >= end || *p != '"') return false;
+        str = ++p;
+        while (p < end && *p != '"') {
+            if (*p == '\\') return false;
+            ++p;
+        }
+        if (p >= end) return false;
+        length = static_cast<size_t>(p - str);
+        ++p;
+        return true;
+    };
+    auto readNumber = [&](double& value) {
+        auto res = std::from_chars(p, end, value);
+        if (res.ec != std::errc()) return false;
+        p = res.ptr;
+        return true;
+    };
+
+    skipSpace();
+    if (p >= end || *p++ != '{') return false;
+    for (;;) {
+        skipSpace();
+        const char* key;
+        size_t keyLength;
+        if (!readString(key, keyLength)) return false;
+        skipSpace();
+        if (p >= end || *p++ != ':') return false;
+        skipSpace();
+
+        std::string_view name(key, keyLength);
+        if (p < end && *p == '"') {
+            const char* str;
+            size_t length;
+            if (!readString(str, length)) return false;
+            if (name == "format") {
+                meta.format = str;
+                meta.formatLength = length;
+            }
+        } else {
+            double value;
+            if (!readNumber(value)) return false;
+            if (name == "n") meta.n = static_cast<int>(value);
+            else if (name == "version") meta.version = static_cast<int>(value);
+            else if (name == "dict_id") meta.dictId = static_cast<uint32_t>(value);
+            else if (name == "total_investment") { meta.totalInvestment = value; meta.hasInvestment = true; }
+            else if (name == "smooth_value") { meta.smoothValue = static_cast<int>(value); meta.hasSmooth = true; }
+        }
+
+        skipSpace();
+        if (p < end && *p == ',') { ++p; continue; }
+        if (p < end && *p == '}') break;
+        return false;
+    }
+    return meta.n >= 0 && meta.hasInvestment && meta.hasSmooth && meta.version == 1;
+}
+
+// Lowest set bit index of a non-zero word
+inline int CountTrailingZeros(uint64_t v) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, v);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(v);
+#endif
+}
+
+// Reads one SLEB128 value and advances 'p'. With 8 readable bytes, values up to 8 bytes long
+// (56 bits) are decoded branch-free from one little-endian word; otherwise byte by byte.
+inline int64_t ReadSleb128(const uint8_t*& p, const uint8_t* end) {
+    if (end - p >= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        uint64_t stops = ~word & 0x8080808080808080ULL; // High bit clear = last byte
+        if (stops) {
+            int length = CountTrailingZeros(stops) / 8 + 1;
+            uint64_t x = word & (~0ULL >> (64 - 8 * length));
+            // Squeeze out the continuation bits: 7-bit groups -> 14 -> 28 -> 56
+            x &= 0x7F7F7F7F7F7F7F7FULL;
+            x = ((x & 0x7F007F007F007F00ULL) >> 1) | (x & 0x007F007F007F007FULL);
+            x = ((x & 0x3FFF00003FFF0000ULL) >> 2) | (x & 0x00003FFF00003FFFULL);
+            x = ((x & 0x0FFFFFFF00000000ULL) >> 4) | (x & 0x000000000FFFFFFFULL);
+            // Sign extension from bit 6 of the last byte (no branch: signs are random)
+            uint64_t sign = (word >> (8 * length - 2)) & 1;
+            x |= (0 - sign) << (7 * length);
+            p += length;
+            return static_cast<int64_t>(x);
+        }
+    }
+
+    int64_t val = 0;
+    int shift = 0;
+    uint8_t byte;
+    do {
+        if (p >= end) throw std::runtime_error("Buffer underflow");
+        byte = *p++;
+        if (shift < 64) val |= (static_cast<int64_t>(byte & 0x7F) << shift);
+        shift += 7;
+    } while (byte & 0x80);
+
+    // Sign extension
+    if ((shift < 64) && (byte & 0x40)) {
+        val |= (~0ULL << shift);
+    }
+    return val;
+}
+
+} // namespace
+
 DspData DspReader::Load(const std::string& filepath) {
-    std::ifstream f(filepath, std::ios::binary);
-    if (!f.is_open()) {
+    DspData result;
+    LoadInto(filepath, result);
+    return result;
+}
+
+void DspReader::LoadHeader(const std::string& filepath, DspData& out) {
+    MappedFile file; // Only the first page or so is ever touched
+    if (!file.Open(filepath)) {
         throw std::runtime_error("Could not open file: " + filepath);
     }
+    const unsigned char* p = file.Data();
+    ReadMetadata(p, p + file.Size(), out);
+    out.values.clear();
+}
+
+void DspReader::ReadMetadata(const unsigned char*& p, const unsigned char* end, DspData& out) {
+    uint32_t meta_len = ReadU32BE(p, end);
+    if (static_cast<size_t>(end - p) < meta_len) throw std::runtime_error("Truncated metadata");
+    const char* metaText = reinterpret_cast<const char*>(p);
+    DspMeta meta;
+    if (!ScanMetadata(metaText, metaText + meta_len, meta)) {
+        nlohmann::json meta_json = nlohmann::json::parse(p, p + meta_len);
+        meta.n = meta_json["n"];
+        meta.totalInvestment = meta_json["total_investment"];
+        meta.smoothValue = meta_json["smooth_value"];
+        meta.version = meta_json.value("version", 1);
+        meta.dictId = meta_json.value("dict_id", 0u);
+        out.format = meta_json.value("format", "unknown");
+        out.blocks.clear();
+        if (meta.version == 2) {
+            for (const auto& b : meta_json.at("blocks")) {
+                DspBlock block;
+                block.start = b.at("start");
+                block.count = b.at("count");
+                block.offset = b.at("offset");
+                block.size = b.at("size");
+                block.min = b.value("min", 0.0);
+                block.max = b.value("max", 0.0);
+                block.mean = b.value("mean", 0.0);
+                block.stddev = b.value("std", 0.0);
+                out.blocks.push_back(block);
+            }
+        }
+    } else if (meta.format) {
+        out.format.assign(meta.format, meta.formatLength);
+    } else {
+        out.format = "unknown";
+    }
+    p += meta_len;
+
+    if (meta.n < 0) throw std::runtime_error("Negative point count");
+    if (meta.version < 1 || meta.version > 2) throw std::runtime_error("Unsupported .dsp version " + std::to_string(meta.version));
+    out.n = static_cast<size_t>(meta.n);
+    out.total_investment = meta.totalInvestment;
+    out.smooth_value = meta.smoothValue;
+    out.version = meta.version;
+    out.dict_id = meta.dictId;
+    if (out.version == 1) {
+        out.blocks.clear();
+        return;
+    }
+
+    // Blocks must tile [0, n) in order and lie inside the file
+    const size_t bodySize = static_cast<size_t>(end - p);
+    size_t next = 0;
+    for (const DspBlock& block : out.blocks) {
+        if (block.start != next || block.count == 0 || block.offset > bodySize || block.size > bodySize - block.offset) {
+            throw std::runtime_error("Corrupt block index");
+        }
+        next += block.count;
+    }
+    if (next != out.n) throw std::runtime_error("Block index does not cover the series");
+}
+
+void DspReader::LoadInto(const std::string& filepath, DspData& out) {
+    MappedFile file;
+    if (!file.Open(filepath)) {
+        throw std::runtime_error("Could not open file: " + filepath);
+    }
+    const unsigned char* p = file.Data();
+    const unsigned char* end = p + file.Size();
 
     // 1. Read Metadata
-    uint32_t meta_len = ReadU32BE(f);
-    std::vector<char> meta_buf(meta_len);
-    f.read(meta_buf.data(), meta_len);
-    nlohmann::json meta_json = nlohmann::json::parse(meta_buf.begin(), meta_buf.end());
-
-    int n = meta_json["n"];
-    double total_investment = meta_json["total_investment"];
-    int smooth_value = meta_json["smooth_value"];
-
-    // 2. Read Compressed Part 1
-    uint32_t c1_len = ReadU32BE(f);
-    std::vector<char> c1_buf(c1_len);
-    f.read(c1_buf.data(), c1_len);
-
-    // 3. Read Compressed Part 2
-    uint32_t c2_len = ReadU32BE(f);
-    std::vector<char> c2_buf(c2_len);
-    f.read(c2_buf.data(), c2_len);
-
-    // 4. Decompress
-    auto Decompress = [](const std::vector<char>& src) -> std::vector<uint8_t> {
-        if (src.empty()) return {};
-        unsigned long long const rSize = ZSTD_getFrameContentSize(src.data(), src.size());
-        if (rSize == ZSTD_CONTENTSIZE_ERROR) throw std::runtime_error("Not a zstd file");
-        if (rSize == ZSTD_CONTENTSIZE_UNKNOWN) throw std::runtime_error("Original size unknown");
-
-        std::vector<uint8_t> dst(rSize);
-        size_t const dSize = ZSTD_decompress(dst.data(), rSize, src.data(), src.size());
-        if (ZSTD_isError(dSize)) throw std::runtime_error(std::string("ZSTD decompress error: ") + ZSTD_getErrorName(dSize));
-        return dst;
-    };
+    ReadMetadata(p, end, out);
+    std::shared_ptr<const DspDictionary> dictionary = FindDictionary(out);
+    const ZSTD_DDict* ddict = dictionary ? dictionary->DDict() : nullptr;
 
-    std::vector<uint8_t> enc1 = Decompress(c1_buf);
-    std::vector<uint8_t> enc2 = Decompress(c2_buf);
+    // 2. Decompress and decode straight into the output (v2: block by block)
+    out.values.resize(out.n);
+    if (out.version == 2) {
+        DecodeBlocks(p, out, ddict, 0, out.n, out.values.data());
+    } else {
+        DecodeFrames(p, end, ddict, out.values.data(), out.n);
+    }
 
-    // 5. Decode SLEB128 & Delta
-    std::vector<int64_t> deltas1 = DecodeSleb128(enc1);
-    std::vector<int64_t> deltas2 = DecodeSleb128(enc2);
+    // 3. Reverse log transformation: val = T * (exp(normalized) - 1)
+    // Check for zero investment (FRED data case): values stay normalized
+    if (std::abs(out.total_investment) >= 1e-9) {
+        SimdKernels::ExpMinusOneScaled(out.values.data(), out.values.size(), out.total_investment);
+    }
+}
 
-    if (deltas1.size() != n || deltas2.size() != n) {
-        throw std::runtime_error("Decoded count mismatch. Expected " + std::to_string(n) + 
-                               ", got " + std::to_string(deltas1.size()) + " and " + std::to_string(deltas2.size()));
+void DspReader::LoadRange(const std::string& filepath, size_t first, size_t count, DspData& out) {
+    MappedFile file;
+    if (!file.Open(filepath)) {
+        throw std::runtime_error("Could not open file: " + filepath);
     }
+    const unsigned char* p = file.Data();
+    const unsigned char* end = p + file.Size();
+    ReadMetadata(p, end, out);
+    std::shared_ptr<const DspDictionary> dictionary = FindDictionary(out);
+    const ZSTD_DDict* ddict = dictionary ? dictionary->DDict() : nullptr;
 
-    std::vector<int64_t> part1 = DeltaDecode(deltas1);
-    std::vector<int64_t> part2 = DeltaDecode(deltas2);
+    first = std::min(first, out.n);
+    count = std::min(count, out.n - first);
+    out.values.resize(count);
+    if (out.version == 2) {
+        DecodeBlocks(p, out, ddict, first, count, out.values.data());
+    } else if (count > 0) {
+        // One pair of frames for the whole series: nothing to skip
+        std::vector<double>& all = Scratch().block;
+        all.resize(out.n);
+        DecodeFrames(p, end, ddict, all.data(), out.n);
+        std::copy(all.begin() + first, all.begin() + first + count, out.values.begin());
+    }
 
-    // 6. Reconstruct values
-    DspData result;
-    result.total_investment = total_investment;
-    result.smooth_value = smooth_value;
-    result.n = n;
-    result.format = meta_json.value("format", "unknown");
-    result.values.reserve(n);
-
-    for (int i = 0; i < n; ++i) {
-        int64_t scaled = part1[i] * 10000 + part2[i];
-        double normalized = static_cast<double>(scaled) / 1e8;
-        
-        double val;
-        // Check for zero investment (FRED data case)
-        if (std::abs(total_investment) < 1e-9) {
-            val = normalized;
-        } else {
-            // Standard case: Reverse log transformation
-            // val = T * (exp(normalized) - 1)
-            val = total_investment * (std::exp(normalized) - 1.0);
+    if (std::abs(out.total_investment) >= 1e-9) {
+        SimdKernels::ExpMinusOneScaled(out.values.data(), out.values.size(), out.total_investment);
+    }
+}
+
+void DspReader::RegisterDictionary(std::shared_ptr<const DspDictionary> dictionary) {
+    if (!dictionary || dictionary->Id() == 0) return;
+    DictionaryRegistry& registry = Dictionaries();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.byId[dictionary->Id()] = std::move(dictionary);
+}
+
+size_t DspReader::RegisterDictionaries(const std::string& dir) {
+    namespace fs = std::filesystem;
+    size_t count = 0;
+    std::error_code ec;
+    for (fs::directory_iterator it(fs::u8path(dir), ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->path().extension() != ".zdict") continue;
+        auto u8 = it->path().u8string();
+        if (auto dictionary = DspDictionary::Load(std::string(reinterpret_cast<const char*>(u8.c_str())))) {
+            RegisterDictionary(std::move(dictionary));
+            ++count;
         }
-        result.values.push_back(val);
     }
+    return count;
+}
 
-    return result;
+std::shared_ptr<const DspDictionary> DspReader::FindDictionary(const DspData& meta) {
+    if (meta.dict_id == 0) return nullptr;
+    DictionaryRegistry& registry = Dictionaries();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    auto it = registry.byId.find(meta.dict_id);
+    if (it == registry.byId.end()) throw std::runtime_error("Missing zstd dictionary " + std::to_string(meta.dict_id));
+    return it->second;
 }
 
-std::vector<int64_t> DspReader::DecodeSleb128(const std::vector<uint8_t>& buffer) {
-    std::vector<int64_t> result;
-    size_t idx = 0;
-    while (idx < buffer.size()) {
-        int64_t val = 0;
-        int shift = 0;
-        uint8_t byte;
-        do {
-            if (idx >= buffer.size()) throw std::runtime_error("Buffer underflow");
-            byte = buffer[idx++];
-            val |= (static_cast<int64_t>(byte & 0x7F) << shift);
-            shift += 7;
-        } while (byte & 0x80);
-
-        // Sign extension
-        if ((shift < 64) && (byte & 0x40)) {
-            val |= (~0ULL << shift); 
+void DspReader::DecodeFrames(const unsigned char* p, const unsigned char* end, const ZSTD_DDict* ddict,
+                             double* out, size_t count) {
+    // Compressed parts are used in place from the mapping
+    uint32_t c1_len = ReadU32BE(p, end);
+    if (static_cast<size_t>(end - p) < c1_len) throw std::runtime_error("Truncated part 1");
+    const unsigned char* c1 = p;
+    p += c1_len;
+
+    uint32_t c2_len = ReadU32BE(p, end);
+    if (static_cast<size_t>(end - p) < c2_len) throw std::runtime_error("Truncated part 2");
+    const unsigned char* c2 = p;
+
+    // Decompress with the thread's context into its scratch buffers
+    ReaderScratch& scratch = Scratch();
+    size_t enc1Size = Decompress(scratch.dctx, ddict, c1, c1_len, scratch.enc1);
+    size_t enc2Size = Decompress(scratch.dctx, ddict, c2, c2_len, scratch.enc2);
+
+    // SLEB128, Delta and the split8 recombination in one pass
+    DecodeSplit8(scratch.enc1.data(), enc1Size, scratch.enc2.data(), enc2Size, out, count);
+}
+
+void DspReader::DecodeBlocks(const unsigned char* body, const DspData& meta, const ZSTD_DDict* ddict,
+                             size_t first, size_t count, double* out) {
+    if (count == 0) return;
+
+    // Blocks tile [0, n) in order: binary search for the one holding 'first'
+    auto block = std::upper_bound(meta.blocks.begin(), meta.blocks.end(), first,
+                                  [](size_t index, const DspBlock& b) { return index < b.start; });
+    --block;
+    const size_t last = first + count;
+    for (; block != meta.blocks.end() && block->start < last; ++block) {
+        const unsigned char* frames = body + block->offset;
+        const size_t from = std::max(first, block->start);
+        const size_t to = std::min(last, block->start + block->count);
+        if (from == block->start && to == block->start + block->count) {
+            DecodeFrames(frames, frames + block->size, ddict, out + (from - first), block->count);
+        } else {
+            // Partly wanted: decode the whole block aside and keep the overlap
+            std::vector<double>& whole = Scratch().block;
+            whole.resize(block->count);
+            DecodeFrames(frames, frames + block->size, ddict, whole.data(), block->count);
+            std::copy(whole.begin() + (from - block->start), whole.begin() + (to - block->start), out + (from - first));
         }
-        result.push_back(val);
     }
-    return result;
 }
 
-std::vector<int64_t> DspReader::DeltaDecode(const std::vector<int64_t>& deltas) {
-    std::vector<int64_t> result;
-    result.reserve(deltas.size());
-    int64_t accum = 0;
-    for (int64_t d : deltas) {
-        accum += d;
-        result.push_back(accum);
+void DspReader::DecodeSplit8(const uint8_t* enc1, size_t size1, const uint8_t* enc2, size_t size2,
+                             double* out, size_t count) {
+    const uint8_t* p1 = enc1;
+    const uint8_t* p2 = enc2;
+    const uint8_t* end1 = enc1 + size1;
+    const uint8_t* end2 = enc2 + size2;
+    int64_t part1 = 0;
+    int64_t part2 = 0;
+    size_t i = 0;
+    for (; i < count && p1 < end1 && p2 < end2; ++i) {
+        part1 += ReadSleb128(p1, end1);
+        part2 += ReadSleb128(p2, end2);
+        int64_t scaled = part1 * 10000 + part2;
+        out[i] = static_cast<double>(scaled) / 1e8;
+    }
+
+    if (i != count || p1 != end1 || p2 != end2) {
+        throw std::runtime_error("Decoded count mismatch. Expected " + std::to_string(count) +
+                                 ", streams ended at " + std::to_string(i));
     }
-    return result;
 }
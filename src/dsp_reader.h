@@ -2,14 +2,33 @@
 
 #include <vector>
 #include <string>
+#include <memory>
+#include <zstd.h>
 #include <nlohmann/json.hpp>
 
+class DspDictionary;
+
+// One independently compressed block of a v2 file, with stats of its decoded values
+struct DspBlock {
+    size_t start = 0;  // Index of the first point
+    size_t count = 0;
+    size_t offset = 0; // Byte offset of the block's two frames, counted from the end of the metadata
+    size_t size = 0;   // Bytes of both length-prefixed frames
+    double min = 0.0;
+    double max = 0.0;
+    double mean = 0.0;
+    double stddev = 0.0;
+};
+
 struct DspData {
     std::vector<double> values;
     double total_investment;
     int smooth_value;
     std::string format;
     size_t n;
+    int version = 1;              // 1: two frames for the whole series, 2: block-indexed
+    std::vector<DspBlock> blocks; // v2 only
+    uint32_t dict_id = 0;         // zstd dictionary the frames need, 0 = none
     
     // Helper to get descriptive name
     std::string GetName() const {
@@ -21,7 +40,38 @@ class DspReader {
 public:
     static DspData Load(const std::string& filepath);
 
+    // Same as Load, but decodes into 'out' and reuses its storage. The file is memory-mapped
+    // and the zstd context and scratch buffers are per thread, so a loop that keeps one
+    // DspData per thread stops allocating once the buffers have grown to the largest file.
+    static void LoadInto(const std::string& filepath, DspData& out);
+
+    // Reads only the metadata (n, total_investment, smooth_value, format, v2 block index);
+    // 'values' is left empty
+    static void LoadHeader(const std::string& filepath, DspData& out);
+
+    // Points [first, first + count) only, clamped to the series; 'n' stays the full length.
+    // v2 files decode just the blocks that overlap the range, v1 files decode everything.
+    static void LoadRange(const std::string& filepath, size_t first, size_t count, DspData& out);
+
+    // Files with a "dict_id" decode only once that dictionary is registered
+    static void RegisterDictionary(std::shared_ptr<const DspDictionary> dictionary);
+    // Registers every <id>.zdict directly under 'dir'; returns how many were loaded
+    static size_t RegisterDictionaries(const std::string& dir);
+
 private:
-    static std::vector<int64_t> DecodeSleb128(const std::vector<uint8_t>& buffer);
-    static std::vector<int64_t> DeltaDecode(const std::vector<int64_t>& deltas);
+    // Parses the length-prefixed metadata at 'p' into 'out' and advances 'p' past it
+    static void ReadMetadata(const unsigned char*& p, const unsigned char* end, DspData& out);
+    // Registered dictionary for meta.dict_id (nullptr for none); throws if it is missing
+    static std::shared_ptr<const DspDictionary> FindDictionary(const DspData& meta);
+    // Decompresses the two length-prefixed split8 frames at 'p' into 'count' normalized values
+    static void DecodeFrames(const unsigned char* p, const unsigned char* end, const ZSTD_DDict* ddict,
+                             double* out, size_t count);
+    // Normalized values [first, first + count) of a v2 file into out[0, count), decoding only the
+    // blocks that overlap. 'body' starts right after the metadata; the index is already validated.
+    static void DecodeBlocks(const unsigned char* body, const DspData& meta, const ZSTD_DDict* ddict,
+                             size_t first, size_t count, double* out);
+    // Fused split8 decoder: walks both SLEB128 delta streams together, integrates them and
+    // writes (part1 * 10000 + part2) / 1e8 for exactly 'count' points into 'out'
+    static void DecodeSplit8(const uint8_t* enc1, size_t size1, const uint8_t* enc2, size_t size2,
+                             double* out, size_t count);
 };
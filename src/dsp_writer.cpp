@@ -0,0 +1,273 @@
+#include "dsp_writer.h"
+#include "dsp_dictionary.h"
+#include "dsp_library.h"
+#include <zstd.h>
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <omp.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Library files decoded to train a dictionary; an even spread of this many is plenty
+constexpr size_t kMaxTrainingFiles = 256;
+
+// Per-thread encode state, reused across files
+struct WriterScratch {
+    ZSTD_CCtx* cctx = ZSTD_createCCtx();
+    std::vector<int64_t> scaled;
+    std::vector<uint8_t> enc1;
+    std::vector<uint8_t> enc2;
+    std::vector<uint8_t> frame;
+    std::vector<uint8_t> body;
+
+    ~WriterScratch() { ZSTD_freeCCtx(cctx); }
+};
+
+WriterScratch& Scratch() {
+    thread_local WriterScratch scratch;
+    return scratch;
+}
+
+void AppendU32BE(std::vector<uint8_t>& out, uint32_t v) {
+    out.push_back(static_cast<uint8_t>(v >> 24));
+    out.push_back(static_cast<uint8_t>(v >> 16));
+    out.push_back(static_cast<uint8_t>(v >> 8));
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+void AppendSleb128(std::vector<uint8_t>& out, int64_t value) {
+    bool more = true;
+    while (more) {
+        uint8_t byte = static_cast<uint8_t>(value & 0x7F);
+        value >>= 7; // Arithmetic shift keeps the sign
+        if ((value == 0 && !(byte & 0x40)) || (value == -1 && (byte & 0x40))) {
+            more = false;
+        } else {
+            byte |= 0x80;
+        }
+        out.push_back(byte);
+    }
+}
+
+// Series on the 1e-8 grid the format stores: log1p(v / T), or v itself for zero investment
+// (FRED data), the inverse of the reader's T * (exp(y) - 1)
+void Quantize(const DspData& data, std::vector<int64_t>& scaled) {
+    const double T = data.total_investment;
+    const bool normalize = std::abs(T) >= 1e-9;
+    scaled.resize(data.values.size());
+    for (size_t i = 0; i < data.values.size(); ++i) {
+        double y = normalize ? std::log1p(data.values[i] / T) : data.values[i];
+        scaled[i] = std::llround(y * 1e8);
+    }
+}
+
+// Split8 + delta + SLEB128 of 'count' scaled values: the two streams that get compressed.
+// Deltas start from zero, so every run decodes on its own.
+void EncodeStreams(const int64_t* scaled, size_t count, std::vector<uint8_t>& enc1, std::vector<uint8_t>& enc2) {
+    enc1.clear();
+    enc2.clear();
+    int64_t prev1 = 0;
+    int64_t prev2 = 0;
+    for (size_t i = 0; i < count; ++i) {
+        // Floor division, like numpy's // and % in generate_test_dsp.py
+        int64_t part1 = scaled[i] >= 0 ? scaled[i] / 10000 : -((-scaled[i] + 9999) / 10000);
+        int64_t part2 = scaled[i] - part1 * 10000;
+        AppendSleb128(enc1, part1 - prev1);
+        AppendSleb128(enc2, part2 - prev2);
+        prev1 = part1;
+        prev2 = part2;
+    }
+}
+
+// Compresses 'src' and appends it to 'out' with its big-endian length
+void AppendFrame(std::vector<uint8_t>& out, const std::vector<uint8_t>& src, int level, const ZSTD_CDict* cdict,
+                 WriterScratch& scratch) {
+    scratch.frame.resize(ZSTD_compressBound(src.size()));
+    size_t size = cdict ? ZSTD_compress_usingCDict(scratch.cctx, scratch.frame.data(), scratch.frame.size(),
+                                                   src.data(), src.size(), cdict)
+                        : ZSTD_compressCCtx(scratch.cctx, scratch.frame.data(), scratch.frame.size(),
+                                            src.data(), src.size(), level);
+    if (ZSTD_isError(size)) throw std::runtime_error(std::string("ZSTD compress error: ") + ZSTD_getErrorName(size));
+    AppendU32BE(out, static_cast<uint32_t>(size));
+    out.insert(out.end(), scratch.frame.begin(), scratch.frame.begin() + size);
+}
+
+size_t BlockStep(const DspWriteOptions& options, size_t n) {
+    return options.version == 2 ? std::max<size_t>(options.blockSize, 1) : std::max<size_t>(n, 1);
+}
+
+} // namespace
+
+void DspWriter::Save(const std::string& path, const DspData& data, const DspWriteOptions& options) {
+    if (options.version != 1 && options.version != 2) {
+        throw std::runtime_error("Unsupported .dsp version " + std::to_string(options.version));
+    }
+    WriterScratch& scratch = Scratch();
+    Quantize(data, scratch.scaled);
+    const size_t n = scratch.scaled.size();
+    const ZSTD_CDict* cdict = options.dictionary ? options.dictionary->CDict(options.level) : nullptr;
+    if (options.dictionary && !cdict) throw std::runtime_error("Could not prepare zstd dictionary");
+
+    nlohmann::ordered_json meta;
+    meta["total_investment"] = data.total_investment;
+    meta["smooth_value"] = data.smooth_value;
+    meta["n"] = n;
+    meta["format"] = "delta+leb128+zstd+split8";
+
+    std::vector<uint8_t>& body = scratch.body;
+    body.clear();
+    if (options.version == 1) {
+        EncodeStreams(scratch.scaled.data(), n, scratch.enc1, scratch.enc2);
+        AppendFrame(body, scratch.enc1, options.level, cdict, scratch);
+        AppendFrame(body, scratch.enc2, options.level, cdict, scratch);
+    } else {
+        const size_t blockSize = BlockStep(options, n);
+        nlohmann::ordered_json blocks = nlohmann::ordered_json::array();
+        for (size_t start = 0; start < n; start += blockSize) {
+            const size_t count = std::min(blockSize, n - start);
+            const size_t offset = body.size();
+            EncodeStreams(scratch.scaled.data() + start, count, scratch.enc1, scratch.enc2);
+            AppendFrame(body, scratch.enc1, options.level, cdict, scratch);
+            AppendFrame(body, scratch.enc2, options.level, cdict, scratch);
+
+            const double* values = data.values.data() + start;
+            double lo = values[0], hi = values[0], sum = 0.0;
+            for (size_t i = 0; i < count; ++i) {
+                lo = std::min(lo, values[i]);
+                hi = std::max(hi, values[i]);
+                sum += values[i];
+            }
+            const double mean = sum / static_cast<double>(count);
+            double sumSq = 0.0;
+            for (size_t i = 0; i < count; ++i) sumSq += (values[i] - mean) * (values[i] - mean);
+
+            nlohmann::ordered_json block;
+            block["start"] = start;
+            block["count"] = count;
+            block["offset"] = offset;
+            block["size"] = body.size() - offset;
+            block["min"] = lo;
+            block["max"] = hi;
+            block["mean"] = mean;
+            block["std"] = std::sqrt(sumSq / static_cast<double>(count));
+            blocks.push_back(std::move(block));
+        }
+        meta["version"] = 2;
+        meta["block_size"] = blockSize;
+        meta["blocks"] = std::move(blocks);
+    }
+    if (options.dictionary) meta["dict_id"] = options.dictionary->Id();
+
+    const std::string metaText = meta.dump();
+    std::vector<uint8_t> header;
+    AppendU32BE(header, static_cast<uint32_t>(metaText.size()));
+
+    fs::path target = fs::u8path(path);
+    fs::path temp = target;
+    temp += ".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        if (!out) throw std::runtime_error("Could not create file: " + path);
+        out.write(reinterpret_cast<const char*>(header.data()), static_cast<std::streamsize>(header.size()));
+        out.write(metaText.data(), static_cast<std::streamsize>(metaText.size()));
+        out.write(reinterpret_cast<const char*>(body.data()), static_cast<std::streamsize>(body.size()));
+        if (!out.flush()) {
+            out.close();
+            std::error_code ec;
+            fs::remove(temp, ec);
+            throw std::runtime_error("Could not write file: " + path);
+        }
+    }
+    std::error_code ec;
+    fs::rename(temp, target, ec);
+    if (ec) {
+        fs::remove(temp, ec);
+        throw std::runtime_error("Could not replace file: " + path);
+    }
+}
+
+std::shared_ptr<DspDictionary> DspWriter::TrainDictionary(const std::vector<DspData>& series, const DspWriteOptions& options,
+                                                          size_t maxBytes) {
+    // Samples are the exact inputs zstd will see: both streams of every block
+    std::vector<std::vector<uint8_t>> samples;
+    std::vector<int64_t> scaled;
+    std::vector<uint8_t> enc1, enc2;
+    for (const DspData& data : series) {
+        Quantize(data, scaled);
+        const size_t step = BlockStep(options, scaled.size());
+        for (size_t start = 0; start < scaled.size(); start += step) {
+            EncodeStreams(scaled.data() + start, std::min(step, scaled.size() - start), enc1, enc2);
+            samples.push_back(enc1);
+            samples.push_back(enc2);
+        }
+    }
+    return DspDictionary::Train(samples, maxBytes);
+}
+
+size_t DspWriter::RewriteLibrary(const std::string& sourceRoot, const std::string& targetRoot,
+                                 DspWriteOptions options, bool trainDictionary) {
+    std::vector<DspFileEntry> entries = DspLibrary::Scan(sourceRoot);
+    DspReader::RegisterDictionaries(sourceRoot); // The sources may already use one
+    std::error_code ec;
+    fs::create_directories(fs::u8path(targetRoot), ec);
+
+    if (trainDictionary && !entries.empty()) {
+        const size_t sampleCount = std::min(entries.size(), kMaxTrainingFiles);
+        std::vector<DspData> sample(sampleCount);
+        #pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < static_cast<int>(sampleCount); ++i) {
+            try {
+                DspReader::LoadInto(entries[i * entries.size() / sampleCount].fullPath, sample[i]);
+            } catch (...) {
+                sample[i].values.clear();
+            }
+        }
+
+        options.dictionary = TrainDictionary(sample, options);
+        if (options.dictionary) {
+            std::string dictPath = targetRoot + "/" + DspDictionary::FileName(options.dictionary->Id());
+            if (!options.dictionary->Save(dictPath)) throw std::runtime_error("Could not write dictionary: " + dictPath);
+            DspReader::RegisterDictionary(options.dictionary);
+            std::cout << "DspWriter: Trained dictionary " << options.dictionary->Id() << " ("
+                      << options.dictionary->Size() / 1024 << " KB) on " << sampleCount << " files." << std::endl;
+        } else {
+            std::cout << "DspWriter: Too little data to train a dictionary, writing without one." << std::endl;
+        }
+    }
+
+    long long written = 0;
+    long long bytesIn = 0;
+    long long bytesOut = 0;
+    #pragma omp parallel for schedule(dynamic) reduction(+:written, bytesIn, bytesOut)
+    for (int i = 0; i < static_cast<int>(entries.size()); ++i) {
+        const auto& entry = entries[i];
+        thread_local DspData data; // Decode buffer reused across files
+
+        try {
+            DspReader::LoadInto(entry.fullPath, data);
+            std::string targetPath = targetRoot + "/" + entry.displayName;
+            std::error_code dirError;
+            fs::create_directories(fs::u8path(targetPath).parent_path(), dirError);
+            Save(targetPath, data, options);
+
+            std::error_code sizeError;
+            bytesIn += static_cast<long long>(fs::file_size(fs::u8path(entry.fullPath), sizeError));
+            bytesOut += static_cast<long long>(fs::file_size(fs::u8path(targetPath), sizeError));
+            ++written;
+        } catch (const std::exception& e) {
+            #pragma omp critical
+            std::cerr << "DspWriter: Skipping " << entry.fullPath << ": " << e.what() << std::endl;
+        }
+    }
+
+    std::cout << "DspWriter: Wrote " << written << " of " << entries.size() << " files (" << bytesIn / 1024
+              << " KB -> " << bytesOut / 1024 << " KB)." << std::endl;
+    return static_cast<size_t>(written);
+}
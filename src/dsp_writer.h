@@ -0,0 +1,35 @@
+#pragma once
+
+#include "dsp_reader.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+class DspDictionary;
+
+struct DspWriteOptions {
+    int version = 2;         // 1: two frames for the whole series, 2: block-indexed (see DspBlock)
+    size_t blockSize = 4096; // Points per block (v2)
+    int level = 19;          // zstd level; generate_test_dsp.py uses 22, which is much slower to write
+    std::shared_ptr<const DspDictionary> dictionary; // Optional; its id goes into the metadata
+};
+
+// The mirror of DspReader: normalizes, split8/delta/SLEB128-encodes and zstd-compresses
+// series into .dsp files that DspReader (and the Python tools) read back.
+class DspWriter {
+public:
+    // Writes 'data' (values as DspReader returns them, plus total_investment and smooth_value)
+    // to a temporary file next to 'path' and renames it into place. Throws on failure.
+    static void Save(const std::string& path, const DspData& data, const DspWriteOptions& options = DspWriteOptions());
+
+    // Trains a dictionary on the streams Save would compress for 'series' with 'options'
+    // (nullptr if zstd cannot learn one from them)
+    static std::shared_ptr<DspDictionary> TrainDictionary(const std::vector<DspData>& series, const DspWriteOptions& options,
+                                                          size_t maxBytes = 112 * 1024);
+
+    // Re-encodes every .dsp under sourceRoot into targetRoot (same relative paths), one file
+    // per thread. With trainDictionary, a dictionary is first trained on a sample of the library,
+    // saved as targetRoot/<id>.zdict and registered with DspReader. Returns the files written.
+    static size_t RewriteLibrary(const std::string& sourceRoot, const std::string& targetRoot,
+                                 DspWriteOptions options, bool trainDictionary);
+};
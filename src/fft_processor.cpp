@@ -0,0 +1,123 @@
+#include "fft_processor.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+FftProcessor::FftProcessor(size_t size) : m_Size(size) {
+    if (size == 0 || (size & (size - 1)) != 0) {
+        throw std::invalid_argument("FFT size must be a power of two");
+    }
+
+    int bits = 0;
+    while ((static_cast<size_t>(1) << bits) < size) ++bits;
+
+    m_BitReverse.resize(size);
+    for (size_t i = 0; i < size; ++i) {
+        size_t r = 0;
+        for (int b = 0; b < bits; ++b) {
+            if (i & (static_cast<size_t>(1) << b)) r |= static_cast<size_t>(1) << (bits - 1 - b);
+        }
+        m_BitReverse[i] = r;
+    }
+
+    // Direct evaluation per entry (no recurrence) keeps twiddle error at 1 ulp
+    const double pi = 3.14159265358979323846;
+    m_Twiddles.resize(size / 2);
+    for (size_t k = 0; k < size / 2; ++k) {
+        double angle = -2.0 * pi * static_cast<double>(k) / static_cast<double>(size);
+        m_Twiddles[k] = std::complex<double>(std::cos(angle), std::sin(angle));
+    }
+}
+
+size_t FftProcessor::NextPowerOfTwo(size_t n) {
+    size_t p = 1;
+    while (p < n) p <<= 1;
+    return p;
+}
+
+void FftProcessor::Forward(std::complex<double>* data) const {
+    Run(data, false);
+}
+
+void FftProcessor::Inverse(std::complex<double>* data) const {
+    Run(data, true);
+    const double scale = 1.0 / static_cast<double>(m_Size);
+    for (size_t i = 0; i < m_Size; ++i) data[i] *= scale;
+}
+
+void FftProcessor::Run(std::complex<double>* data, bool inverse) const {
+    for (size_t i = 0; i < m_Size; ++i) {
+        size_t r = m_BitReverse[i];
+        if (i < r) std::swap(data[i], data[r]);
+    }
+
+    for (size_t len = 2; len <= m_Size; len <<= 1) {
+        const size_t half = len / 2;
+        const size_t step = m_Size / len;
+        for (size_t i = 0; i < m_Size; i += len) {
+            for (size_t k = 0; k < half; ++k) {
+                std::complex<double> w = m_Twiddles[k * step];
+                if (inverse) w = std::conj(w);
+                std::complex<double> u = data[i + k];
+                std::complex<double> v = data[i + k + half] * w;
+                data[i + k] = u + v;
+                data[i + k + half] = u - v;
+            }
+        }
+    }
+}
+
+SlidingDotProduct::SlidingDotProduct(const std::vector<double>& pattern)
+    : m_PatternSize(pattern.size()),
+      m_Fft(FftProcessor::NextPowerOfTwo(std::max<size_t>(4 * pattern.size(), 64))) {
+    // Correlation == convolution with the reversed pattern
+    const size_t L = m_Fft.Size();
+    m_Spectrum.assign(L, std::complex<double>(0.0, 0.0));
+    for (size_t k = 0; k < m_PatternSize; ++k) {
+        m_Spectrum[k] = std::complex<double>(pattern[m_PatternSize - 1 - k], 0.0);
+    }
+    m_Fft.Forward(m_Spectrum.data());
+}
+
+void SlidingDotProduct::Compute(const double* x, size_t n, double shift, double* out) const {
+    const size_t m = m_PatternSize;
+    if (m == 0 || n < m) return;
+
+    const size_t L = m_Fft.Size();
+    const size_t step = L - m + 1;      // Valid outputs per block
+    const size_t windows = n - m + 1;
+
+    // Per-thread scratch, reused across calls
+    thread_local std::vector<std::complex<double>> buf;
+    buf.resize(L);
+
+    auto load = [&](size_t start, size_t t) -> double {
+        size_t idx = start + t;
+        return (idx < n) ? x[idx] - shift : 0.0;
+    };
+
+    // The pattern is real, so two blocks ride in one transform:
+    // block A in the real part, block B in the imaginary part.
+    for (size_t s1 = 0; s1 < windows; s1 += 2 * step) {
+        const size_t s2 = s1 + step;
+        const bool hasSecond = s2 < windows;
+
+        for (size_t t = 0; t < L; ++t) {
+            buf[t] = std::complex<double>(load(s1, t), hasSecond ? load(s2, t) : 0.0);
+        }
+
+        m_Fft.Forward(buf.data());
+        for (size_t t = 0; t < L; ++t) buf[t] *= m_Spectrum[t];
+        m_Fft.Inverse(buf.data());
+
+        // Circular outputs [m-1, L-1] are the valid linear ones
+        for (size_t t = m - 1; t < L; ++t) {
+            size_t j1 = s1 + t - (m - 1);
+            if (j1 < windows) out[j1] = buf[t].real();
+            if (hasSecond) {
+                size_t j2 = s2 + t - (m - 1);
+                if (j2 < windows) out[j2] = buf[t].imag();
+            }
+        }
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+#include <complex>
+
+// Iterative radix-2 FFT with precomputed twiddles for one fixed size.
+class FftProcessor {
+public:
+    explicit FftProcessor(size_t size); // size must be a power of two
+
+    void Forward(std::complex<double>* data) const;
+    void Inverse(std::complex<double>* data) const; // Includes the 1/N scaling
+
+    size_t Size() const { return m_Size; }
+    static size_t NextPowerOfTwo(size_t n);
+
+private:
+    void Run(std::complex<double>* data, bool inverse) const;
+
+    size_t m_Size;
+    std::vector<size_t> m_BitReverse;
+    std::vector<std::complex<double>> m_Twiddles; // e^(-2*pi*i*k/N), k < N/2
+};
+
+// MASS-style sliding dot product of one fixed pattern against any series.
+// Uses overlap-save blocks, so the pattern spectrum is computed once per query
+// and long series never need a full-length FFT.
+class SlidingDotProduct {
+public:
+    explicit SlidingDotProduct(const std::vector<double>& pattern);
+
+    // out[j] = sum_k pattern[k] * (x[j + k] - shift), for j in [0, n - m].
+    // 'shift' is subtracted before the transform to keep magnitudes small.
+    void Compute(const double* x, size_t n, double shift, double* out) const;
+
+    size_t PatternSize() const { return m_PatternSize; }
+
+private:
+    size_t m_PatternSize;
+    FftProcessor m_Fft;
+    std::vector<std::complex<double>> m_Spectrum; // FFT of the reversed pattern
+};
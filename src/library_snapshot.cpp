@@ -0,0 +1,256 @@
+#include "library_snapshot.h"
+#include "binary_io.h"
+#include "mapped_file.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+using BinaryIo::AlignUp;
+using BinaryIo::Cursor;
+using BinaryIo::kAlignment;
+using BinaryIo::Put;
+using BinaryIo::PutString;
+
+constexpr char kMagic[8] = { 'R', 'E', 'L', '2', 'S', 'N', 'A', 'P' };
+constexpr uint32_t kVersion = 2;
+constexpr uint32_t kByteOrderMark = 0x01020304;
+constexpr uint32_t kFlagDerived = 1; // Pyramids and rolling-moment tables are stored
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t flags;
+    uint32_t reserved;
+    uint64_t sourceCount;
+    uint64_t stockCount;
+    uint64_t fileSize;
+    uint64_t padding[2];
+};
+static_assert(sizeof(SnapshotHeader) == 64, "Snapshot header must stay 64 bytes");
+
+bool ByPath(const DspFileStamp& a, const DspFileStamp& b) {
+    return a.path < b.path;
+}
+
+// Stamps of every scanned file, sorted by path so scan order does not matter
+bool StampSources(const std::vector<DspFileEntry>& sources, std::vector<DspFileStamp>& stamps) {
+    stamps.resize(sources.size());
+    for (size_t i = 0; i < sources.size(); ++i) {
+        if (!DspLibrary::Stamp(sources[i].fullPath, stamps[i])) return false;
+    }
+    std::sort(stamps.begin(), stamps.end(), ByPath);
+    return true;
+}
+
+// --- Writing ---
+
+struct DataPlacement {
+    uint64_t pyramid = 0;
+    uint64_t stats = 0; // prefixSum, then prefixSumSq at the next aligned offset
+};
+
+uint64_t StatsBytes(const CachedStock& stock) {
+    return AlignUp(stock.StatsSize() * sizeof(double));
+}
+
+// Header, manifest and stock records; 'placements' holds the data offsets to record
+std::vector<unsigned char> BuildMetadata(const std::vector<CachedStock>& stocks, const std::vector<DspFileStamp>& stamps,
+                                         const std::vector<DataPlacement>& placements, bool derived) {
+    std::vector<unsigned char> meta;
+    SnapshotHeader header = {};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.byteOrder = kByteOrderMark;
+    header.flags = derived ? kFlagDerived : 0;
+    header.sourceCount = stamps.size();
+    header.stockCount = stocks.size();
+    Put(meta, header);
+
+    for (const auto& stamp : stamps) {
+        PutString(meta, stamp.path);
+        Put(meta, stamp.size);
+        Put(meta, stamp.mtime);
+        Put(meta, stamp.hash);
+    }
+
+    for (size_t i = 0; i < stocks.size(); ++i) {
+        const CachedStock& stock = stocks[i];
+        PutString(meta, stock.Symbol());
+        PutString(meta, stock.FullPath());
+        Put(meta, static_cast<uint32_t>(stock.isFred ? 1 : 0));
+        if (derived) {
+            Put(meta, static_cast<uint32_t>(stock.LevelCount()));
+            for (size_t offset : stock.levelOffsets) Put(meta, static_cast<uint64_t>(offset));
+            for (double shift : stock.levelShift) Put(meta, shift);
+        } else {
+            // Level 0 only; the pyramid is rebuilt on open
+            Put(meta, static_cast<uint32_t>(1));
+            Put(meta, static_cast<uint64_t>(0));
+            Put(meta, static_cast<uint64_t>(stock.Data().size()));
+        }
+        Put(meta, placements[i].pyramid);
+        Put(meta, placements[i].stats);
+    }
+    return meta;
+}
+
+void WriteAligned(std::ofstream& out, const double* data, size_t count) {
+    static const char zeros[kAlignment] = {};
+    uint64_t bytes = count * sizeof(double);
+    out.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(bytes));
+    out.write(zeros, static_cast<std::streamsize>(AlignUp(bytes) - bytes));
+}
+
+// --- Reading ---
+
+// Pointer to 'count' doubles at 'offset', or nullptr if misaligned or out of bounds
+const double* MappedArray(const MappedFile& file, uint64_t offset, uint64_t count) {
+    if (offset % kAlignment != 0) return nullptr;
+    if (offset > file.Size() || count > (file.Size() - offset) / sizeof(double)) return nullptr;
+    return reinterpret_cast<const double*>(file.Data() + offset);
+}
+
+} // namespace
+
+bool LibrarySnapshot::Write(const std::string& path, const std::vector<CachedStock>& stocks,
+                            const std::vector<DspFileStamp>& manifest, bool includeDerived) {
+    std::vector<DspFileStamp> stamps = manifest;
+    std::sort(stamps.begin(), stamps.end(), ByPath);
+
+    // Records are fixed-size per stock, so a first pass with dummy offsets gives the data start
+    std::vector<DataPlacement> placements(stocks.size());
+    uint64_t cursor = AlignUp(BuildMetadata(stocks, stamps, placements, includeDerived).size());
+    for (size_t i = 0; i < stocks.size(); ++i) {
+        const CachedStock& stock = stocks[i];
+        placements[i].pyramid = cursor;
+        cursor += AlignUp((includeDerived ? stock.pyramid.size() : stock.Data().size()) * sizeof(double));
+        if (includeDerived) {
+            placements[i].stats = cursor;
+            cursor += 2 * StatsBytes(stock);
+        }
+    }
+    std::vector<unsigned char> meta = BuildMetadata(stocks, stamps, placements, includeDerived);
+    reinterpret_cast<SnapshotHeader*>(meta.data())->fileSize = cursor;
+
+    fs::path target = fs::u8path(path);
+    fs::path temp = target;
+    temp += ".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+
+        static const char zeros[kAlignment] = {};
+        out.write(reinterpret_cast<const char*>(meta.data()), static_cast<std::streamsize>(meta.size()));
+        out.write(zeros, static_cast<std::streamsize>(AlignUp(meta.size()) - meta.size()));
+        for (const CachedStock& stock : stocks) {
+            if (includeDerived) {
+                WriteAligned(out, stock.pyramid.data(), stock.pyramid.size());
+                WriteAligned(out, stock.prefixSum, stock.StatsSize());
+                WriteAligned(out, stock.prefixSumSq, stock.StatsSize());
+            } else {
+                WriteAligned(out, stock.Data().data(), stock.Data().size());
+            }
+        }
+        if (!out.flush()) {
+            out.close();
+            std::error_code ec;
+            fs::remove(temp, ec);
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    fs::rename(temp, target, ec);
+    if (ec) {
+        fs::remove(temp, ec);
+        return false;
+    }
+    return true;
+}
+
+std::shared_ptr<const MappedFile> LibrarySnapshot::Open(const std::string& path, const std::vector<DspFileEntry>& sources,
+                                                        std::vector<CachedStock>& stocks,
+                                                        std::vector<DspFileStamp>& manifest) {
+    auto file = std::make_shared<MappedFile>();
+    if (!file->Open(path) || file->Size() < sizeof(SnapshotHeader)) return nullptr;
+
+    SnapshotHeader header;
+    std::memcpy(&header, file->Data(), sizeof(header));
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kVersion ||
+        header.byteOrder != kByteOrderMark || header.fileSize != file->Size()) {
+        std::cout << "AnalysisEngine: Snapshot " << path << " is not usable, rebuilding." << std::endl;
+        return nullptr;
+    }
+
+    // Staleness: the scanned files must be exactly the ones the snapshot was built from
+    std::vector<DspFileStamp> stamps;
+    bool current = header.sourceCount == sources.size() && StampSources(sources, stamps);
+    Cursor in = { file->Data() + sizeof(header), file->Data() + file->Size() };
+    for (uint64_t i = 0; current && i < header.sourceCount; ++i) {
+        std::string sourcePath = in.GetString();
+        uint64_t size = in.Get<uint64_t>();
+        int64_t mtime = in.Get<int64_t>();
+        stamps[i].hash = in.Get<uint64_t>();
+        current = in.ok && sourcePath == stamps[i].path && size == stamps[i].size && mtime == stamps[i].mtime;
+    }
+    if (!current) {
+        std::cout << "AnalysisEngine: Snapshot " << path << " is stale, rebuilding." << std::endl;
+        return nullptr;
+    }
+
+    const bool derived = (header.flags & kFlagDerived) != 0;
+    std::vector<CachedStock> loaded(header.stockCount);
+    for (CachedStock& stock : loaded) {
+        std::string symbol = in.GetString();
+        std::string fullPath = in.GetString();
+        stock.name = AnalysisEngine::InternName(fullPath, symbol);
+        stock.isFred = in.Get<uint32_t>() != 0;
+        uint32_t levels = in.Get<uint32_t>();
+        if (!in.ok || levels == 0 || levels > 64) return nullptr;
+        stock.levelOffsets.resize(levels + 1);
+        for (size_t& offset : stock.levelOffsets) offset = static_cast<size_t>(in.Get<uint64_t>());
+        if (derived) {
+            stock.levelShift.resize(levels);
+            for (double& shift : stock.levelShift) shift = in.Get<double>();
+        }
+        uint64_t pyramidOffset = in.Get<uint64_t>();
+        uint64_t statsOffset = in.Get<uint64_t>();
+        if (!in.ok || stock.levelOffsets.front() != 0) return nullptr;
+        for (uint32_t l = 0; l < levels; ++l) {
+            if (stock.levelOffsets[l] > stock.levelOffsets[l + 1]) return nullptr;
+        }
+
+        stock.pyramid.length = stock.levelOffsets.back();
+        stock.pyramid.ptr = MappedArray(*file, pyramidOffset, stock.pyramid.length);
+        if (!stock.pyramid.ptr) return nullptr;
+        stock.storage = file;
+        if (derived) {
+            stock.prefixSum = MappedArray(*file, statsOffset, stock.StatsSize());
+            stock.prefixSumSq = MappedArray(*file, statsOffset + StatsBytes(stock), stock.StatsSize());
+            if (!stock.prefixSum || !stock.prefixSumSq) return nullptr;
+        }
+    }
+
+    if (!derived) {
+        // Only level 0 is stored: rebuild the rest in owned memory (still no decoding)
+        #pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < static_cast<int>(loaded.size()); ++i) {
+            CachedStock& stock = loaded[i];
+            std::vector<double> data(stock.pyramid.begin(), stock.pyramid.end());
+            AnalysisEngine::BuildStock(data, stock);
+        }
+    }
+
+    stocks.reserve(stocks.size() + loaded.size());
+    for (CachedStock& stock : loaded) stocks.push_back(std::move(stock));
+    manifest.swap(stamps);
+    return file;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "analysis_engine.h"
+#include "dsp_library.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+// Binary snapshot of a decoded library: symbols, FRED flags and series, optionally with
+// pyramids and rolling-moment tables. It is written once after a full load and memory-mapped
+// on later starts, so stocks point straight into the file instead of being decoded again.
+//
+// Layout (native endianness, checked by the header):
+//   header | source manifest (path, size, mtime, hash per scanned .dsp) | stock records | data
+// Every double array in the data section starts on a 64-byte boundary.
+class LibrarySnapshot {
+public:
+    // Writes to a temporary file next to 'path' and renames it into place. 'manifest' holds
+    // the stamps of the files the stocks were decoded from.
+    static bool Write(const std::string& path, const std::vector<CachedStock>& stocks,
+                      const std::vector<DspFileStamp>& manifest, bool includeDerived = true);
+
+    // Maps 'path', appends its stocks to 'stocks' and returns the recorded stamps of 'sources'
+    // (sorted by path) in 'manifest'. Returns nullptr and leaves both untouched if the file is
+    // missing, malformed, or no longer matches 'sources'. The appended stocks keep the mapping alive.
+    static std::shared_ptr<const MappedFile> Open(const std::string& path, const std::vector<DspFileEntry>& sources,
+                                                  std::vector<CachedStock>& stocks, std::vector<DspFileStamp>& manifest);
+};
@@ -10,6 +10,7 @@
 #include "alpha_vantage.h"
 #include "dsp_library.h" 
 #include "analysis_engine.h" 
+#include "streaming_search.h"
 #include <iostream>
 #include <filesystem>
 #include <algorithm>
@@ -20,6 +21,7 @@
 #include <fstream>
 #include <random>
 #include <thread>
+#include <future>
 #include <mutex>
 #include <deque>
 
@@ -65,8 +67,18 @@ bool g_TestingMode = false;
 bool g_UseFred = false; // Default Off // False = Last 300 (Live), True = First 300 (Testing)
 int g_QuerySize = 300;
 int g_Lookahead = 100;
+bool g_FineScales = false; // Match at 0.5x-4x in quarter-octave steps instead of 1x, 2x, 4x...
 std::vector<double> g_StockData;
 std::vector<SearchResult> g_SearchResults;
+std::shared_ptr<SearchTask> g_SearchTask; // Fetch tab search still running, if any
+uint64_t g_SearchRevision = 0;            // Its snapshot last drawn
+std::vector<double> g_SearchPattern;      // Its query
+std::chrono::high_resolution_clock::time_point g_SearchStart;
+bool g_IncrementalLive = false; // Live fetches that only add new closes slide g_LiveStream instead of searching again
+StreamingSearch g_LiveStream;
+std::future<std::vector<SearchResult>> g_LiveStreamStart; // g_LiveStream.Start running in the background
+int g_LiveStreamLookahead = 0;                             // Its lookahead
+const int kMaxLiveSteps = 30;                              // New closes a fetch may add and still slide the session
 std::vector<double> g_PredictionData;
 
 struct FuturePoint { double z; double weight; };
@@ -74,6 +86,7 @@ std::vector<FuturePoint> g_FuturePoints;
 std::vector<double> g_MedianData;
 
 std::string g_AlphaStatus = "Idle";
+const int kLibraryRefreshSeconds = 60; // Rescan for new or changed .dsp files while running
 float g_Zoom = 1.0f;
 ImVec2 g_Pan = ImVec2(0, 0);
 
@@ -186,6 +199,112 @@ void SaveResults(const std::string& folderName) {
     }
 }
 
+// Search settings shared by the live search and the simulation
+static SearchOptions CurrentSearchOptions() {
+    SearchOptions options;
+    if (g_FineScales) options.scaleFactors = AnalysisEngine::ScaleGrid(0.5, 4.0, 4);
+    return options;
+}
+
+// Averages the lookahead of g_SearchResults into the prediction, median and future-point views
+static void UpdatePrediction(const std::vector<double>& searchPattern) {
+    g_PredictionData.clear();
+    g_FuturePoints.clear();
+    g_MedianData.clear();
+
+    if (!g_SearchResults.empty()) {
+        std::vector<double> sum_returns(100, 0.0);
+        int count = 0;
+        std::vector<std::vector<double>> allSegments; // For Median
+
+        for (const auto& res : g_SearchResults) {
+            if (!res.stockPin) continue;
+
+            // Match and lookahead in the query's time base
+            std::vector<double> scaledData =
+                AnalysisEngine::MatchSegment(res, std::max(400, g_QuerySize + g_Lookahead));
+
+            // Segment Match stats
+            double seg_sum = 0, seg_sq_sum = 0;
+            int match_end_idx = 300 - 1;
+
+            // Calculate stats for the match segment (for Z-score normalization)
+            // And accumulate for Median Calculation
+            if (300 <= (int)scaledData.size()) {
+                for(int k=0; k<300; ++k) {
+                    double val = scaledData[k];
+                    seg_sum += val;
+                }
+                double seg_mean = seg_sum / 300.0;
+                // Re-iterate for stdev
+                for(int k=0; k<300; ++k) {
+                    double v = scaledData[k];
+                    seg_sq_sum += (v - seg_mean)*(v - seg_mean);
+                }
+                double seg_stdev = std::sqrt(seg_sq_sum / static_cast<double>(g_QuerySize));
+                if (seg_stdev == 0) seg_stdev = 1.0;
+
+                // --- 1. Store Normalized Full Segment for Median ---
+                int len = g_QuerySize + g_Lookahead; 
+                if (len > (int)scaledData.size()) len = (int)scaledData.size();
+
+                std::vector<double> norm_full;
+                for(int k=0; k<len; ++k) {
+                    double v = scaledData[k];
+                    norm_full.push_back((v - seg_mean) / seg_stdev);
+                }
+                allSegments.push_back(norm_full);
+
+                // --- 2. Future Point Z-Score Calculation (Robust to Negative Data) ---
+                if (399 < (int)scaledData.size()) {
+                    double future_val = scaledData[399];
+                    double z = (future_val - seg_mean) / seg_stdev;
+                    g_FuturePoints.push_back({z, res.pearson});
+                }
+            }
+
+            // For Prediction Line (average returns)
+            if (match_end_idx + 100 < (int)scaledData.size()) {
+                double base_val = scaledData[match_end_idx];
+                if (base_val == 0) base_val = 0.0001;
+
+                for (int k = 0; k < 100; ++k) {
+                    double future_val = scaledData[match_end_idx + 1 + k];
+                    double ret = (future_val - base_val) / base_val;
+                    sum_returns[k] += ret;
+                }
+                count++;
+            }
+        }
+
+        // Calculate Median Line
+        if (!allSegments.empty()) {
+            for (int t = 0; t < g_QuerySize + g_Lookahead; ++t) {
+                std::vector<double> vals;
+                for (const auto& seg : allSegments) {
+                    if (t < (int)seg.size()) vals.push_back(seg[t]);
+                }
+                if (!vals.empty()) {
+                    std::sort(vals.begin(), vals.end());
+                    double med = vals[vals.size()/2];
+                    if (vals.size() % 2 == 0) {
+                        med = (vals[vals.size()/2 - 1] + vals[vals.size()/2]) * 0.5;
+                    }
+                    g_MedianData.push_back(med);
+                }
+            }
+        }
+
+        if (count > 0 && !searchPattern.empty()) {
+            double current_price = searchPattern.back(); 
+            for (int k = 0; k < 100; ++k) {
+                double avg_ret = sum_returns[k] / count;
+                g_PredictionData.push_back(current_price * (1.0 + avg_ret));
+            }
+        }
+    }
+}
+
 // Simulation Thread Function
 void RunSimulation(std::string apiKey) {
     std::cout << "Simulation Started." << std::endl;
@@ -194,7 +313,8 @@ void RunSimulation(std::string apiKey) {
     auto& engine = AnalysisEngine::GetInstance();
     if (!engine.IsLoaded()) {
         std::string root = DspLibrary::FindRoot();
-        engine.LoadLibrary(root);
+        engine.LoadLibrary(root, AnalysisEngine::DefaultSnapshotPath(root));
+        engine.StartWatching(kLibraryRefreshSeconds);
     }
     
     int games_played = 0;
@@ -281,7 +401,7 @@ void RunSimulation(std::string apiKey) {
                 g_SimStatus = "Analyzing " + ticker + "...";
             }
             
-            std::vector<SearchResult> results = engine.Search(query, false, 35, g_Lookahead); // topK=35 for better density
+            std::vector<SearchResult> results = engine.Search(query, false, 35, g_Lookahead, CurrentSearchOptions()); // topK=35 for better density
             
             // Calculate EV
             // 1. Query Stats
@@ -295,25 +415,18 @@ void RunSimulation(std::string apiKey) {
             // 2. Future Points
             std::vector<struct FuturePoint> points;
             for (const auto& res : results) {
-                if (!res.stockPtr) continue;
-                std::vector<double> scaledData;
-                 if (res.scale == 1) {
-                    scaledData = res.stockPtr->data;
-                } else {
-                    scaledData = res.stockPtr->data;
-                    for (int s = 1; s < res.scale; s *= 2) {
-                        scaledData = AnalysisEngine::Downsample(scaledData);
-                    }
-                }
+                if (!res.stockPin) continue;
+                // Match and lookahead in the query's time base
+                std::vector<double> scaledData = AnalysisEngine::MatchSegment(res, g_QuerySize + g_Lookahead);
                 
                 // Match stats for normalization
                 double seg_sum = 0, seg_sq_sum = 0;
                 int match_len = g_QuerySize;
-                if (res.offset + match_len <= (int)scaledData.size()) {
-                    for(int k=0; k<match_len; ++k) seg_sum += scaledData[res.offset + k];
+                if (match_len <= (int)scaledData.size()) {
+                    for(int k=0; k<match_len; ++k) seg_sum += scaledData[k];
                     double seg_mean = seg_sum / match_len;
                     for(int k=0; k<match_len; ++k) {
-                        double v = scaledData[res.offset + k];
+                        double v = scaledData[k];
                         seg_sq_sum += (v - seg_mean)*(v - seg_mean);
                     }
                     double seg_stdev = std::sqrt(seg_sq_sum / match_len);
@@ -321,7 +434,7 @@ void RunSimulation(std::string apiKey) {
                     
                     // Future Point (at +Lookahead relative to offset match end)
                     // Match is [offset, offset + match_len - 1]. Future is offset + match_len + lookahead - 1
-                    int future_idx = res.offset + match_len + g_Lookahead - 1;
+                    int future_idx = match_len + g_Lookahead - 1;
                     if (future_idx < (int)scaledData.size()) {
                         double future_val = scaledData[future_idx];
                         double z = (future_val - seg_mean) / seg_stdev;
@@ -550,9 +663,22 @@ int main(int, char**)
                     
                     ImGui::SameLine();
                     ImGui::Checkbox("Include FRED", &g_UseFred);
+                    ImGui::SameLine();
+                    ImGui::Checkbox("Fine Time Scales", &g_FineScales);
+                    if (ImGui::IsItemHovered()) ImGui::SetTooltip("Match analogs running at 0.5x to 4x speed in quarter-octave steps (slower). Default (Unchecked) is 1x, 2x, 4x...");
+                    ImGui::SameLine();
+                    ImGui::Checkbox("Incremental Live Updates", &g_IncrementalLive);
+                    if (ImGui::IsItemHovered()) ImGui::SetTooltip("Live mode: a fetch that only adds new closes updates the last search in a fraction of the time. Not used with Testing Mode or Fine Time Scales.");
                     
-                    ImGui::SliderInt("Query Size", &g_QuerySize, 100, 500);
-                    ImGui::SliderInt("Lookahead", &g_Lookahead, 10, 200);
+                    bool queryChanged = ImGui::SliderInt("Query Size", &g_QuerySize, 100, 500);
+                    queryChanged |= ImGui::SliderInt("Lookahead", &g_Lookahead, 10, 200);
+                    if (queryChanged && (g_SearchTask || g_LiveStreamStart.valid())) {
+                        // The running search no longer matches the settings (a live session start is
+                        // left to finish, and its results are dropped)
+                        if (g_SearchTask) g_SearchTask->Cancel();
+                        g_SearchTask.reset();
+                        g_AlphaStatus = "Search cancelled (Query Size or Lookahead changed).";
+                    }
 
                     // Persistent Query Segment for plotting (updated on fetch)
                     static std::vector<double> s_DisplayQuery;
@@ -568,8 +694,9 @@ int main(int, char**)
                             if (!engine.IsLoaded()) {
                                 g_AlphaStatus = "Caching Library...";
                                 std::string root = DspLibrary::FindRoot();
-                                size_t count = engine.LoadLibrary(root);
+                                size_t count = engine.LoadLibrary(root, AnalysisEngine::DefaultSnapshotPath(root));
                                 std::cout << "Cached " << count << " stocks." << std::endl;
+                                engine.StartWatching(kLibraryRefreshSeconds);
                             }
 
                             // 2. Fetch
@@ -595,113 +722,39 @@ int main(int, char**)
                                         s_DisplayQuery = searchPattern;
                                     }
                                     
-                                    // 4. Search and Calculate Prediction
-                                    g_SearchResults = engine.Search(searchPattern, g_UseFred, 35, g_Lookahead);
-                                    g_AlphaStatus = "Found Top 10 Matches.";
-
+                                    // 4. Search in the background; the results and prediction fill in as it runs.
+                                    // The previous search is dropped, so its snapshot cannot overwrite these results
+                                    if (g_SearchTask) g_SearchTask->Cancel();
+                                    g_SearchTask.reset();
+                                    g_SearchResults.clear();
                                     g_PredictionData.clear();
                                     g_FuturePoints.clear();
                                     g_MedianData.clear();
-                                    
-                                    if (!g_SearchResults.empty()) {
-                                        std::vector<double> sum_returns(100, 0.0);
-                                        int count = 0;
-                                        std::vector<std::vector<double>> allSegments; // For Median
-
-                                        for (const auto& res : g_SearchResults) {
-                                            if (!res.stockPtr) continue;
-
-                                            // Reconstruct the data at the correct scale
-                                            std::vector<double> scaledData;
-                                            if (res.scale == 1) {
-                                                scaledData = res.stockPtr->data;
-                                            } else {
-                                                scaledData = res.stockPtr->data;
-                                                for (int s = 1; s < res.scale; s *= 2) {
-                                                    scaledData = AnalysisEngine::Downsample(scaledData);
-                                                }
-                                            }
-                                            
-                                            // Segment Match stats
-                                            double seg_sum = 0, seg_sq_sum = 0;
-                                            int match_end_idx = res.offset + 300 - 1;
-                                            
-                                            // Calculate stats for the match segment (for Z-score normalization)
-                                            // And accumulate for Median Calculation
-                                            if (res.offset + 300 <= (int)scaledData.size()) {
-                                                for(int k=0; k<300; ++k) {
-                                                    double val = scaledData[res.offset + k];
-                                                    seg_sum += val;
-                                                }
-                                                double seg_mean = seg_sum / 300.0;
-                                                // Re-iterate for stdev
-                                                for(int k=0; k<300; ++k) {
-                                                    double v = scaledData[res.offset + k];
-                                                    seg_sq_sum += (v - seg_mean)*(v - seg_mean);
-                                                }
-                                                double seg_stdev = std::sqrt(seg_sq_sum / static_cast<double>(g_QuerySize));
-                                                if (seg_stdev == 0) seg_stdev = 1.0;
-
-                                                // --- 1. Store Normalized Full Segment for Median ---
-                                                int len = g_QuerySize + g_Lookahead; 
-                                                if (res.offset + len > (int)scaledData.size()) len = (int)scaledData.size() - res.offset;
-                                                
-                                                std::vector<double> norm_full;
-                                                for(int k=0; k<len; ++k) {
-                                                    double v = scaledData[res.offset + k];
-                                                    norm_full.push_back((v - seg_mean) / seg_stdev);
-                                                }
-                                                allSegments.push_back(norm_full);
-
-                                                // --- 2. Future Point Z-Score Calculation (Robust to Negative Data) ---
-                                                if (res.offset + 399 < (int)scaledData.size()) {
-                                                    double future_val = scaledData[res.offset + 399];
-                                                    double z = (future_val - seg_mean) / seg_stdev;
-                                                    g_FuturePoints.push_back({z, res.pearson});
-                                                }
-                                            }
-
-                                            // For Prediction Line (average returns)
-                                            if (match_end_idx + 100 < (int)scaledData.size()) {
-                                                double base_val = scaledData[match_end_idx];
-                                                if (base_val == 0) base_val = 0.0001;
-
-                                                for (int k = 0; k < 100; ++k) {
-                                                    double future_val = scaledData[match_end_idx + 1 + k];
-                                                    double ret = (future_val - base_val) / base_val;
-                                                    sum_returns[k] += ret;
-                                                }
-                                                count++;
-                                            }
-                                        }
-                                        
-                                        // Calculate Median Line
-                                        if (!allSegments.empty()) {
-                                            for (int t = 0; t < g_QuerySize + g_Lookahead; ++t) {
-                                                std::vector<double> vals;
-                                                for (const auto& seg : allSegments) {
-                                                    if (t < (int)seg.size()) vals.push_back(seg[t]);
-                                                }
-                                                if (!vals.empty()) {
-                                                    std::sort(vals.begin(), vals.end());
-                                                    double med = vals[vals.size()/2];
-                                                    if (vals.size() % 2 == 0) {
-                                                        med = (vals[vals.size()/2 - 1] + vals[vals.size()/2]) * 0.5;
-                                                    }
-                                                    g_MedianData.push_back(med);
-                                                }
-                                            }
-                                        }
-
-                                        if (count > 0 && !searchPattern.empty()) {
-                                            double current_price = searchPattern.back(); 
-                                            for (int k = 0; k < 100; ++k) {
-                                                double avg_ret = sum_returns[k] / count;
-                                                g_PredictionData.push_back(current_price * (1.0 + avg_ret));
-                                            }
+                                    g_SearchPattern = searchPattern;
+                                    g_SearchRevision = 0;
+                                    g_SearchStart = start_time;
+                                    const SearchOptions options = CurrentSearchOptions();
+                                    const bool incremental = g_IncrementalLive && !g_TestingMode && options.scaleFactors.empty() &&
+                                                             !g_LiveStreamStart.valid();
+                                    const int steps = incremental ? g_LiveStream.StepsTo(searchPattern, g_UseFred, 35, g_Lookahead, options, kMaxLiveSteps) : -1;
+                                    if (steps > 0) {
+                                        // Only new closes since the last fetch: slide the live session forward
+                                        for (int k = steps; k > 0; --k) {
+                                            g_SearchResults = g_LiveStream.Advance(searchPattern[searchPattern.size() - k]);
                                         }
+                                        UpdatePrediction(searchPattern);
+                                        g_AlphaStatus = "Updated with " + std::to_string(steps) + " new closes.";
+                                    } else if (incremental && steps < 0) {
+                                        // (Re)start the live session in the background; later fetches slide it
+                                        const bool useFred = g_UseFred;
+                                        const int lookahead = g_Lookahead;
+                                        g_LiveStreamLookahead = lookahead;
+                                        g_LiveStreamStart = std::async(std::launch::async, [searchPattern, useFred, lookahead, options]() {
+                                            return g_LiveStream.Start(searchPattern, useFred, 35, lookahead, options);
+                                        });
+                                    } else {
+                                        g_SearchTask = engine.SearchAsync(searchPattern, g_UseFred, 35, g_Lookahead, options);
                                     }
-
                                 } else {
                                     g_AlphaStatus = "Data too short for search (<300).";
                                     g_SearchResults.clear();
@@ -715,8 +768,49 @@ int main(int, char**)
 
                             auto end_time = std::chrono::high_resolution_clock::now();
                             auto ms_int = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
+                            std::cout << "Fetch Time: " << ms_int.count() << "ms" << std::endl;
+                            if (!g_SearchTask) g_AlphaStatus += " (" + std::to_string(ms_int.count()) + "ms)";
+                        }
+                    }
+
+                    // Draw the running search's matches as they come in
+                    if (g_SearchTask) {
+                        const bool done = g_SearchTask->IsDone();
+                        if (g_SearchTask->Revision() != g_SearchRevision) {
+                            g_SearchRevision = g_SearchTask->Revision();
+                            g_SearchResults = g_SearchTask->Snapshot();
+                            UpdatePrediction(g_SearchPattern);
+                        }
+                        if (done) {
+                            auto ms_int = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                std::chrono::high_resolution_clock::now() - g_SearchStart);
                             std::cout << "Fetch+Search Total Time: " << ms_int.count() << "ms" << std::endl;
+                            try {
+                                g_SearchTask->Future().get();
+                                g_AlphaStatus = "Found Top " + std::to_string(g_SearchResults.size()) + " Matches.";
+                            } catch (const std::exception& e) {
+                                g_AlphaStatus = "Error: " + std::string(e.what());
+                            }
                             g_AlphaStatus += " (" + std::to_string(ms_int.count()) + "ms)";
+                            g_SearchTask.reset();
+                        } else {
+                            g_AlphaStatus = "Running OpenMP Search... " + std::to_string(static_cast<int>(g_SearchTask->Progress() * 100.0)) + "%";
+                        }
+                    }
+                    if (g_LiveStreamStart.valid() && g_LiveStreamStart.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                        try {
+                            std::vector<SearchResult> results = g_LiveStreamStart.get();
+                            if (g_LiveStreamLookahead == g_Lookahead && static_cast<int>(g_SearchPattern.size()) == g_QuerySize) {
+                                auto ms_int = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                    std::chrono::high_resolution_clock::now() - g_SearchStart);
+                                std::cout << "Fetch+Search Total Time: " << ms_int.count() << "ms" << std::endl;
+                                g_SearchResults = std::move(results);
+                                UpdatePrediction(g_SearchPattern);
+                                g_AlphaStatus = "Found Top " + std::to_string(g_SearchResults.size()) + " Matches. (" +
+                                                std::to_string(ms_int.count()) + "ms)";
+                            }
+                        } catch (const std::exception& e) {
+                            g_AlphaStatus = "Error: " + std::string(e.what());
                         }
                     }
                     ImGui::SameLine();
@@ -745,19 +839,11 @@ int main(int, char**)
                                 // 1. Plot Matches (Background)
                                 for (size_t i = 0; i < g_SearchResults.size(); ++i) {
                                     const auto& res = g_SearchResults[i];
-                                    if (res.stockPtr) {
-                                        // Reconstruct Scaled Data
-                                        std::vector<double> scaledData;
-                                        if (res.scale == 1) {
-                                            scaledData = res.stockPtr->data;
-                                        } else {
-                                            scaledData = res.stockPtr->data;
-                                            for (int s = 1; s < res.scale; s *= 2) {
-                                                scaledData = AnalysisEngine::Downsample(scaledData);
-                                            }
-                                        }
+                                    if (res.stockPin) {
+                                        // Match and lookahead in the query's time base
+                                        std::vector<double> scaledData = AnalysisEngine::MatchSegment(res, g_QuerySize + g_Lookahead);
 
-                                        int start = res.offset;
+                                        int start = 0;
                                         // 300 (match) + 100 (future) -> g_QuerySize + g_Lookahead
                                         int len = g_QuerySize + g_Lookahead; 
                                         if (start + len > (int)scaledData.size()) len = (int)scaledData.size() - start;
@@ -924,6 +1010,8 @@ int main(int, char**)
                     ImGui::Text("Simulation Mode: Backtest strategy on random tickers.");
                     ImGui::InputText("API Key", g_AlphaApiKey, sizeof(g_AlphaApiKey), ImGuiInputTextFlags_Password);
                     ImGui::Checkbox("Rate Limit (Free Tier - 12s delay)", &g_SimRateLimit);
+                    ImGui::SameLine();
+                    ImGui::Checkbox("Fine Time Scales", &g_FineScales);
                     
                     ImGui::SliderInt("Query Size", &g_QuerySize, 100, 500);
                     ImGui::SliderInt("Lookahead", &g_Lookahead, 10, 200);
@@ -1060,6 +1148,7 @@ int main(int, char**)
     }
 
     // Cleanup
+    if (g_LiveStreamStart.valid()) g_LiveStreamStart.wait();
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImPlot::DestroyContext();
@@ -0,0 +1,177 @@
+#include "result_cache.h"
+#include <cstring>
+
+namespace {
+
+// FNV-1a over 8-byte words, as DspLibrary::HashFile
+class Fnv {
+public:
+    void Add(uint64_t word) { m_Hash = (m_Hash ^ word) * 0x100000001B3ULL; }
+    void Add(double value) {
+        uint64_t word;
+        std::memcpy(&word, &value, sizeof(word));
+        Add(word);
+    }
+    uint64_t Value() const { return m_Hash; }
+
+private:
+    uint64_t m_Hash = 0xCBF29CE484222325ULL;
+};
+
+bool SameBits(const std::vector<double>& a, const std::vector<double>& b) {
+    return a.size() == b.size() && (a.empty() || std::memcmp(a.data(), b.data(), a.size() * sizeof(double)) == 0);
+}
+
+} // namespace
+
+ResultCache::ResultCache(size_t capacity) : m_Capacity(capacity) {}
+
+ResultCache::Key ResultCache::MakeKey(const std::vector<double>& query, bool useFred, int topK, int lookahead,
+                                      const SearchOptions& options) {
+    Key key;
+    key.query = query;
+    key.useFred = useFred;
+    key.topK = topK;
+    key.lookahead = lookahead;
+    key.options = options;
+
+    // Every SearchOptions field can change the results
+    Fnv fnv;
+    fnv.Add(static_cast<uint64_t>(query.size()));
+    for (double v : query) fnv.Add(v);
+    fnv.Add(static_cast<uint64_t>(useFred));
+    fnv.Add(static_cast<uint64_t>(static_cast<uint32_t>(topK)) << 32 | static_cast<uint32_t>(lookahead));
+    fnv.Add(static_cast<uint64_t>(options.mode));
+    fnv.Add(options.minPearson);
+    fnv.Add(static_cast<uint64_t>(static_cast<uint32_t>(options.matchesPerStock)) << 32 |
+            static_cast<uint32_t>(options.exclusionZone));
+    fnv.Add(static_cast<uint64_t>(static_cast<uint32_t>(options.coarseLevels)) << 32 |
+            static_cast<uint32_t>(options.indexLeaves));
+    fnv.Add(options.recallTarget);
+    for (double f : options.scaleFactors) fnv.Add(f);
+    key.hash = fnv.Value();
+    return key;
+}
+
+bool ResultCache::SameKey(const Key& a, const Key& b) {
+    const SearchOptions& x = a.options;
+    const SearchOptions& y = b.options;
+    return a.hash == b.hash && a.useFred == b.useFred && a.topK == b.topK && a.lookahead == b.lookahead &&
+           x.mode == y.mode && std::memcmp(&x.minPearson, &y.minPearson, sizeof(double)) == 0 &&
+           x.matchesPerStock == y.matchesPerStock && x.exclusionZone == y.exclusionZone &&
+           x.coarseLevels == y.coarseLevels && std::memcmp(&x.recallTarget, &y.recallTarget, sizeof(double)) == 0 &&
+           x.indexLeaves == y.indexLeaves && SameBits(x.scaleFactors, y.scaleFactors) && SameBits(a.query, b.query);
+}
+
+ResultCache::Lru::iterator ResultCache::Locate(const Key& key) {
+    auto range = m_ByHash.equal_range(key.hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (SameKey(it->second->key, key)) return it->second;
+    }
+    return m_Lru.end();
+}
+
+void ResultCache::Erase(Lru::iterator entry) {
+    auto range = m_ByHash.equal_range(entry->key.hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == entry) {
+            m_ByHash.erase(it);
+            break;
+        }
+    }
+    m_Lru.erase(entry);
+}
+
+void ResultCache::Reset(uint64_t version) {
+    m_Lru.clear();
+    m_ByHash.clear();
+    m_StockIndex.clear();
+    m_Version = version;
+}
+
+bool ResultCache::Find(const std::shared_ptr<const StockLibrary>& library, const std::vector<double>& query,
+                       bool useFred, int topK, int lookahead, const SearchOptions& options,
+                       std::vector<SearchResult>& results) {
+    if (!library) return false;
+    Key key = MakeKey(query, useFred, topK, lookahead, options);
+
+    std::vector<size_t> stocks;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if (m_Capacity == 0) return false;
+        if (library->version > m_Version) Reset(library->version);
+        // A search still running on an older version: its entries were emptied out, so it misses
+        Lru::iterator entry = library->version == m_Version ? Locate(key) : m_Lru.end();
+        if (entry == m_Lru.end()) {
+            ++m_Stats.misses;
+            return false;
+        }
+        m_Lru.splice(m_Lru.begin(), m_Lru, entry);
+        results = entry->results;
+        stocks = entry->stocks;
+    }
+
+    // Pinned outside the lock: in lazy mode this may decode a stock evicted since
+    for (size_t i = 0; i < results.size(); ++i) {
+        results[i].stockPin = AnalysisEngine::AcquireStock(library, stocks[i]);
+        if (!results[i].stockPin) {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            ++m_Stats.misses;
+            return false;
+        }
+    }
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    ++m_Stats.hits;
+    return true;
+}
+
+void ResultCache::Store(const std::shared_ptr<const StockLibrary>& library, const std::vector<double>& query,
+                        bool useFred, int topK, int lookahead, const SearchOptions& options,
+                        const std::vector<SearchResult>& results, uint64_t generation) {
+    if (!library) return;
+    Entry entry;
+    entry.key = MakeKey(query, useFred, topK, lookahead, options);
+    entry.results = results;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (m_Capacity == 0 || generation != m_Generation) return;
+    if (library->version > m_Version) Reset(library->version);
+    if (library->version < m_Version) return; // Results of an older version, not worth keeping
+    if (m_StockIndex.empty()) {
+        for (size_t i = 0; i < library->stocks.size(); ++i) m_StockIndex[library->stocks[i].Id()] = i;
+    }
+    for (SearchResult& result : entry.results) {
+        auto it = m_StockIndex.find(result.stockId);
+        if (it == m_StockIndex.end()) return; // Not a stock of this version
+        entry.stocks.push_back(it->second);
+        result.stockPin.reset();
+    }
+
+    Lru::iterator existing = Locate(entry.key);
+    if (existing != m_Lru.end()) Erase(existing);
+    m_Lru.push_front(std::move(entry));
+    m_ByHash.emplace(m_Lru.front().key.hash, m_Lru.begin());
+    while (m_Lru.size() > m_Capacity) Erase(std::prev(m_Lru.end()));
+}
+
+uint64_t ResultCache::Generation() const {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Generation;
+}
+
+void ResultCache::Clear() {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    Reset(m_Version);
+    ++m_Generation;
+}
+
+void ResultCache::SetCapacity(size_t capacity) {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Capacity = capacity;
+    while (m_Lru.size() > m_Capacity) Erase(std::prev(m_Lru.end()));
+}
+
+ResultCache::Stats ResultCache::GetStats() const {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Stats;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "analysis_engine.h"
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// LRU cache of Search results. An entry is keyed by the query values (bit for bit) and every
+// argument that shapes the results, and belongs to one library version: a call on a newer
+// version empties the cache, one on an older version misses and stores nothing. Entries hold
+// no stock pins (they would keep stocks resident past the lazy cache's budget); a hit pins the
+// matched stocks again.
+class ResultCache {
+public:
+    struct Stats {
+        size_t hits = 0;
+        size_t misses = 0;
+    };
+
+    explicit ResultCache(size_t capacity);
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+
+    // Read before a search and passed to Store: results of a search that overlapped a Clear
+    // (say, the index it used was replaced) are not stored
+    uint64_t Generation() const;
+    // Results stored for these arguments on 'library'; false on a miss
+    bool Find(const std::shared_ptr<const StockLibrary>& library, const std::vector<double>& query, bool useFred,
+              int topK, int lookahead, const SearchOptions& options, std::vector<SearchResult>& results);
+    void Store(const std::shared_ptr<const StockLibrary>& library, const std::vector<double>& query, bool useFred,
+               int topK, int lookahead, const SearchOptions& options, const std::vector<SearchResult>& results,
+               uint64_t generation);
+    void Clear(); // Also starts a new generation
+    void SetCapacity(size_t capacity); // 0 = off; drops the oldest entries beyond it
+    Stats GetStats() const;
+
+private:
+    struct Key {
+        std::vector<double> query;
+        bool useFred = false;
+        int topK = 0;
+        int lookahead = 0;
+        SearchOptions options;
+        uint64_t hash = 0;
+    };
+    struct Entry {
+        Key key;
+        std::vector<SearchResult> results; // Without stockPin
+        std::vector<size_t> stocks;        // Index of each result's stock in the library
+    };
+    using Lru = std::list<Entry>;
+
+    static Key MakeKey(const std::vector<double>& query, bool useFred, int topK, int lookahead,
+                       const SearchOptions& options);
+    static bool SameKey(const Key& a, const Key& b);
+    Lru::iterator Locate(const Key& key); // m_Lru.end() if absent; caller holds m_Mutex
+    void Erase(Lru::iterator entry);       // Caller holds m_Mutex
+    void Reset(uint64_t version);          // Caller holds m_Mutex
+
+    size_t m_Capacity;
+    mutable std::mutex m_Mutex;
+    Lru m_Lru; // Most recently used first
+    std::unordered_multimap<uint64_t, Lru::iterator> m_ByHash;
+    std::unordered_map<uint32_t, size_t> m_StockIndex; // StockName id -> index in m_Version's stocks
+    uint64_t m_Version = 0;
+    uint64_t m_Generation = 0; // Clear calls so far
+    Stats m_Stats;
+};
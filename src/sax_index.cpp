@@ -0,0 +1,587 @@
+#include "sax_index.h"
+#include "binary_io.h"
+#include "mapped_file.h"
+#include "search_common.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <set>
+#include <unordered_map>
+#include <omp.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+using BinaryIo::AlignUp;
+using BinaryIo::Cursor;
+using BinaryIo::kAlignment;
+using BinaryIo::Put;
+using BinaryIo::PutString;
+
+constexpr char kMagic[8] = { 'R', 'E', 'L', '2', 'I', 'S', 'A', 'X' };
+constexpr uint32_t kVersion = 1;
+constexpr uint32_t kByteOrderMark = 0x01020304;
+constexpr int kSegments = SaxIndex::kSegments;
+constexpr int kLevelBits = 6; // Entry slots hold record << kLevelBits | level
+constexpr uint32_t kLevelMask = (1u << kLevelBits) - 1;
+constexpr int kRootBits = kSegments; // One bit per segment: the iSAX root's children
+// Leaves a search thread takes at a time; their candidates share stock lookups. Lazy libraries
+// take more, as a stock decoded for one batch may be evicted before the next.
+constexpr int kLeafBatch = 16;
+constexpr int kLazyLeafBatch = 64;
+
+struct IndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t segments;
+    uint32_t windowLength;
+    uint64_t stockCount;
+    uint64_t leafCount;
+    uint64_t entryCount;
+    uint64_t leavesOffset;
+    uint64_t entriesOffset;
+    uint64_t fileSize;
+    uint64_t reserved;
+};
+static_assert(sizeof(IndexHeader) == 80, "Index header must stay 80 bytes");
+static_assert(sizeof(SaxIndex::Entry) == 8 + kSegments, "Index entries must stay packed");
+static_assert(sizeof(SaxIndex::Leaf) == 16 + 2 * kSegments, "Index leaves must stay packed");
+
+// N(0,1) quantiles cutting the line into 256 equally likely regions. Symbol s covers
+// [b[s], b[s + 1]], with b[0] = -inf and b[256] = +inf.
+const std::vector<double>& Breakpoints() {
+    static const std::vector<double> table = [] {
+        std::vector<double> b(257);
+        b[0] = -std::numeric_limits<double>::infinity();
+        b[256] = std::numeric_limits<double>::infinity();
+        for (int k = 1; k < 256; ++k) {
+            const double p = k / 256.0;
+            double lo = -10.0, hi = 10.0;
+            for (int it = 0; it < 100; ++it) {
+                double mid = 0.5 * (lo + hi);
+                if (0.5 * std::erfc(-mid / std::sqrt(2.0)) < p) lo = mid; else hi = mid;
+            }
+            b[k] = 0.5 * (lo + hi);
+        }
+        return b;
+    }();
+    return table;
+}
+
+uint8_t Symbol(double value) {
+    const std::vector<double>& b = Breakpoints();
+    return static_cast<uint8_t>(std::upper_bound(b.begin() + 1, b.end() - 1, value) - (b.begin() + 1));
+}
+
+// Segment s of an m-point window covers [SegmentStart(s), SegmentStart(s + 1))
+size_t SegmentStart(int s, size_t m) {
+    return static_cast<size_t>(s) * m / kSegments;
+}
+
+// Query side of the bounds: z-normalized PAA and segment lengths
+struct QueryPaa {
+    double paa[kSegments];
+    double length[kSegments];
+    double twoM;
+};
+
+// Upper bound on the Pearson of the query with any window whose symbols lie in [lo, hi] per
+// segment: MINDIST^2 = sum length_s * gap_s^2 <= dist^2 = 2m(1 - pearson)
+double PearsonBound(const QueryPaa& query, const uint8_t* lo, const uint8_t* hi) {
+    const std::vector<double>& b = Breakpoints();
+    double minDist = 0.0;
+    for (int s = 0; s < kSegments; ++s) {
+        double gap = 0.0;
+        if (query.paa[s] < b[lo[s]]) gap = b[lo[s]] - query.paa[s];
+        else if (query.paa[s] > b[hi[s] + 1]) gap = query.paa[s] - b[hi[s] + 1];
+        minDist += query.length[s] * gap * gap;
+    }
+    return 1.0 - minDist / query.twoM;
+}
+
+// Sort key: bit 7 of every segment, then bit 6... so entries of one iSAX node are contiguous
+void InterleavedKey(const uint8_t* word, uint64_t& hi, uint64_t& lo) {
+    hi = 0;
+    lo = 0;
+    for (int bit = 7; bit >= 0; --bit) {
+        uint64_t& dst = bit >= 4 ? hi : lo;
+        for (int s = 0; s < kSegments; ++s) dst = (dst << 1) | ((word[s] >> bit) & 1u);
+    }
+}
+
+struct KeyedEntry {
+    uint64_t hi;
+    uint64_t lo;
+    SaxIndex::Entry entry;
+
+    bool operator<(const KeyedEntry& other) const {
+        if (hi != other.hi) return hi < other.hi;
+        if (lo != other.lo) return lo < other.lo;
+        if (entry.slot != other.entry.slot) return entry.slot < other.entry.slot;
+        return entry.offset < other.entry.offset;
+    }
+};
+
+// SAX entries of every non-flat window of 'stock', which is library record 'record'
+void IndexStock(const CachedStock& stock, uint32_t record, size_t m, std::vector<KeyedEntry>& out) {
+    for (int level = 0; level < stock.LevelCount() && level <= static_cast<int>(kLevelMask); ++level) {
+        const size_t size = stock.LevelSize(level);
+        if (size < m) break;
+        const LevelStats stats = stock.Stats(level);
+        for (size_t j = 0; j + m <= size; ++j) {
+            double mean, ssx;
+            stats.Window(j, m, mean, ssx);
+            if (ssx == 0.0) continue;
+
+            // z-normalized segment means straight from the prefix sums of x - shift
+            const double inv = 1.0 / std::sqrt(ssx / static_cast<double>(m));
+            const double d = mean - stats.shift;
+            KeyedEntry keyed;
+            keyed.entry.slot = (record << kLevelBits) | static_cast<uint32_t>(level);
+            keyed.entry.offset = static_cast<uint32_t>(j);
+            for (int s = 0; s < kSegments; ++s) {
+                const size_t a = j + SegmentStart(s, m);
+                const size_t b = j + SegmentStart(s + 1, m);
+                const double segmentMean = (stats.prefixSum[b] - stats.prefixSum[a]) / static_cast<double>(b - a);
+                keyed.entry.word[s] = Symbol((segmentMean - d) * inv);
+            }
+            InterleavedKey(keyed.entry.word, keyed.hi, keyed.lo);
+            out.push_back(keyed);
+        }
+    }
+}
+
+// K-th best of the per-stock best matches. Every stock keeps a match at least as good as its
+// current best to the end, so the final Top K can never fall below it.
+class StockBests {
+public:
+    explicit StockBests(int k) : m_K(k) {}
+
+    // Records that 'stock' now has a match of 'pearson'; returns the K-th best stock, or -inf
+    double Update(int stock, double pearson) {
+        std::lock_guard<std::mutex> guard(m_Mutex);
+        auto it = m_InTop.find(stock);
+        if (it != m_InTop.end()) {
+            m_Top.erase({ it->second, stock });
+            it->second = pearson;
+            m_Top.insert({ pearson, stock });
+        } else if (static_cast<int>(m_Top.size()) < m_K) {
+            m_InTop[stock] = pearson;
+            m_Top.insert({ pearson, stock });
+        } else if (m_K > 0 && pearson > m_Top.begin()->first) {
+            m_InTop.erase(m_Top.begin()->second);
+            m_Top.erase(m_Top.begin());
+            m_InTop[stock] = pearson;
+            m_Top.insert({ pearson, stock });
+        }
+        if (m_K <= 0 || static_cast<int>(m_Top.size()) < m_K) return -std::numeric_limits<double>::infinity();
+        return m_Top.begin()->first;
+    }
+
+private:
+    int m_K;
+    std::mutex m_Mutex;
+    std::set<std::pair<double, int>> m_Top;
+    std::unordered_map<int, double> m_InTop;
+};
+
+struct Candidate {
+    int stock; // Library index
+    int level;
+    int offset;
+};
+
+// Matches of one library stock, from its index entries or a full scan
+struct StockMatches {
+    StockMatches(int capacity, int exclusionZone) : matches(capacity, exclusionZone) {}
+
+    std::mutex lock;
+    MatchSet matches;
+    double best = -2.0;
+};
+
+} // namespace
+
+bool SaxIndex::Build(const std::shared_ptr<const StockLibrary>& library, size_t windowLength, const std::string& path,
+                     size_t leafSize) {
+    if (!library || windowLength < static_cast<size_t>(kSegments) || windowLength > UINT32_MAX) return false;
+    const std::vector<CachedStock>& stocks = library->stocks;
+    if (stocks.size() > (UINT32_MAX >> kLevelBits)) return false;
+    leafSize = std::max<size_t>(1, std::min<size_t>(leafSize, UINT32_MAX));
+    const size_t m = windowLength;
+
+    // Windows of every stock, one stock per thread
+    std::vector<std::vector<KeyedEntry>> perStock(stocks.size());
+    std::vector<char> indexed(stocks.size(), 0);
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < static_cast<int>(stocks.size()); ++i) {
+        std::shared_ptr<const CachedStock> stock = AnalysisEngine::AcquireStock(library, i);
+        if (!stock || stock->Data().size() > UINT32_MAX) continue;
+        IndexStock(*stock, static_cast<uint32_t>(i), m, perStock[i]);
+        indexed[i] = 1;
+    }
+
+    // Bucket by root node, then sort each bucket on the full key
+    const size_t buckets = size_t(1) << kRootBits;
+    std::vector<uint64_t> bucketStart(buckets + 1, 0);
+    for (const auto& entries : perStock) {
+        for (const KeyedEntry& e : entries) ++bucketStart[(e.hi >> (64 - kRootBits)) + 1];
+    }
+    for (size_t b = 0; b < buckets; ++b) bucketStart[b + 1] += bucketStart[b];
+    const uint64_t entryCount = bucketStart[buckets];
+    if (entryCount == 0) {
+        std::cout << "AnalysisEngine: No " << m << "-point windows to index." << std::endl;
+        return false;
+    }
+
+    std::vector<KeyedEntry> sorted(entryCount);
+    {
+        std::vector<uint64_t> fill(bucketStart.begin(), bucketStart.end() - 1);
+        for (auto& entries : perStock) {
+            for (const KeyedEntry& e : entries) sorted[fill[e.hi >> (64 - kRootBits)]++] = e;
+            std::vector<KeyedEntry>().swap(entries);
+        }
+    }
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int b = 0; b < static_cast<int>(buckets); ++b) {
+        std::sort(sorted.begin() + bucketStart[b], sorted.begin() + bucketStart[b + 1]);
+    }
+
+    // Leaves: each root node cut into near-equal runs of at most leafSize entries
+    std::vector<Leaf> leaves;
+    for (size_t b = 0; b < buckets; ++b) {
+        const uint64_t count = bucketStart[b + 1] - bucketStart[b];
+        if (count == 0) continue;
+        const uint64_t pieces = (count + leafSize - 1) / leafSize;
+        for (uint64_t p = 0; p < pieces; ++p) {
+            Leaf leaf = {};
+            leaf.first = bucketStart[b] + count * p / pieces;
+            leaf.count = static_cast<uint32_t>(bucketStart[b] + count * (p + 1) / pieces - leaf.first);
+            std::memset(leaf.lo, 0xFF, sizeof(leaf.lo));
+            for (uint64_t e = leaf.first; e < leaf.first + leaf.count; ++e) {
+                const uint8_t* word = sorted[e].entry.word;
+                for (int s = 0; s < kSegments; ++s) {
+                    leaf.lo[s] = std::min(leaf.lo[s], word[s]);
+                    leaf.hi[s] = std::max(leaf.hi[s], word[s]);
+                }
+            }
+            leaves.push_back(leaf);
+        }
+    }
+
+    // Header and stock records
+    std::vector<unsigned char> meta;
+    IndexHeader header = {};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.byteOrder = kByteOrderMark;
+    header.segments = kSegments;
+    header.windowLength = static_cast<uint32_t>(m);
+    header.stockCount = stocks.size();
+    header.leafCount = leaves.size();
+    header.entryCount = entryCount;
+    Put(meta, header);
+    for (size_t i = 0; i < stocks.size(); ++i) {
+        const CachedStock& stock = stocks[i];
+        DspFileStamp stamp;
+        auto it = std::lower_bound(library->manifest.begin(), library->manifest.end(), stock.FullPath(),
+                                   [](const DspFileStamp& s, const std::string& p) { return s.path < p; });
+        if (it != library->manifest.end() && it->path == stock.FullPath()) stamp = *it;
+        PutString(meta, stock.FullPath());
+        PutString(meta, stock.Symbol());
+        Put(meta, stamp.size);
+        Put(meta, stamp.mtime);
+        Put(meta, stamp.hash);
+        // Only files with a manifest stamp can be recognized as unchanged later
+        Put(meta, static_cast<uint32_t>(indexed[i] && !stamp.path.empty() ? 1 : 0));
+    }
+    header.leavesOffset = AlignUp(meta.size());
+    header.entriesOffset = AlignUp(header.leavesOffset + leaves.size() * sizeof(Leaf));
+    header.fileSize = header.entriesOffset + entryCount * sizeof(Entry);
+    std::memcpy(meta.data(), &header, sizeof(header));
+
+    fs::path target = fs::u8path(path);
+    fs::path temp = target;
+    temp += ".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+
+        static const char zeros[kAlignment] = {};
+        out.write(reinterpret_cast<const char*>(meta.data()), static_cast<std::streamsize>(meta.size()));
+        out.write(zeros, static_cast<std::streamsize>(header.leavesOffset - meta.size()));
+        out.write(reinterpret_cast<const char*>(leaves.data()), static_cast<std::streamsize>(leaves.size() * sizeof(Leaf)));
+        out.write(zeros, static_cast<std::streamsize>(header.entriesOffset - header.leavesOffset - leaves.size() * sizeof(Leaf)));
+
+        std::vector<Entry> block;
+        block.reserve(64 * 1024);
+        for (uint64_t e = 0; e < entryCount; e += block.capacity()) {
+            block.clear();
+            for (uint64_t k = e; k < std::min<uint64_t>(entryCount, e + block.capacity()); ++k) block.push_back(sorted[k].entry);
+            out.write(reinterpret_cast<const char*>(block.data()), static_cast<std::streamsize>(block.size() * sizeof(Entry)));
+        }
+        if (!out.flush()) {
+            out.close();
+            std::error_code ec;
+            fs::remove(temp, ec);
+            return false;
+        }
+    }
+    std::error_code ec;
+    fs::rename(temp, target, ec);
+    if (ec) {
+        fs::remove(temp, ec);
+        return false;
+    }
+
+    std::cout << "AnalysisEngine: Indexed " << entryCount << " windows of " << m << " points in " << leaves.size()
+              << " leaves (" << header.fileSize / (1024 * 1024) << " MB)." << std::endl;
+    return true;
+}
+
+std::shared_ptr<const SaxIndex> SaxIndex::Open(const std::string& path) {
+    auto file = std::make_shared<MappedFile>();
+    if (!file->Open(path) || file->Size() < sizeof(IndexHeader)) return nullptr;
+
+    IndexHeader header;
+    std::memcpy(&header, file->Data(), sizeof(header));
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kVersion ||
+        header.byteOrder != kByteOrderMark || header.segments != static_cast<uint32_t>(kSegments) ||
+        header.fileSize != file->Size() || header.leavesOffset % kAlignment != 0 ||
+        header.entriesOffset % kAlignment != 0 || header.leavesOffset > header.entriesOffset ||
+        header.leafCount > (header.entriesOffset - header.leavesOffset) / sizeof(Leaf) ||
+        header.entriesOffset > file->Size() || header.entryCount > (file->Size() - header.entriesOffset) / sizeof(Entry)) {
+        std::cout << "AnalysisEngine: Index " << path << " is not usable." << std::endl;
+        return nullptr;
+    }
+
+    std::shared_ptr<SaxIndex> index(new SaxIndex());
+    index->m_WindowLength = header.windowLength;
+    index->m_Stocks.resize(header.stockCount);
+    Cursor in = { file->Data() + sizeof(header), file->Data() + header.leavesOffset };
+    for (StockRecord& record : index->m_Stocks) {
+        std::string fullPath = in.GetString();
+        std::string symbol = in.GetString();
+        record.stamp.path = fullPath;
+        record.stamp.size = in.Get<uint64_t>();
+        record.stamp.mtime = in.Get<int64_t>();
+        record.stamp.hash = in.Get<uint64_t>();
+        record.indexed = in.Get<uint32_t>() != 0;
+        if (!in.ok) return nullptr;
+        record.name = AnalysisEngine::InternName(fullPath, symbol);
+    }
+
+    index->m_Leaves = reinterpret_cast<const Leaf*>(file->Data() + header.leavesOffset);
+    index->m_LeafCount = header.leafCount;
+    index->m_Entries = reinterpret_cast<const Entry*>(file->Data() + header.entriesOffset);
+    index->m_EntryCount = header.entryCount;
+    for (size_t l = 0; l < index->m_LeafCount; ++l) {
+        const Leaf& leaf = index->m_Leaves[l];
+        if (leaf.first > header.entryCount || leaf.count > header.entryCount - leaf.first) return nullptr;
+    }
+    index->m_File = std::move(file);
+    return index;
+}
+
+std::vector<SearchResult> SaxIndex::Search(const std::shared_ptr<const StockLibrary>& library, const std::vector<double>& query,
+                                           bool useFred, int topK, int lookahead, const SearchOptions& options) const {
+    std::vector<SearchResult> results;
+    const size_t m = m_WindowLength;
+    if (query.size() != m) return results;
+
+    // Windows the index does not cover are scanned with Rolling
+    SearchOptions scanOptions = options;
+    scanOptions.mode = SearchMode::Rolling;
+    scanOptions.scaleFactors.clear();
+    QueryVariants variants;
+    if (!PrepareVariants(query, scanOptions, variants)) return results;
+
+    const PreparedQuery& prepared = variants.prepared[0];
+    QueryPaa paa;
+    paa.twoM = 2.0 * static_cast<double>(m);
+    const double inv = 1.0 / std::sqrt(prepared.sumSq / static_cast<double>(m));
+    for (int s = 0; s < kSegments; ++s) {
+        const size_t a = SegmentStart(s, m), b = SegmentStart(s + 1, m);
+        double sum = 0.0;
+        for (size_t k = a; k < b; ++k) sum += prepared.centered[k];
+        paa.length[s] = static_cast<double>(b - a);
+        paa.paa[s] = sum / paa.length[s] * inv;
+    }
+
+    // Index records that still describe a library stock: same file, unchanged
+    const std::vector<CachedStock>& stocks = library->stocks;
+    std::unordered_map<uint32_t, int> byId;
+    for (int i = 0; i < static_cast<int>(stocks.size()); ++i) {
+        if (useFred || !stocks[i].isFred) byId[stocks[i].Id()] = i;
+    }
+    std::vector<int> target(m_Stocks.size(), -1);
+    std::vector<bool> covered(stocks.size(), false);
+    for (size_t r = 0; r < m_Stocks.size(); ++r) {
+        const StockRecord& record = m_Stocks[r];
+        if (!record.indexed || !record.name) continue;
+        auto found = byId.find(record.name->id);
+        if (found == byId.end()) continue;
+        auto it = std::lower_bound(library->manifest.begin(), library->manifest.end(), record.stamp.path,
+                                   [](const DspFileStamp& s, const std::string& p) { return s.path < p; });
+        if (it == library->manifest.end() || it->path != record.stamp.path || it->size != record.stamp.size ||
+            it->mtime != record.stamp.mtime || it->hash != record.stamp.hash) {
+            continue;
+        }
+        target[r] = found->second;
+        covered[found->second] = true;
+    }
+
+    const int exclusionZone = options.exclusionZone >= 0 ? options.exclusionZone : static_cast<int>(m);
+    std::vector<std::unique_ptr<StockMatches>> perStock(stocks.size());
+    std::vector<int> uncovered;
+    for (const auto& entry : byId) {
+        perStock[entry.second] = std::make_unique<StockMatches>(options.matchesPerStock, exclusionZone);
+        if (!covered[entry.second]) uncovered.push_back(entry.second);
+    }
+    std::sort(uncovered.begin(), uncovered.end());
+
+    SharedThreshold threshold(options.minPearson);
+    StockBests bests(topK);
+    auto publish = [](StockMatches& state) {
+        double best = -2.0;
+        for (const Match& match : state.matches.Matches()) best = std::max(best, match.pearson);
+        if (best <= state.best) return -2.0;
+        state.best = best;
+        return best;
+    };
+
+    // Leaves, most promising first
+    std::vector<double> leafBound(m_LeafCount);
+    #pragma omp parallel for schedule(static)
+    for (int l = 0; l < static_cast<int>(m_LeafCount); ++l) {
+        leafBound[l] = PearsonBound(paa, m_Leaves[l].lo, m_Leaves[l].hi);
+    }
+    std::vector<int> order(m_LeafCount);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+        if (leafBound[a] != leafBound[b]) return leafBound[a] > leafBound[b];
+        return a < b;
+    });
+    const bool exact = options.mode != SearchMode::Indexed;
+    const int visitLimit = exact ? static_cast<int>(m_LeafCount)
+                                 : std::min(static_cast<int>(m_LeafCount), std::max(1, options.indexLeaves));
+
+    // Candidates of a batch of consecutive leaves are verified stock by stock, so each stock is
+    // pinned (or decoded, in a lazy library) once per batch
+    const int batch = library->stockCache ? kLazyLeafBatch : kLeafBatch;
+    auto gather = [&](const Leaf& leaf, std::vector<Candidate>& candidates, long long& screened) {
+        for (uint64_t e = leaf.first; e < leaf.first + leaf.count; ++e) {
+            const Entry& entry = m_Entries[e];
+            const uint32_t record = entry.slot >> kLevelBits;
+            const int level = static_cast<int>(entry.slot & kLevelMask);
+            if (record >= target.size() || target[record] < 0) continue;
+            const int i = target[record];
+            if (static_cast<int>(entry.offset) > SearchLimit(stocks[i], level, m, lookahead)) continue;
+            ++screened;
+            if (PearsonBound(paa, entry.word, entry.word) < threshold.Get() - kRescoreMargin) continue;
+            candidates.push_back({ i, level, static_cast<int>(entry.offset) });
+        }
+    };
+
+    std::atomic<int> nextLeaf(0);
+    long long visited = 0;
+    long long screened = 0;
+    long long verified = 0;
+    #pragma omp parallel reduction(+:visited, screened, verified)
+    {
+        std::vector<Candidate> candidates;
+        bool done = false;
+        for (int first = nextLeaf.fetch_add(batch); first < visitLimit && !done; first = nextLeaf.fetch_add(batch)) {
+            candidates.clear();
+            for (int k = first; k < std::min(visitLimit, first + batch); ++k) {
+                // Bounds only fall from here on, and the bar only rises
+                if (leafBound[order[k]] < threshold.Get() - kRescoreMargin) {
+                    done = true;
+                    break;
+                }
+                ++visited;
+                gather(m_Leaves[order[k]], candidates, screened);
+            }
+            std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+                if (a.stock != b.stock) return a.stock < b.stock;
+                if (a.level != b.level) return a.level < b.level;
+                return a.offset < b.offset;
+            });
+
+            for (size_t c = 0; c < candidates.size();) {
+                const int i = candidates[c].stock;
+                size_t end = c;
+                while (end < candidates.size() && candidates[end].stock == i) ++end;
+                std::shared_ptr<const CachedStock> stock = AnalysisEngine::AcquireStock(library, i);
+                if (!stock) {
+                    c = end;
+                    continue;
+                }
+
+                // Scored into a copy, so other threads can offer to the stock meanwhile. The whole
+                // pool is merged back, so the picks do not depend on which thread finishes first
+                StockMatches& state = *perStock[i];
+                MatchSet matches(options.matchesPerStock, exclusionZone);
+                {
+                    std::lock_guard<std::mutex> guard(state.lock);
+                    matches = state.matches;
+                }
+                for (; c < end; ++c) {
+                    const Candidate& candidate = candidates[c];
+                    ++verified;
+                    const double* window = stock->Level(candidate.level).data() + candidate.offset;
+                    matches.Offer(AnalysisEngine::CalculatePearson(query.data(), window, m), candidate.offset,
+                                  1 << candidate.level);
+                }
+                double best;
+                {
+                    std::lock_guard<std::mutex> guard(state.lock);
+                    state.matches.Merge(matches);
+                    best = publish(state);
+                }
+                if (best > -2.0) threshold.Publish(bests.Update(i, best));
+            }
+        }
+    }
+
+    // New and changed stocks: full scan against the bar the index pass left
+    std::vector<PruneCounters> threadCounters(omp_get_max_threads());
+    #pragma omp parallel for schedule(dynamic)
+    for (int u = 0; u < static_cast<int>(uncovered.size()); ++u) {
+        const int i = uncovered[u];
+        std::shared_ptr<const CachedStock> stock = AnalysisEngine::AcquireStock(library, i);
+        if (!stock) continue;
+        StockMatches& state = *perStock[i];
+        ScoreStock(variants, *stock, lookahead, SearchMode::Rolling, threshold, state.matches,
+                   threadCounters[omp_get_thread_num()]);
+        double best = publish(state);
+        if (best > -2.0) threshold.Publish(bests.Update(i, best));
+    }
+
+    std::vector<TopKHeap> heaps(1, TopKHeap(topK));
+    for (int i = 0; i < static_cast<int>(stocks.size()); ++i) {
+        if (!perStock[i] || perStock[i]->best < options.minPearson) continue;
+        std::shared_ptr<const CachedStock> stock = AnalysisEngine::AcquireStock(library, i);
+        if (!stock) continue;
+        for (const Match& match : perStock[i]->matches.Matches()) {
+            if (match.pearson < options.minPearson) continue;
+            SearchResult result = MakeResult(*stock, match, variants);
+            result.stockPin = stock;
+            heaps[0].Push(result);
+        }
+    }
+    results = MergeTopK(heaps, topK);
+
+    std::cout << "AnalysisEngine: Index visited " << visited << " of " << m_LeafCount << " leaves, verified " << verified
+              << " of " << screened << " windows; scanned " << uncovered.size() << " stocks it does not cover." << std::endl;
+    return results;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "analysis_engine.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class MappedFile;
+
+// On-disk iSAX index over the z-normalized windows of one length at every pyramid level of a
+// library. A window is summarized by the PAA of kSegments segments, quantized to 8-bit SAX
+// symbols on N(0,1) breakpoints (so each lower cardinality is a prefix of the bits). Entries are
+// sorted by their bit-interleaved words, which keeps every iSAX subtree contiguous, and cut into
+// leaves of at most leafSize entries that never straddle a root node. Each leaf records the
+// bounding box of its words, and MINDIST to that box is a lower bound on the z-normalized
+// distance of every window in it (dist^2 = 2m(1 - pearson)), so searches rank the leaves and
+// read only the ones they visit.
+//
+// Flat windows (Pearson 0 with everything) are not indexed. Stocks that are new or changed
+// since the build are not covered, and searches scan them in full.
+//
+// Layout (native endianness, checked by the header):
+//   header | stocks (path, symbol, size, mtime, hash) | leaves | entries
+// Leaves and entries start on 64-byte boundaries.
+class SaxIndex {
+public:
+    static constexpr int kSegments = 16;
+    static constexpr size_t kDefaultLeafSize = 1024;
+
+    // Indexes every window of windowLength points of 'library' (lazy stocks are decoded as
+    // needed) and writes the index to a temporary file next to 'path', then renames it into
+    // place. Returns false if the library cannot be indexed or the file cannot be written.
+    static bool Build(const std::shared_ptr<const StockLibrary>& library, size_t windowLength, const std::string& path,
+                      size_t leafSize = kDefaultLeafSize);
+    // Maps 'path'; nullptr if it is missing or malformed
+    static std::shared_ptr<const SaxIndex> Open(const std::string& path);
+
+    size_t WindowLength() const { return m_WindowLength; }
+    size_t LeafCount() const { return m_LeafCount; }
+    size_t EntryCount() const { return m_EntryCount; }
+
+    // SearchMode::Indexed visits the options.indexLeaves leaves with the best bounds,
+    // SearchMode::IndexedExact every leaf whose bound can still reach the Top K (the same
+    // results as the scans). 'query' must have WindowLength() points.
+    std::vector<SearchResult> Search(const std::shared_ptr<const StockLibrary>& library, const std::vector<double>& query,
+                                     bool useFred, int topK, int lookahead, const SearchOptions& options) const;
+
+    struct Entry {
+        uint32_t slot;   // Stock record << 6 | pyramid level
+        uint32_t offset; // Window start in level coordinates
+        uint8_t word[kSegments];
+    };
+
+    struct Leaf {
+        uint64_t first; // Index of its first entry
+        uint32_t count;
+        uint32_t reserved;
+        uint8_t lo[kSegments]; // Smallest symbol per segment among its entries
+        uint8_t hi[kSegments]; // Largest
+    };
+
+private:
+    SaxIndex() = default;
+
+    struct StockRecord {
+        const StockName* name = nullptr;
+        DspFileStamp stamp;
+        bool indexed = false;
+    };
+
+    std::shared_ptr<const MappedFile> m_File;
+    size_t m_WindowLength = 0;
+    std::vector<StockRecord> m_Stocks;
+    const Leaf* m_Leaves = nullptr;
+    size_t m_LeafCount = 0;
+    const Entry* m_Entries = nullptr;
+    size_t m_EntryCount = 0;
+};
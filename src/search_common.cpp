@@ -0,0 +1,775 @@
+#include "search_common.h"
+#include "simd_kernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+bool PrepareQuery(const std::vector<double>& pattern, SearchMode mode, PreparedQuery& prepared) {
+    const size_t patternSize = pattern.size();
+    if (patternSize < AnalysisEngine::kMinLevelSize) return false; // Minimum safety checks
+
+    prepared.pattern = &pattern;
+    double patternMean = 0.0;
+    for (double v : pattern) patternMean += v;
+    patternMean /= static_cast<double>(patternSize);
+    prepared.centered.reserve(patternSize);
+    for (double v : pattern) {
+        prepared.centered.push_back(v - patternMean);
+        prepared.sumSq += (v - patternMean) * (v - patternMean);
+    }
+    // A flat query correlates at 0 with everything, so nothing can pass the threshold
+    if (prepared.sumSq == 0.0) return false;
+
+    if (mode == SearchMode::Mass) {
+        prepared.sliding = std::make_unique<SlidingDotProduct>(prepared.centered);
+    }
+    if (mode == SearchMode::Float32) {
+        prepared.centered32.reserve(patternSize);
+        for (double c : prepared.centered) {
+            prepared.centered32.push_back(static_cast<float>(c));
+            prepared.centeredSum32 += prepared.centered32.back();
+        }
+    }
+    if (mode == SearchMode::Pruned || mode == SearchMode::Dft) {
+        double inv = 1.0 / std::sqrt(prepared.sumSq / static_cast<double>(patternSize));
+        prepared.zNorm.reserve(patternSize);
+        for (double c : prepared.centered) prepared.zNorm.push_back(c * inv);
+    }
+    if (mode == SearchMode::Dft) {
+        const double twoPi = 2.0 * std::acos(-1.0);
+        prepared.dft.assign(2 * CachedStock::kDftCoefficients, 0.0);
+        for (int f = 0; f < CachedStock::kDftCoefficients; ++f) {
+            for (size_t t = 0; t < patternSize; ++t) {
+                const double angle = twoPi * static_cast<double>(((f + 1) * t) % patternSize) / patternSize;
+                prepared.dft[2 * f] += prepared.zNorm[t] * std::cos(angle);
+                prepared.dft[2 * f + 1] -= prepared.zNorm[t] * std::sin(angle);
+            }
+        }
+    }
+    if (mode == SearchMode::Pruned) {
+        prepared.order.resize(patternSize);
+        for (size_t k = 0; k < patternSize; ++k) prepared.order[k] = k;
+        std::sort(prepared.order.begin(), prepared.order.end(), [&](size_t a, size_t b) {
+            return std::abs(prepared.zNorm[a]) > std::abs(prepared.zNorm[b]);
+        });
+    }
+    return true;
+}
+
+std::vector<double> ResampleQuery(const std::vector<double>& pattern, size_t length) {
+    std::vector<double> out(length);
+    const double step = static_cast<double>(pattern.size() - 1) / static_cast<double>(length - 1);
+    for (size_t i = 0; i + 1 < length; ++i) {
+        const double pos = static_cast<double>(i) * step;
+        const size_t k = std::min(static_cast<size_t>(pos), pattern.size() - 2);
+        out[i] = pattern[k] + (pattern[k + 1] - pattern[k]) * (pos - static_cast<double>(k));
+    }
+    out[length - 1] = pattern.back();
+    return out;
+}
+
+bool PrepareVariants(const std::vector<double>& query, const SearchOptions& options, QueryVariants& variants) {
+    variants.querySize = query.size();
+    if (options.scaleFactors.empty()) {
+        variants.prepared.resize(1);
+        return PrepareQuery(query, options.mode, variants.prepared[0]);
+    }
+    if (query.size() < AnalysisEngine::kMinLevelSize) return false;
+
+    // Factor f stretches the query's span of m - 1 steps to f * (m - 1); factors that round to
+    // the same length share one copy
+    std::vector<size_t> lengths;
+    for (double factor : options.scaleFactors) {
+        if (!(factor > 0.0) || !std::isfinite(factor)) continue;
+        const double length = std::round(static_cast<double>(query.size() - 1) * factor) + 1.0;
+        if (length < static_cast<double>(AnalysisEngine::kMinLevelSize) || length > 1e9) continue;
+        lengths.push_back(static_cast<size_t>(length));
+    }
+    std::sort(lengths.begin(), lengths.end());
+    lengths.erase(std::unique(lengths.begin(), lengths.end()), lengths.end());
+
+    // Sized up front: each PreparedQuery points at its pattern
+    variants.patterns.resize(lengths.size());
+    variants.prepared.resize(lengths.size());
+    size_t kept = 0;
+    for (size_t length : lengths) {
+        variants.patterns[kept] = ResampleQuery(query, length);
+        PreparedQuery& prepared = variants.prepared[kept];
+        prepared = PreparedQuery();
+        if (!PrepareQuery(variants.patterns[kept], options.mode, prepared)) continue;
+        prepared.levels = 1;
+        prepared.stretch = static_cast<double>(length - 1) / static_cast<double>(query.size() - 1);
+        ++kept;
+    }
+    variants.patterns.resize(kept);
+    variants.prepared.resize(kept);
+    return kept > 0;
+}
+
+void PrepareCoarse(PreparedQuery& prepared, int coarseLevels) {
+    std::vector<double> coarse = *prepared.pattern;
+    int shift = 0;
+    while (shift < coarseLevels && coarse.size() / 2 >= AnalysisEngine::kMinLevelSize) {
+        coarse = AnalysisEngine::Downsample(coarse);
+        ++shift;
+    }
+
+    double mean = 0.0;
+    for (double v : coarse) mean += v;
+    mean /= static_cast<double>(coarse.size());
+    prepared.coarseCentered.clear();
+    prepared.coarseSumSq = 0.0;
+    for (double v : coarse) {
+        prepared.coarseCentered.push_back(v - mean);
+        prepared.coarseSumSq += (v - mean) * (v - mean);
+    }
+    // Nothing left to correlate with: score every window in full
+    prepared.coarseShift = prepared.coarseSumSq > 0.0 ? shift : 0;
+}
+
+void PruneCounters::Add(const PruneCounters& other) {
+    windows += other.windows;
+    lowerBound += other.lowerBound;
+    abandoned += other.abandoned;
+    full += other.full;
+}
+
+// --- MatchSet ---
+
+namespace {
+size_t FirstCompaction(int capacity) {
+    return static_cast<size_t>(std::max(32, 8 * capacity));
+}
+}
+
+MatchSet::MatchSet(int capacity, int exclusionZone)
+    : m_Capacity(std::max(1, capacity)), m_ExclusionZone(exclusionZone), m_CompactAt(FirstCompaction(m_Capacity)) {
+}
+
+// Higher Pearson wins; exact ties go to the smaller scale, then the lower variant, then the
+// earlier offset, which is the order the brute-force scan meets them in
+static bool Better(const Match& a, const Match& b) {
+    if (a.pearson != b.pearson) return a.pearson > b.pearson;
+    if (a.scale != b.scale) return a.scale < b.scale;
+    if (a.variant != b.variant) return a.variant < b.variant;
+    return a.offset < b.offset;
+}
+
+static bool Same(const Match& a, const Match& b) {
+    return a.pearson == b.pearson && a.scale == b.scale && a.variant == b.variant && a.offset == b.offset;
+}
+
+bool MatchSet::Conflicts(const Match& m, const Match& candidate) const {
+    if (m_Capacity == 1) return true; // Single best: everything competes
+    long long a = static_cast<long long>(m.offset) * m.scale;
+    long long b = static_cast<long long>(candidate.offset) * candidate.scale;
+    return a == b || std::llabs(a - b) < m_ExclusionZone;
+}
+
+size_t MatchSet::Pick(const std::vector<Match>& sorted, size_t limit, std::vector<Match>& picks) const {
+    size_t last = 0;
+    for (size_t i = 0; i < sorted.size() && picks.size() < limit; ++i) {
+        bool clear = true;
+        for (const Match& pick : picks) {
+            if (Conflicts(pick, sorted[i])) {
+                clear = false;
+                break;
+            }
+        }
+        if (!clear) continue;
+        picks.push_back(sorted[i]);
+        last = i;
+    }
+    return last;
+}
+
+void MatchSet::Compact() {
+    std::sort(m_Candidates.begin(), m_Candidates.end(), Better);
+    m_Candidates.erase(std::unique(m_Candidates.begin(), m_Candidates.end(), Same), m_Candidates.end());
+
+    std::vector<Match> picks;
+    const size_t last = Pick(m_Candidates, 2 * static_cast<size_t>(m_Capacity), picks);
+    if (picks.size() == 2 * static_cast<size_t>(m_Capacity)) {
+        m_Bar = m_Candidates[last];
+        m_HasBar = true;
+        m_Candidates.resize(last + 1);
+    }
+    m_CompactAt = std::max(FirstCompaction(m_Capacity), 2 * m_Candidates.size());
+}
+
+double MatchSet::Threshold() const {
+    // Matches in the brute-force path start from -1.0 and must strictly improve
+    if (m_Capacity == 1) return m_Candidates.empty() ? -1.0 : m_Candidates[0].pearson;
+    return m_HasBar ? m_Bar.pearson : -1.0;
+}
+
+bool MatchSet::Admits(const Match& candidate) const {
+    if (candidate.pearson <= -1.0) return false;
+    if (m_Capacity == 1) return m_Candidates.empty() || Better(candidate, m_Candidates[0]);
+    return !m_HasBar || Better(candidate, m_Bar);
+}
+
+bool MatchSet::Admits(double pearson, int offset, int scale) const {
+    return Admits(Match{ pearson, offset, scale, m_Variant });
+}
+
+void MatchSet::Offer(double pearson, int offset, int scale) {
+    Offer(Match{ pearson, offset, scale, m_Variant });
+}
+
+void MatchSet::Offer(const Match& match) {
+    if (!Admits(match)) return;
+    if (m_Capacity == 1) {
+        m_Candidates.assign(1, match);
+        return;
+    }
+    m_Candidates.push_back(match);
+    if (m_Candidates.size() >= m_CompactAt) Compact();
+}
+
+void MatchSet::Merge(const MatchSet& other) {
+    for (const Match& m : other.m_Candidates) Offer(m);
+    if (m_Capacity > 1) Compact();
+}
+
+std::vector<Match> MatchSet::Matches() const {
+    if (m_Capacity == 1) return m_Candidates;
+    std::vector<Match> sorted = m_Candidates;
+    std::sort(sorted.begin(), sorted.end(), Better);
+    std::vector<Match> picks;
+    Pick(sorted, static_cast<size_t>(m_Capacity), picks);
+    return picks;
+}
+
+void MatchSet::Clear() {
+    m_Candidates.clear();
+    m_HasBar = false;
+    m_CompactAt = FirstCompaction(m_Capacity);
+}
+
+// --- TopKHeap ---
+
+namespace {
+// Min-heap on Pearson: the weakest kept result sits at the front
+bool HeapOrder(const SearchResult& a, const SearchResult& b) {
+    return a.pearson > b.pearson;
+}
+}
+
+bool TopKHeap::Push(const SearchResult& result) {
+    if (m_Capacity <= 0) return false;
+    if (static_cast<int>(m_Items.size()) < m_Capacity) {
+        m_Items.push_back(result);
+        std::push_heap(m_Items.begin(), m_Items.end(), HeapOrder);
+        return true;
+    }
+    if (result.pearson <= m_Items.front().pearson) return false;
+    std::pop_heap(m_Items.begin(), m_Items.end(), HeapOrder);
+    m_Items.back() = result;
+    std::push_heap(m_Items.begin(), m_Items.end(), HeapOrder);
+    return true;
+}
+
+double TopKHeap::Kth() const {
+    if (m_Capacity <= 0 || static_cast<int>(m_Items.size()) < m_Capacity) {
+        return -std::numeric_limits<double>::infinity();
+    }
+    return m_Items.front().pearson;
+}
+
+std::vector<SearchResult> MergeTopK(std::vector<TopKHeap>& heaps, int topK) {
+    std::vector<SearchResult> results;
+    for (auto& heap : heaps) {
+        results.insert(results.end(), heap.Items().begin(), heap.Items().end());
+    }
+
+    // Sort by Hyperspherical Distance (Ascending: 0 is best)
+    // Note: Since Distance = acos(Pearson), Sorting by Distance Ascending is IDENTICAL to Pearson Descending.
+    auto byDistance = [](const SearchResult& a, const SearchResult& b) {
+        return a.distance < b.distance;
+    };
+
+    // At most threads * K candidates; only the survivors get sorted
+    if (topK >= 0 && results.size() > static_cast<size_t>(topK)) {
+        std::nth_element(results.begin(), results.begin() + topK, results.end(), byDistance);
+        results.resize(topK);
+    }
+    std::sort(results.begin(), results.end(), byDistance);
+    return results;
+}
+
+void SharedThreshold::Publish(double kth) {
+    double current = m_Value.load(std::memory_order_relaxed);
+    while (kth > current && !m_Value.compare_exchange_weak(current, kth, std::memory_order_relaxed)) {
+    }
+}
+
+// --- Level scorers ---
+// Each one scores the windows starting at offsets [first, last] of one level.
+
+namespace {
+
+void ScoreLevelBruteForce(const std::vector<double>& pattern, const double* data, int first, int last, int scale,
+                          MatchSet& matches) {
+    for (int j = first; j <= last; ++j) {
+        double p = AnalysisEngine::CalculatePearson(pattern.data(), data + j, pattern.size());
+        matches.Offer(p, j, scale);
+    }
+}
+
+// Turns per-window dot products with the centered query into Pearson, and rescores
+// exactly every window that could still enter the match set. dots[0] belongs to 'first'.
+void FinishLevel(const PreparedQuery& query, const double* data, const LevelStats& stats, const double* dots,
+                 int first, int last, int scale, const SharedThreshold& shared, MatchSet& matches) {
+    const size_t m = query.centered.size();
+    const double floor = shared.Get() - kRescoreMargin;
+
+    for (int j = first; j <= last; ++j) {
+        double mean, ssx;
+        stats.Window(j, m, mean, ssx);
+        double approx = (ssx > 0.0) ? dots[j - first] / std::sqrt(query.sumSq * ssx) : 0.0;
+        if (approx < floor) continue;
+        if (!matches.Admits(approx + kRescoreMargin, j, scale)) continue;
+
+        double p = AnalysisEngine::CalculatePearson(query.pattern->data(), data + j, m);
+        matches.Offer(p, j, scale);
+    }
+}
+
+void ScoreLevelRolling(const PreparedQuery& query, const double* data, const LevelStats& stats, int first, int last,
+                       int scale, const SharedThreshold& shared, MatchSet& matches) {
+    const size_t m = query.centered.size();
+    const size_t windows = static_cast<size_t>(last - first) + 1;
+    const double* q = query.centered.data();
+
+    thread_local std::vector<double> dots;
+    dots.resize(windows);
+
+    // sum(centered_q * x) == sum(centered_q * (x - mean_x)) because centered_q sums to zero,
+    // so the inner loop is a plain dot product
+    for (size_t i = 0; i < windows; ++i) {
+        dots[i] = SimdKernels::Dot(q, data + first + i, m);
+    }
+    FinishLevel(query, data, stats, dots.data(), first, last, scale, shared, matches);
+}
+
+void ScoreLevelMass(const PreparedQuery& query, const double* data, const LevelStats& stats, int first, int last,
+                    int scale, const SharedThreshold& shared, MatchSet& matches) {
+    const size_t m = query.centered.size();
+    const size_t windows = static_cast<size_t>(last - first) + 1;
+
+    thread_local std::vector<double> dots;
+    dots.resize(windows);
+
+    query.sliding->Compute(data + first, windows + m - 1, stats.shift, dots.data());
+    FinishLevel(query, data, stats, dots.data(), first, last, scale, shared, matches);
+}
+
+// Rolling on the float copy of a level, which holds x - shift. With d = mean(window) - shift,
+// sum(q32 * (x - shift)) - d * sum(q32) is the centered dot product up to float rounding, bounded
+// by DotF32's error times |q| * |x - shift| = sqrt(sumSq * (ssx + m * d^2)). Every window whose
+// score could be within that bound of the bar is rescored in double, so the matches are exactly
+// those of the double path.
+void ScoreLevelFloat32(const PreparedQuery& query, const double* data, const float* data32, const LevelStats& stats,
+                       int first, int last, int scale, const SharedThreshold& shared, MatchSet& matches,
+                       PruneCounters& counters) {
+    const size_t m = query.centered32.size();
+    const double n = static_cast<double>(m);
+    const float* q = query.centered32.data();
+    // DotF32's bound, doubled to cover rounding q and x - shift to float
+    const double gamma = 2.0 * (n + 2.0) * std::ldexp(1.0, -24);
+    const double bar = shared.Get();
+
+    for (int j = first; j <= last; ++j) {
+        ++counters.windows;
+        double mean, ssx;
+        stats.Window(j, m, mean, ssx);
+        double approx = 0.0;
+        double margin = kRescoreMargin;
+        if (ssx > 0.0) {
+            const double d = mean - stats.shift;
+            const double norm = std::sqrt(query.sumSq * ssx);
+            approx = (SimdKernels::DotF32(q, data32 + j, m) - d * query.centeredSum32) / norm;
+            margin += gamma * std::sqrt(query.sumSq * (ssx + n * d * d)) / norm;
+        }
+        if (approx + margin < bar) continue;
+        if (!matches.Admits(approx + margin, j, scale)) continue;
+
+        ++counters.full;
+        double p = AnalysisEngine::CalculatePearson(query.pattern->data(), data + j, m);
+        matches.Offer(p, j, scale);
+    }
+}
+
+// Pearson of a centered pattern with the window at 'offset', without the exact rescore
+double ApproxPearson(const std::vector<double>& centered, double sumSq, const double* data, const LevelStats& stats,
+                     int offset) {
+    double mean, ssx;
+    stats.Window(offset, centered.size(), mean, ssx);
+    return ssx > 0.0 ? SimdKernels::Dot(centered.data(), data + offset, centered.size()) / std::sqrt(sumSq * ssx) : 0.0;
+}
+
+// Last offset of the coarse copy of 'level' a coarse window fits at, or -1 without one
+int CoarseLimit(const PreparedQuery& query, const CachedStock& stock, int level) {
+    const int coarseLevel = level + query.coarseShift;
+    if (query.coarseShift == 0 || coarseLevel >= stock.LevelCount()) return -1;
+    return static_cast<int>(stock.LevelSize(coarseLevel)) - static_cast<int>(query.coarseCentered.size());
+}
+
+// Window j of a level averages down to window j / 2^shift of its coarse copy when j is a
+// multiple of 2^shift. Every other window lies between two coarse offsets, and is refined
+// if either of them is promising. Windows past the last coarse offset are always refined.
+void ScoreLevelHierarchical(const PreparedQuery& query, const CachedStock& stock, int level, int first, int last,
+                            const SharedThreshold& shared, MatchSet& matches, PruneCounters& counters) {
+    const double* data = stock.Level(level).data();
+    const LevelStats stats = stock.Stats(level);
+    const int scale = 1 << level;
+    counters.windows += static_cast<size_t>(last - first) + 1;
+
+    const int coarseLast = CoarseLimit(query, stock, level);
+    if (coarseLast < 0) {
+        counters.full += static_cast<size_t>(last - first) + 1;
+        ScoreLevelRolling(query, data, stats, first, last, scale, shared, matches);
+        return;
+    }
+    const int step = 1 << query.coarseShift;
+    const double* coarse = stock.Level(level + query.coarseShift).data();
+    const LevelStats coarseStats = stock.Stats(level + query.coarseShift);
+    const double bar = std::max(shared.Get(), matches.Threshold()) - query.coarseSlack;
+
+    int runFirst = -1, runLast = -2; // Refinement run being extended
+    auto refine = [&](int lo, int hi) {
+        lo = std::max(lo, first);
+        hi = std::min(hi, last);
+        if (lo > hi) return;
+        if (lo <= runLast + 1) {
+            runLast = std::max(runLast, hi);
+            return;
+        }
+        if (runFirst >= 0) {
+            counters.full += static_cast<size_t>(runLast - runFirst) + 1;
+            ScoreLevelRolling(query, data, stats, runFirst, runLast, scale, shared, matches);
+        }
+        runFirst = lo;
+        runLast = hi;
+    };
+
+    const int k0 = first / step;
+    const int k1 = std::min((last + step - 1) / step, coarseLast);
+    for (int k = k0; k <= k1; ++k) {
+        if (ApproxPearson(query.coarseCentered, query.coarseSumSq, coarse, coarseStats, k) >= bar) {
+            refine(k * step - step + 1, k * step + step - 1);
+        }
+    }
+    refine((coarseLast + 1) * step, last);
+    if (runFirst >= 0) {
+        counters.full += static_cast<size_t>(runLast - runFirst) + 1;
+        ScoreLevelRolling(query, data, stats, runFirst, runLast, scale, shared, matches);
+    }
+}
+
+// GEMINI filter and refine. For z-normalized windows dist^2 = (1/m) sum over all m coefficients of
+// |X_f - Q_f|^2 (Parseval), and coefficients f and m - f are conjugates, so the first K (from 1;
+// coefficient 0 is zero) give dist^2 >= (2/m) sum |X_f - Q_f|^2, i.e. pearson <= 1 - sum / m^2.
+// The features' rounding (t per coefficient) takes at most t * sqrt(K) off the root of the sum.
+// Only windows whose bound can still reach the bar are rescored with CalculatePearson.
+void ScoreLevelDft(const PreparedQuery& query, const double* data, const float* features, int first, int last,
+                   int scale, const SharedThreshold& shared, MatchSet& matches, PruneCounters& counters) {
+    constexpr int K = CachedStock::kDftCoefficients;
+    const size_t m = query.zNorm.size();
+    const double mm = static_cast<double>(m) * static_cast<double>(m);
+    const double slack = DftFeatureTolerance(m) * std::sqrt(static_cast<double>(K));
+    const double* q = query.dft.data();
+
+    double floor = 0.0;
+    double ceiling = 0.0; // Feature distances above this cannot reach the floor
+    auto refresh = [&]() {
+        floor = std::max(shared.Get(), matches.Threshold()) - kRescoreMargin;
+        const double reach = std::sqrt(std::max(0.0, 1.0 - floor) * mm) + slack;
+        ceiling = reach * reach;
+    };
+    refresh();
+
+    for (int j = first; j <= last; ++j) {
+        if (((j - first) & 63) == 0) refresh();
+        ++counters.windows;
+
+        const float* x = features + 2 * K * static_cast<size_t>(j);
+        double bound = 0.0; // Flat window: Pearson 0
+        if (!std::isnan(x[0])) {
+            double sum = 0.0;
+            for (int k = 0; k < 2 * K; ++k) {
+                const double d = x[k] - q[k];
+                sum += d * d;
+            }
+            if (sum > ceiling) {
+                ++counters.lowerBound;
+                continue;
+            }
+            const double gap = std::max(0.0, std::sqrt(sum) - slack);
+            bound = 1.0 - gap * gap / mm;
+        } else if (bound < floor) {
+            ++counters.lowerBound;
+            continue;
+        }
+        if (!matches.Admits(bound + kRescoreMargin, j, scale)) continue;
+
+        ++counters.full;
+        double p = AnalysisEngine::CalculatePearson(query.pattern->data(), data + j, m);
+        matches.Offer(p, j, scale);
+        refresh();
+    }
+}
+
+// UCR-suite style scoring. For z-normalized windows of length m, dist^2 = 2m(1 - pearson),
+// so the best-so-far Pearson maps to a distance ceiling that windows are abandoned against.
+void ScoreLevelPruned(const PreparedQuery& query, const double* data, const LevelStats& stats, int first, int last,
+                      int scale, const SharedThreshold& shared, MatchSet& matches, PruneCounters& counters) {
+    const size_t m = query.zNorm.size();
+    const double twoM = 2.0 * static_cast<double>(m);
+    const double* qz = query.zNorm.data();
+    const size_t* order = query.order.data();
+
+    double floor = 0.0;
+    double ceiling = 0.0;
+    auto refresh = [&]() {
+        // Keep a margin so near-ties survive to the exact rescore
+        floor = std::max(shared.Get(), matches.Threshold()) - kRescoreMargin;
+        ceiling = twoM * (1.0 - floor);
+    };
+    refresh();
+
+    for (int j = first; j <= last; ++j) {
+        if (((j - first) & 63) == 0) refresh();
+        ++counters.windows;
+
+        double mean, ssx;
+        stats.Window(j, m, mean, ssx);
+        if (ssx == 0.0) {
+            // Flat window: Pearson 0
+            if (0.0 >= floor) matches.Offer(0.0, j, scale);
+            continue;
+        }
+        const double inv = 1.0 / std::sqrt(ssx / static_cast<double>(m));
+        const double* x = data + j;
+
+        // LB_Kim: first and last points
+        double a = (x[0] - mean) * inv - qz[0];
+        double b = (x[m - 1] - mean) * inv - qz[m - 1];
+        if (a * a + b * b > ceiling) {
+            ++counters.lowerBound;
+            continue;
+        }
+
+        // Early abandoning, largest query deviations first
+        double dist = 0.0;
+        size_t k = 0;
+        for (; k < m; ++k) {
+            size_t idx = order[k];
+            double z = (x[idx] - mean) * inv - qz[idx];
+            dist += z * z;
+            if (dist > ceiling) break;
+        }
+        if (k < m) {
+            ++counters.abandoned;
+            continue;
+        }
+
+        ++counters.full;
+        double approx = 1.0 - dist / twoM;
+        if (!matches.Admits(approx + kRescoreMargin, j, scale)) continue;
+
+        double p = AnalysisEngine::CalculatePearson(query.pattern->data(), x, m);
+        matches.Offer(p, j, scale);
+        refresh();
+    }
+}
+
+} // namespace
+
+int SearchLimit(const CachedStock& stock, int level, size_t patternSize, int lookahead) {
+    const size_t size = stock.LevelSize(level);
+    if (size < patternSize + lookahead) return -1;
+    return static_cast<int>(size) - lookahead - static_cast<int>(patternSize);
+}
+
+int SearchLimit(const PreparedQuery& prepared, const CachedStock& stock, int level, int lookahead) {
+    if (level >= prepared.levels) return -1;
+    return SearchLimit(stock, level, prepared.centered.size(), prepared.DataLookahead(lookahead));
+}
+
+void ScoreRange(const PreparedQuery& prepared, const CachedStock& stock, int level, int first, int last,
+                SearchMode mode, const SharedThreshold& threshold, MatchSet& matches, PruneCounters& counters) {
+    const SeriesView currentData = stock.Level(level);
+    const int currentScale = 1 << level;
+
+    switch (mode) {
+        case SearchMode::BruteForce:
+            ScoreLevelBruteForce(*prepared.pattern, currentData.data(), first, last, currentScale, matches);
+            break;
+        case SearchMode::Rolling:
+        case SearchMode::Indexed:      // Stocks the index does not cover
+        case SearchMode::IndexedExact:
+            ScoreLevelRolling(prepared, currentData.data(), stock.Stats(level), first, last, currentScale,
+                              threshold, matches);
+            break;
+        case SearchMode::Mass:
+            ScoreLevelMass(prepared, currentData.data(), stock.Stats(level), first, last, currentScale,
+                           threshold, matches);
+            break;
+        case SearchMode::Pruned:
+            ScoreLevelPruned(prepared, currentData.data(), stock.Stats(level), first, last, currentScale,
+                             threshold, matches, counters);
+            break;
+        case SearchMode::Hierarchical:
+            ScoreLevelHierarchical(prepared, stock, level, first, last, threshold, matches, counters);
+            break;
+        case SearchMode::Dft: {
+            const float* features = stock.LevelDft(level);
+            if (features && stock.dftWindow == prepared.centered.size()) {
+                ScoreLevelDft(prepared, currentData.data(), features, first, last, currentScale, threshold, matches,
+                              counters);
+            } else {
+                ScoreLevelRolling(prepared, currentData.data(), stock.Stats(level), first, last, currentScale,
+                                  threshold, matches);
+            }
+            break;
+        }
+        case SearchMode::Float32:
+            if (const float* data32 = stock.Level32(level)) {
+                ScoreLevelFloat32(prepared, currentData.data(), data32, stock.Stats(level), first, last, currentScale,
+                                  threshold, matches, counters);
+            } else {
+                ScoreLevelRolling(prepared, currentData.data(), stock.Stats(level), first, last, currentScale,
+                                  threshold, matches);
+            }
+            break;
+    }
+}
+
+void ScoreStock(const QueryVariants& variants, const CachedStock& stock, int lookahead, SearchMode mode,
+                const SharedThreshold& threshold, MatchSet& matches, PruneCounters& counters) {
+    for (int v = 0; v < static_cast<int>(variants.prepared.size()); ++v) {
+        const PreparedQuery& prepared = variants.prepared[v];
+        matches.SetVariant(v);
+
+        // Loop through the precomputed scales
+        // Condition: we need patternSize + lookahead points.
+        for (int level = 0; level < stock.LevelCount(); ++level) {
+            const int searchLimit = SearchLimit(prepared, stock, level, lookahead);
+            if (searchLimit < 0) break;
+
+            // Search at this scale
+            ScoreRange(prepared, stock, level, 0, searchLimit, mode, threshold, matches, counters);
+        }
+    }
+}
+
+double EstimateWindowCost(SearchMode mode, size_t patternSize) {
+    // Rough relative cost of scoring one window; only the ratios between chunks matter
+    const double m = static_cast<double>(patternSize);
+    switch (mode) {
+        case SearchMode::BruteForce: return 3.0 * m;  // Two full passes plus centering
+        case SearchMode::Rolling:    return m;        // One dot product
+        case SearchMode::Indexed:
+        case SearchMode::IndexedExact: return m;      // Scans of stocks the index does not cover
+        case SearchMode::Float32:    return 0.5 * m;  // One float dot product, twice the lanes
+        case SearchMode::Hierarchical: return 0.25 * m; // Coarse pass plus the refined regions
+        case SearchMode::Pruned:     return 0.25 * m; // Most windows abandon early
+        case SearchMode::Dft:        return 16.0 + 0.05 * m; // Feature distance, plus the few windows rescored
+        case SearchMode::Mass: {
+            double block = static_cast<double>(FftProcessor::NextPowerOfTwo(std::max<size_t>(4 * patternSize, 64)));
+            double perBlock = 2.0 * block * std::log2(block);                 // Forward + inverse
+            return perBlock / (2.0 * (block - m + 1.0)) + 8.0;                // Two blocks per transform
+        }
+    }
+    return m;
+}
+
+SearchResult MakeResult(const CachedStock& stock, const Match& match, const QueryVariants& variants) {
+    // "Invariant to Y stretching" Distance is simply derived from Pearson.
+    // Pearson = Cosine of Centered Vectors.
+    // Distance = acos(Pearson).
+    SearchResult res;
+    res.symbol = stock.Symbol();
+    res.offset = match.offset;
+    res.scale = match.scale;
+    res.pearson = match.pearson;
+    res.distance = std::acos(std::max(-1.0, std::min(1.0, match.pearson)));
+    res.stockId = stock.Id();
+    const double stretch = variants.prepared[match.variant].stretch;
+    res.resampled = stretch > 0.0;
+    res.timeScale = res.resampled ? stretch : static_cast<double>(match.scale);
+    return res;
+}
+
+double CalibrateCoarse(PreparedQuery& prepared, const std::vector<std::shared_ptr<const CachedStock>>& sample,
+                       int lookahead, double minPearson, double recallTarget, size_t& measured) {
+    const int step = 1 << prepared.coarseShift;
+    // Per stock: its exhaustive best, and the slack that match needs to be refined
+    std::vector<double> bests(sample.size(), -2.0);
+    std::vector<double> needs(sample.size(), 0.0);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < static_cast<int>(sample.size()); ++i) {
+        const CachedStock* stock = sample[i].get();
+        double& best = bests[i];
+        double& bestNeed = needs[i];
+        for (int level = 0; level < stock->LevelCount(); ++level) {
+            const int searchLimit = SearchLimit(prepared, *stock, level, lookahead);
+            if (searchLimit < 0) break;
+            const double* data = stock->Level(level).data();
+            const LevelStats stats = stock->Stats(level);
+
+            int bestOffset = 0;
+            double levelBest = -2.0;
+            for (int j = 0; j <= searchLimit; ++j) {
+                double p = ApproxPearson(prepared.centered, prepared.sumSq, data, stats, j);
+                if (p > levelBest) {
+                    levelBest = p;
+                    bestOffset = j;
+                }
+            }
+            if (levelBest <= best) continue;
+            best = levelBest;
+
+            // The coarse score it is refined by: the better of the two coarse offsets around it
+            const int coarseLast = CoarseLimit(prepared, *stock, level);
+            const int below = bestOffset / step;
+            const int above = (bestOffset + step - 1) / step;
+            if (coarseLast < 0 || below > coarseLast) {
+                bestNeed = 0.0; // Always refined
+                continue;
+            }
+            const double* coarse = stock->Level(level + prepared.coarseShift).data();
+            const LevelStats coarseStats = stock->Stats(level + prepared.coarseShift);
+            double near = ApproxPearson(prepared.coarseCentered, prepared.coarseSumSq, coarse, coarseStats, below);
+            if (above <= coarseLast) {
+                near = std::max(near, ApproxPearson(prepared.coarseCentered, prepared.coarseSumSq, coarse, coarseStats, above));
+            }
+            bestNeed = std::max(0.0, levelBest - near);
+        }
+    }
+
+    std::vector<double> needed;    // Qualifying best matches
+    std::vector<double> neededAny; // Every stock's best, in case none qualify
+    for (size_t i = 0; i < sample.size(); ++i) {
+        if (bests[i] < -1.0) continue;
+        neededAny.push_back(needs[i]);
+        if (bests[i] >= minPearson) needed.push_back(needs[i]);
+    }
+    if (needed.empty()) needed.swap(neededAny);
+    measured = needed.size();
+    if (needed.empty()) {
+        prepared.coarseShift = 0; // Nothing to learn from: search exhaustively
+        return 1.0;
+    }
+
+    std::sort(needed.begin(), needed.end());
+    double target = std::min(1.0, std::max(0.0, recallTarget));
+    size_t index = static_cast<size_t>(std::ceil(target * static_cast<double>(needed.size())));
+    index = std::min(needed.size() - 1, index > 0 ? index - 1 : 0);
+    prepared.coarseSlack = needed[index] + kRescoreMargin;
+    size_t kept = std::upper_bound(needed.begin(), needed.end(), needed[index]) - needed.begin();
+    return static_cast<double>(kept) / static_cast<double>(needed.size());
+}
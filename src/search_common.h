@@ -0,0 +1,183 @@
+#pragma once
+
+// Building blocks shared by the AnalysisEngine search paths (not part of the public API).
+
+#include "analysis_engine.h"
+#include "fft_processor.h"
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <vector>
+
+// Windows whose approximate score is this close to the bar they must clear are rescored
+// with CalculatePearson, so every fast mode picks the same offsets and reports the same
+// values as the brute-force path.
+constexpr double kRescoreMargin = 1e-6;
+
+// Rounding of the stored DFT features, in z-normalized units: float rounding of coefficients of
+// magnitude below m, with room for the double sliding DFT's own error (see AttachDft)
+inline double DftFeatureTolerance(size_t m) { return std::ldexp(static_cast<double>(m), -22); }
+
+// Query-side state shared by every stock of one search
+struct PreparedQuery {
+    const std::vector<double>* pattern = nullptr;
+    std::vector<double> centered; // pattern - mean(pattern)
+    double sumSq = 0.0;           // sum(centered^2)
+    std::unique_ptr<SlidingDotProduct> sliding;
+    std::vector<double> zNorm;    // z-normalized pattern (Pruned mode)
+    std::vector<size_t> order;    // Indices of zNorm by descending magnitude (Pruned mode)
+    std::vector<double> dft;      // The DFT features of zNorm, laid out as CachedStock::dftFeatures (Dft mode)
+    std::vector<float> centered32; // 'centered' rounded to float (Float32 mode)
+    double centeredSum32 = 0.0;    // sum(centered32), no longer exactly zero after rounding
+
+    // Hierarchical mode
+    int coarseShift = 0;                // Levels between a scored level and its coarse copy (0 = exhaustive)
+    std::vector<double> coarseCentered; // Pattern halved coarseShift times, centered
+    double coarseSumSq = 0.0;
+    double coarseSlack = 0.0;           // Coarse scores this far below the bar are still refined
+
+    // Resampled copies (SearchOptions::scaleFactors) are matched on level 0 only
+    int levels = std::numeric_limits<int>::max(); // Pyramid levels searched
+    double stretch = 0.0;                          // Data points per original query point (0 = not resampled)
+
+    // Points 'lookahead' query points span in the data this pattern is matched against
+    int DataLookahead(int lookahead) const {
+        return stretch > 0.0 ? static_cast<int>(std::ceil(lookahead * stretch - 1e-9)) : lookahead;
+    }
+};
+
+// Returns false when the query cannot produce any match (too short or flat)
+bool PrepareQuery(const std::vector<double>& pattern, SearchMode mode, PreparedQuery& prepared);
+
+// Every pattern one search scores: the query itself over the pyramid, or one resampled copy
+// per distinct length the scale factors give. A match's 'variant' indexes 'prepared'.
+struct QueryVariants {
+    std::vector<std::vector<double>> patterns; // Resampled copies; prepared[i].pattern points here
+    std::vector<PreparedQuery> prepared;
+    size_t querySize = 0;
+};
+
+// Linear interpolation of 'pattern' onto 'length' points with the same first and last value
+std::vector<double> ResampleQuery(const std::vector<double>& pattern, size_t length);
+
+// Returns false when no variant can produce a match
+bool PrepareVariants(const std::vector<double>& query, const SearchOptions& options, QueryVariants& variants);
+
+// Hierarchical mode: builds the coarse query, at most 'coarseLevels' halvings down while it
+// keeps kMinLevelSize points and some variance
+void PrepareCoarse(PreparedQuery& prepared, int coarseLevels);
+
+// Hierarchical mode: sets prepared.coarseSlack to the smallest slack that keeps 'recallTarget'
+// of the per-stock best matches (exhaustive, at least minPearson if any are) in 'sample'.
+// Returns the share of those matches the slack keeps, and their count in 'measured'.
+double CalibrateCoarse(PreparedQuery& prepared, const std::vector<std::shared_ptr<const CachedStock>>& sample,
+                       int lookahead, double minPearson, double recallTarget, size_t& measured);
+
+struct PruneCounters {
+    size_t windows = 0;
+    size_t lowerBound = 0; // Rejected by LB_Kim (Dft: by the feature distance)
+    size_t abandoned = 0;  // Rejected part way through the distance
+    size_t full = 0;       // Evaluated to the end (Float32: rescored in double, Hierarchical: refined)
+
+    void Add(const PruneCounters& other);
+};
+
+struct Match {
+    double pearson;
+    int offset; // In level coordinates
+    int scale;
+    int variant; // QueryVariants index of the pattern that matched
+};
+
+// The best N matches of one stock whose starts (in level-0 points) are at least
+// 'exclusionZone' apart, picked greedily by score from every window offered: the best one, then
+// the best one clear of it, and so on. That selection does not depend on the order windows
+// (or a stock's chunks) come in. With N == 1 this is simply the best window.
+//
+// Windows that can no longer be picked are dropped as it goes. A window can overlap at most
+// two windows that are clear of each other, so once 2N mutually clear windows beat it, at
+// least N picks beat it whatever is offered later.
+class MatchSet {
+public:
+    MatchSet(int capacity, int exclusionZone);
+
+    // Bar a new match has to beat: the best window with N (2N) better ones ahead of it
+    double Threshold() const;
+    // Whether a match with this score could still be picked
+    bool Admits(double pearson, int offset, int scale) const;
+    void Offer(double pearson, int offset, int scale);
+    void Offer(const Match& match); // Keeps the match's own variant
+    // Offers every window 'other' still holds (windows both hold count once)
+    void Merge(const MatchSet& other);
+    // Variant new matches are tagged with; ties between variants go to the lower index
+    void SetVariant(int variant) { m_Variant = variant; }
+
+    // The picks, best first
+    std::vector<Match> Matches() const;
+    void Clear();
+
+private:
+    bool Conflicts(const Match& m, const Match& candidate) const;
+    bool Admits(const Match& candidate) const;
+    // Sorts the windows best first, drops the ones that can no longer be picked and raises the bar
+    void Compact();
+    // Greedy picks from 'sorted' (best first), at most 'limit' of them; returns the index of the last
+    size_t Pick(const std::vector<Match>& sorted, size_t limit, std::vector<Match>& picks) const;
+
+    int m_Capacity;
+    int m_ExclusionZone;
+    int m_Variant = 0;
+    std::vector<Match> m_Candidates; // Everything that can still be picked (N == 1: the best)
+    size_t m_CompactAt;              // Candidate count that triggers the next Compact
+    bool m_HasBar = false;
+    Match m_Bar{};
+};
+
+// Bounded min-heap of the K best results seen by one thread
+class TopKHeap {
+public:
+    explicit TopKHeap(int capacity = 0) : m_Capacity(capacity) {}
+
+    bool Push(const SearchResult& result); // False if it did not make the cut
+    double Kth() const;                    // Weakest kept Pearson once full, else -inf
+    std::vector<SearchResult>& Items() { return m_Items; }
+
+private:
+    int m_Capacity;
+    std::vector<SearchResult> m_Items;
+};
+
+// Merges per-thread heaps into one Top K list, best first
+std::vector<SearchResult> MergeTopK(std::vector<TopKHeap>& heaps, int topK);
+
+// Best-so-far Pearson shared by all threads: the larger of the cutoff and the K-th best
+// result any single thread holds. Windows below it cannot reach the final Top K.
+class SharedThreshold {
+public:
+    explicit SharedThreshold(double floor) : m_Value(floor) {}
+
+    double Get() const { return m_Value.load(std::memory_order_relaxed); }
+    void Publish(double kth); // Raises the threshold, never lowers it
+
+private:
+    std::atomic<double> m_Value;
+};
+
+// Last valid window offset at 'level' for this query, or -1 if the level is too short
+int SearchLimit(const CachedStock& stock, int level, size_t patternSize, int lookahead);
+// Same for one prepared pattern, or -1 past the levels it searches
+int SearchLimit(const PreparedQuery& prepared, const CachedStock& stock, int level, int lookahead);
+
+// Scores windows starting at [first, last] of one level into 'matches'
+void ScoreRange(const PreparedQuery& prepared, const CachedStock& stock, int level, int first, int last,
+                SearchMode mode, const SharedThreshold& threshold, MatchSet& matches, PruneCounters& counters);
+
+// Relative cost of scoring one window, used to size scheduler chunks
+double EstimateWindowCost(SearchMode mode, size_t patternSize);
+
+// Scores every variant at every level it searches of 'stock' into 'matches'
+void ScoreStock(const QueryVariants& variants, const CachedStock& stock, int lookahead, SearchMode mode,
+                const SharedThreshold& threshold, MatchSet& matches, PruneCounters& counters);
+
+SearchResult MakeResult(const CachedStock& stock, const Match& match, const QueryVariants& variants);
@@ -0,0 +1,466 @@
+#include "simd_kernels.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define REL2_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC accepts any intrinsic without flags; GCC/Clang need per-function targets
+#if defined(REL2_X86) && (defined(__GNUC__) || defined(__clang__))
+#define REL2_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define REL2_TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define REL2_TARGET_AVX2
+#define REL2_TARGET_AVX512
+#endif
+
+namespace {
+
+// --- Scalar reference ---
+
+double DotScalar(const double* a, const double* b, size_t size) {
+    double dot = 0.0;
+    for (size_t i = 0; i < size; ++i) dot += a[i] * b[i];
+    return dot;
+}
+
+void SumsScalar(const double* a, const double* b, size_t size, double& sumA, double& sumB) {
+    double sa = 0.0, sb = 0.0;
+    for (size_t i = 0; i < size; ++i) {
+        sa += a[i];
+        sb += b[i];
+    }
+    sumA = sa;
+    sumB = sb;
+}
+
+void CenteredSumsScalar(const double* a, const double* b, size_t size, double meanA, double meanB,
+                        double& cross, double& sumSqA, double& sumSqB) {
+    double num = 0.0, sa = 0.0, sb = 0.0;
+    for (size_t i = 0; i < size; ++i) {
+        double da = a[i] - meanA;
+        double db = b[i] - meanB;
+        num += da * db;
+        sa += da * da;
+        sb += db * db;
+    }
+    cross = num;
+    sumSqA = sa;
+    sumSqB = sb;
+}
+
+void DotAndNormsScalar(const double* a, const double* b, size_t size, double& dot, double& normSqA, double& normSqB) {
+    double d = 0.0, na = 0.0, nb = 0.0;
+    for (size_t i = 0; i < size; ++i) {
+        d += a[i] * b[i];
+        na += a[i] * a[i];
+        nb += b[i] * b[i];
+    }
+    dot = d;
+    normSqA = na;
+    normSqB = nb;
+}
+
+double DotF32Scalar(const float* a, const float* b, size_t size) {
+    double dot = 0.0;
+    for (size_t i = 0; i < size; ++i) dot += static_cast<double>(a[i]) * b[i];
+    return dot;
+}
+
+void ExpMinusOneScaledScalar(double* x, size_t size, double scale) {
+    for (size_t i = 0; i < size; ++i) x[i] = scale * (std::exp(x[i]) - 1.0);
+}
+
+#ifdef REL2_X86
+
+// --- AVX2 + FMA ---
+
+REL2_TARGET_AVX2 inline double HorizontalSum(__m256d v) {
+    __m128d lo = _mm256_castpd256_pd128(v);
+    __m128d hi = _mm256_extractf128_pd(v, 1);
+    lo = _mm_add_pd(lo, hi);
+    __m128d swapped = _mm_unpackhi_pd(lo, lo);
+    return _mm_cvtsd_f64(_mm_add_sd(lo, swapped));
+}
+
+REL2_TARGET_AVX2 double DotAvx2(const double* a, const double* b, size_t size) {
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), acc0);
+        acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4), acc1);
+    }
+    for (; i + 4 <= size; i += 4) {
+        acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), acc0);
+    }
+    double dot = HorizontalSum(_mm256_add_pd(acc0, acc1));
+    for (; i < size; ++i) dot += a[i] * b[i];
+    return dot;
+}
+
+REL2_TARGET_AVX2 inline float HorizontalSum(__m256 v) {
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    lo = _mm_add_ps(lo, hi);
+    lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    return _mm_cvtss_f32(_mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 1)));
+}
+
+REL2_TARGET_AVX2 double DotF32Avx2(const float* a, const float* b, size_t size) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    for (; i + 8 <= size; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    float dot = HorizontalSum(_mm256_add_ps(acc0, acc1));
+    for (; i < size; ++i) dot += a[i] * b[i];
+    return dot;
+}
+
+REL2_TARGET_AVX2 void SumsAvx2(const double* a, const double* b, size_t size, double& sumA, double& sumB) {
+    __m256d accA = _mm256_setzero_pd();
+    __m256d accB = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        accA = _mm256_add_pd(accA, _mm256_loadu_pd(a + i));
+        accB = _mm256_add_pd(accB, _mm256_loadu_pd(b + i));
+    }
+    double sa = HorizontalSum(accA);
+    double sb = HorizontalSum(accB);
+    for (; i < size; ++i) {
+        sa += a[i];
+        sb += b[i];
+    }
+    sumA = sa;
+    sumB = sb;
+}
+
+REL2_TARGET_AVX2 void CenteredSumsAvx2(const double* a, const double* b, size_t size, double meanA, double meanB,
+                                       double& cross, double& sumSqA, double& sumSqB) {
+    const __m256d ma = _mm256_set1_pd(meanA);
+    const __m256d mb = _mm256_set1_pd(meanB);
+    __m256d accNum = _mm256_setzero_pd();
+    __m256d accA = _mm256_setzero_pd();
+    __m256d accB = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        __m256d da = _mm256_sub_pd(_mm256_loadu_pd(a + i), ma);
+        __m256d db = _mm256_sub_pd(_mm256_loadu_pd(b + i), mb);
+        accNum = _mm256_fmadd_pd(da, db, accNum);
+        accA = _mm256_fmadd_pd(da, da, accA);
+        accB = _mm256_fmadd_pd(db, db, accB);
+    }
+    double num = HorizontalSum(accNum);
+    double sa = HorizontalSum(accA);
+    double sb = HorizontalSum(accB);
+    for (; i < size; ++i) {
+        double da = a[i] - meanA;
+        double db = b[i] - meanB;
+        num += da * db;
+        sa += da * da;
+        sb += db * db;
+    }
+    cross = num;
+    sumSqA = sa;
+    sumSqB = sb;
+}
+
+REL2_TARGET_AVX2 void DotAndNormsAvx2(const double* a, const double* b, size_t size,
+                                      double& dot, double& normSqA, double& normSqB) {
+    __m256d accDot = _mm256_setzero_pd();
+    __m256d accA = _mm256_setzero_pd();
+    __m256d accB = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        __m256d va = _mm256_loadu_pd(a + i);
+        __m256d vb = _mm256_loadu_pd(b + i);
+        accDot = _mm256_fmadd_pd(va, vb, accDot);
+        accA = _mm256_fmadd_pd(va, va, accA);
+        accB = _mm256_fmadd_pd(vb, vb, accB);
+    }
+    double d = HorizontalSum(accDot);
+    double na = HorizontalSum(accA);
+    double nb = HorizontalSum(accB);
+    for (; i < size; ++i) {
+        d += a[i] * b[i];
+        na += a[i] * a[i];
+        nb += b[i] * b[i];
+    }
+    dot = d;
+    normSqA = na;
+    normSqB = nb;
+}
+
+// exp(x) = 2^k * exp(r) with r = x - k*ln2 in [-ln2/2, ln2/2]; a degree-13 Taylor
+// polynomial is below half an ulp there. Valid while 2^k is a normal double (|x| < ~708).
+REL2_TARGET_AVX2 inline __m256d ExpAvx2(__m256d x) {
+    const __m256d log2e = _mm256_set1_pd(1.4426950408889634074);
+    const __m256d ln2Hi = _mm256_set1_pd(6.93147180369123816490e-01);
+    const __m256d ln2Lo = _mm256_set1_pd(1.90821492927058770002e-10);
+    static const double kInvFactorial[] = {
+        1.0 / 6227020800.0, 1.0 / 479001600.0, 1.0 / 39916800.0, 1.0 / 3628800.0, 1.0 / 362880.0,
+        1.0 / 40320.0, 1.0 / 5040.0, 1.0 / 720.0, 1.0 / 120.0, 1.0 / 24.0, 1.0 / 6.0, 0.5, 1.0, 1.0
+    };
+
+    __m256d k = _mm256_round_pd(_mm256_mul_pd(x, log2e), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256d r = _mm256_fnmadd_pd(k, ln2Hi, x);
+    r = _mm256_fnmadd_pd(k, ln2Lo, r);
+
+    __m256d p = _mm256_set1_pd(kInvFactorial[0]);
+    for (int i = 1; i < 14; ++i) p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(kInvFactorial[i]));
+
+    __m256i exponent = _mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(k));
+    exponent = _mm256_slli_epi64(_mm256_add_epi64(exponent, _mm256_set1_epi64x(1023)), 52);
+    return _mm256_mul_pd(p, _mm256_castsi256_pd(exponent));
+}
+
+// Four values at x. Lanes outside the polynomial's range go through std::exp one by one,
+// so every value gets the same result wherever it sits in the array.
+REL2_TARGET_AVX2 inline void ExpMinusOneScaledQuad(double* x, double scale) {
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d limit = _mm256_set1_pd(700.0);
+    const __m256d absMask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7FFFFFFFFFFFFFFFLL));
+    __m256d v = _mm256_loadu_pd(x);
+    int far = _mm256_movemask_pd(_mm256_cmp_pd(_mm256_and_pd(v, absMask), limit, _CMP_GT_OQ));
+    double in[4];
+    if (far) _mm256_storeu_pd(in, v);
+    _mm256_storeu_pd(x, _mm256_mul_pd(_mm256_set1_pd(scale), _mm256_sub_pd(ExpAvx2(v), one)));
+    for (int lane = 0; far && lane < 4; ++lane) {
+        if (far & (1 << lane)) x[lane] = scale * (std::exp(in[lane]) - 1.0);
+    }
+}
+
+REL2_TARGET_AVX2 void ExpMinusOneScaledAvx2(double* x, size_t size, double scale) {
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) ExpMinusOneScaledQuad(x + i, scale);
+    if (i < size) {
+        // Pad the tail to a full vector rather than switching to std::exp, so a value decodes
+        // the same in a full series and in any sub-range of it
+        double tail[4] = { 0.0, 0.0, 0.0, 0.0 };
+        std::copy(x + i, x + size, tail);
+        ExpMinusOneScaledQuad(tail, scale);
+        std::copy(tail, tail + (size - i), x + i);
+    }
+}
+
+// --- AVX-512F (masked tails, no scalar remainder) ---
+
+REL2_TARGET_AVX512 double DotAvx512(const double* a, const double* b, size_t size) {
+    __m512d acc0 = _mm512_setzero_pd();
+    __m512d acc1 = _mm512_setzero_pd();
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        acc0 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i), acc0);
+        acc1 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i + 8), _mm512_loadu_pd(b + i + 8), acc1);
+    }
+    for (; i < size; i += 8) {
+        __mmask8 mask = (size - i >= 8) ? static_cast<__mmask8>(0xFF) : static_cast<__mmask8>((1u << (size - i)) - 1);
+        acc0 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(mask, a + i), _mm512_maskz_loadu_pd(mask, b + i), acc0);
+    }
+    return _mm512_reduce_add_pd(_mm512_add_pd(acc0, acc1));
+}
+
+REL2_TARGET_AVX512 double DotF32Avx512(const float* a, const float* b, size_t size) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+    for (; i < size; i += 16) {
+        __mmask16 mask = (size - i >= 16) ? static_cast<__mmask16>(0xFFFF) : static_cast<__mmask16>((1u << (size - i)) - 1);
+        acc0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i), acc0);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+REL2_TARGET_AVX512 void SumsAvx512(const double* a, const double* b, size_t size, double& sumA, double& sumB) {
+    __m512d accA = _mm512_setzero_pd();
+    __m512d accB = _mm512_setzero_pd();
+    for (size_t i = 0; i < size; i += 8) {
+        __mmask8 mask = (size - i >= 8) ? static_cast<__mmask8>(0xFF) : static_cast<__mmask8>((1u << (size - i)) - 1);
+        accA = _mm512_add_pd(accA, _mm512_maskz_loadu_pd(mask, a + i));
+        accB = _mm512_add_pd(accB, _mm512_maskz_loadu_pd(mask, b + i));
+    }
+    sumA = _mm512_reduce_add_pd(accA);
+    sumB = _mm512_reduce_add_pd(accB);
+}
+
+REL2_TARGET_AVX512 void CenteredSumsAvx512(const double* a, const double* b, size_t size, double meanA, double meanB,
+                                           double& cross, double& sumSqA, double& sumSqB) {
+    const __m512d ma = _mm512_set1_pd(meanA);
+    const __m512d mb = _mm512_set1_pd(meanB);
+    __m512d accNum = _mm512_setzero_pd();
+    __m512d accA = _mm512_setzero_pd();
+    __m512d accB = _mm512_setzero_pd();
+    for (size_t i = 0; i < size; i += 8) {
+        __mmask8 mask = (size - i >= 8) ? static_cast<__mmask8>(0xFF) : static_cast<__mmask8>((1u << (size - i)) - 1);
+        // Masked-off lanes stay exactly zero after centering
+        __m512d da = _mm512_maskz_sub_pd(mask, _mm512_maskz_loadu_pd(mask, a + i), ma);
+        __m512d db = _mm512_maskz_sub_pd(mask, _mm512_maskz_loadu_pd(mask, b + i), mb);
+        accNum = _mm512_fmadd_pd(da, db, accNum);
+        accA = _mm512_fmadd_pd(da, da, accA);
+        accB = _mm512_fmadd_pd(db, db, accB);
+    }
+    cross = _mm512_reduce_add_pd(accNum);
+    sumSqA = _mm512_reduce_add_pd(accA);
+    sumSqB = _mm512_reduce_add_pd(accB);
+}
+
+REL2_TARGET_AVX512 void DotAndNormsAvx512(const double* a, const double* b, size_t size,
+                                          double& dot, double& normSqA, double& normSqB) {
+    __m512d accDot = _mm512_setzero_pd();
+    __m512d accA = _mm512_setzero_pd();
+    __m512d accB = _mm512_setzero_pd();
+    for (size_t i = 0; i < size; i += 8) {
+        __mmask8 mask = (size - i >= 8) ? static_cast<__mmask8>(0xFF) : static_cast<__mmask8>((1u << (size - i)) - 1);
+        __m512d va = _mm512_maskz_loadu_pd(mask, a + i);
+        __m512d vb = _mm512_maskz_loadu_pd(mask, b + i);
+        accDot = _mm512_fmadd_pd(va, vb, accDot);
+        accA = _mm512_fmadd_pd(va, va, accA);
+        accB = _mm512_fmadd_pd(vb, vb, accB);
+    }
+    dot = _mm512_reduce_add_pd(accDot);
+    normSqA = _mm512_reduce_add_pd(accA);
+    normSqB = _mm512_reduce_add_pd(accB);
+}
+
+#if defined(_MSC_VER)
+bool CpuHas(int leaf, int sub, int reg, int bit) {
+    int info[4];
+    __cpuidex(info, leaf, sub);
+    return (info[reg] >> bit) & 1;
+}
+#endif
+
+#endif // REL2_X86
+
+SimdIsa DetectIsa() {
+#if defined(REL2_X86) && defined(_MSC_VER)
+    // OSXSAVE + OS-enabled YMM (and ZMM/opmask for AVX-512)
+    if (!CpuHas(1, 0, 2, 27)) return SimdIsa::Scalar;
+    unsigned long long xcr0 = _xgetbv(0);
+    bool ymm = (xcr0 & 0x6) == 0x6;
+    bool zmm = (xcr0 & 0xE6) == 0xE6;
+    bool avx2 = ymm && CpuHas(7, 0, 1, 5) && CpuHas(1, 0, 2, 12);
+    bool avx512 = zmm && CpuHas(7, 0, 1, 16);
+    if (avx512) return SimdIsa::Avx512;
+    if (avx2) return SimdIsa::Avx2;
+    return SimdIsa::Scalar;
+#elif defined(REL2_X86) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return SimdIsa::Avx512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return SimdIsa::Avx2;
+    return SimdIsa::Scalar;
+#else
+    return SimdIsa::Scalar;
+#endif
+}
+
+struct KernelTable {
+    double (*dot)(const double*, const double*, size_t);
+    void (*sums)(const double*, const double*, size_t, double&, double&);
+    void (*centeredSums)(const double*, const double*, size_t, double, double, double&, double&, double&);
+    void (*dotAndNorms)(const double*, const double*, size_t, double&, double&, double&);
+    void (*expMinusOneScaled)(double*, size_t, double);
+    double (*dotF32)(const float*, const float*, size_t);
+};
+
+const KernelTable kScalarTable = { DotScalar, SumsScalar, CenteredSumsScalar, DotAndNormsScalar, ExpMinusOneScaledScalar,
+                                   DotF32Scalar };
+#ifdef REL2_X86
+const KernelTable kAvx2Table = { DotAvx2, SumsAvx2, CenteredSumsAvx2, DotAndNormsAvx2, ExpMinusOneScaledAvx2,
+                                 DotF32Avx2 };
+// AVX-512F parts all have AVX2, and the exp pass is bound by the decoder in front of it
+const KernelTable kAvx512Table = { DotAvx512, SumsAvx512, CenteredSumsAvx512, DotAndNormsAvx512, ExpMinusOneScaledAvx2,
+                                   DotF32Avx512 };
+#endif
+
+const KernelTable* TableFor(SimdIsa isa) {
+#ifdef REL2_X86
+    if (isa == SimdIsa::Avx512) return &kAvx512Table;
+    if (isa == SimdIsa::Avx2) return &kAvx2Table;
+#endif
+    (void)isa;
+    return &kScalarTable;
+}
+
+struct Dispatch {
+    std::atomic<const KernelTable*> table;
+    std::atomic<SimdIsa> isa;
+    Dispatch() {
+        SimdIsa best = DetectIsa();
+        isa.store(best);
+        table.store(TableFor(best));
+    }
+};
+
+Dispatch& GetDispatch() {
+    static Dispatch dispatch;
+    return dispatch;
+}
+
+} // namespace
+
+double SimdKernels::Dot(const double* a, const double* b, size_t size) {
+    return GetDispatch().table.load(std::memory_order_relaxed)->dot(a, b, size);
+}
+
+void SimdKernels::Sums(const double* a, const double* b, size_t size, double& sumA, double& sumB) {
+    GetDispatch().table.load(std::memory_order_relaxed)->sums(a, b, size, sumA, sumB);
+}
+
+void SimdKernels::CenteredSums(const double* a, const double* b, size_t size, double meanA, double meanB,
+                               double& cross, double& sumSqA, double& sumSqB) {
+    GetDispatch().table.load(std::memory_order_relaxed)->centeredSums(a, b, size, meanA, meanB, cross, sumSqA, sumSqB);
+}
+
+void SimdKernels::DotAndNorms(const double* a, const double* b, size_t size,
+                              double& dot, double& normSqA, double& normSqB) {
+    GetDispatch().table.load(std::memory_order_relaxed)->dotAndNorms(a, b, size, dot, normSqA, normSqB);
+}
+
+double SimdKernels::DotF32(const float* a, const float* b, size_t size) {
+    return GetDispatch().table.load(std::memory_order_relaxed)->dotF32(a, b, size);
+}
+
+void SimdKernels::ExpMinusOneScaled(double* x, size_t size, double scale) {
+    GetDispatch().table.load(std::memory_order_relaxed)->expMinusOneScaled(x, size, scale);
+}
+
+SimdIsa SimdKernels::Detect() {
+    static const SimdIsa best = DetectIsa();
+    return best;
+}
+
+SimdIsa SimdKernels::Active() {
+    return GetDispatch().isa.load();
+}
+
+void SimdKernels::SetActive(SimdIsa isa) {
+    if (static_cast<int>(isa) > static_cast<int>(Detect())) isa = Detect();
+    Dispatch& d = GetDispatch();
+    d.isa.store(isa);
+    d.table.store(TableFor(isa));
+}
+
+const char* SimdKernels::Name(SimdIsa isa) {
+    switch (isa) {
+        case SimdIsa::Avx512: return "AVX-512";
+        case SimdIsa::Avx2: return "AVX2";
+        default: return "Scalar";
+    }
+}
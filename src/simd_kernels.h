@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+
+enum class SimdIsa {
+    Scalar,
+    Avx2,   // AVX2 + FMA
+    Avx512  // AVX-512F
+};
+
+// Vectorized reductions behind AnalysisEngine's math kernels.
+// The best ISA the CPU and OS support is picked on first use; the scalar
+// versions stay available as the reference.
+class SimdKernels {
+public:
+    // sum(a[i] * b[i])
+    static double Dot(const double* a, const double* b, size_t size);
+    // sum(a[i]), sum(b[i])
+    static void Sums(const double* a, const double* b, size_t size, double& sumA, double& sumB);
+    // sum((a-ma)(b-mb)), sum((a-ma)^2), sum((b-mb)^2)
+    static void CenteredSums(const double* a, const double* b, size_t size, double meanA, double meanB,
+                             double& cross, double& sumSqA, double& sumSqB);
+    // sum(a*b), sum(a^2), sum(b^2)
+    static void DotAndNorms(const double* a, const double* b, size_t size,
+                            double& dot, double& normSqA, double& normSqB);
+    // sum(a[i] * b[i]) over float inputs. The vector paths accumulate in float (twice the lanes
+    // of Dot); the error stays within (size + 2) * 2^-24 * sum(|a[i] * b[i]|).
+    static double DotF32(const float* a, const float* b, size_t size);
+    // x[i] = scale * (exp(x[i]) - 1), in place. The vector exp stays within about an ulp of
+    // std::exp (before the subtraction), so decoded series can differ from the scalar path in the last bits.
+    // Each result depends only on x[i] and scale, not on its position or the array length.
+    static void ExpMinusOneScaled(double* x, size_t size, double scale);
+
+    static SimdIsa Detect();     // Best ISA available on this machine
+    static SimdIsa Active();     // ISA currently dispatched to
+    static void SetActive(SimdIsa isa); // Clamped to Detect(); lets callers compare against Scalar
+    static const char* Name(SimdIsa isa);
+};
@@ -0,0 +1,116 @@
+#include "stock_cache.h"
+
+StockCache::StockCache(size_t stockCount, size_t budgetBytes, Loader loader)
+    : m_Loader(std::move(loader)), m_Budget(budgetBytes), m_Slots(stockCount) {
+    m_Prefetcher = std::thread(&StockCache::PrefetchLoop, this);
+}
+
+StockCache::~StockCache() {
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Stop = true;
+    }
+    m_Work.notify_all();
+    if (m_Prefetcher.joinable()) m_Prefetcher.join();
+}
+
+size_t StockCache::Footprint(const CachedStock& stock) {
+    return (stock.pyramid.size() + 2 * stock.StatsSize() + stock.levelShift.size()) * sizeof(double) +
+           (stock.pyramid32 ? stock.pyramid.size() * sizeof(float) : 0) +
+           (stock.dftFeatures ? 2 * CachedStock::kDftCoefficients * stock.pyramid.size() * sizeof(float) : 0) +
+           stock.levelOffsets.size() * sizeof(size_t) + sizeof(CachedStock);
+}
+
+std::shared_ptr<const CachedStock> StockCache::Pin(size_t index) {
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    Slot& slot = m_Slots[index];
+    while (slot.loading) m_LoadDone.wait(lock);
+
+    if (slot.data) {
+        ++m_Stats.hits;
+        m_Lru.splice(m_Lru.begin(), m_Lru, slot.lru);
+        return slot.data;
+    }
+    if (slot.failed) return nullptr;
+
+    // Decode outside the lock; anyone else asking for this stock waits on m_LoadDone
+    ++m_Stats.misses;
+    slot.loading = true;
+    lock.unlock();
+    std::shared_ptr<const CachedStock> data = Load(index);
+    lock.lock();
+
+    slot.loading = false;
+    if (data) Insert(index, data);
+    else slot.failed = true;
+    m_LoadDone.notify_all();
+    return data;
+}
+
+void StockCache::Prefetch(size_t index) {
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        Slot& slot = m_Slots[index];
+        if (slot.data || slot.loading || slot.queued || slot.failed) return;
+        if (m_Queue.size() >= kMaxQueued) return;
+        slot.queued = true;
+        m_Queue.push_back(index);
+    }
+    m_Work.notify_one();
+}
+
+StockCache::Stats StockCache::GetStats() const {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Stats;
+}
+
+std::shared_ptr<const CachedStock> StockCache::Load(size_t index) {
+    try {
+        return m_Loader(index);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void StockCache::Insert(size_t index, std::shared_ptr<const CachedStock> data) {
+    Slot& slot = m_Slots[index];
+    slot.bytes = Footprint(*data);
+    slot.data = std::move(data);
+    m_Lru.push_front(index);
+    slot.lru = m_Lru.begin();
+    m_Stats.residentBytes += slot.bytes;
+
+    // Least recently used first; the stock just inserted always stays
+    while (m_Stats.residentBytes > m_Budget && m_Lru.size() > 1) {
+        Slot& victim = m_Slots[m_Lru.back()];
+        m_Lru.pop_back();
+        m_Stats.residentBytes -= victim.bytes;
+        victim.bytes = 0;
+        victim.data.reset();
+        ++m_Stats.evictions;
+    }
+}
+
+void StockCache::PrefetchLoop() {
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    for (;;) {
+        m_Work.wait(lock, [this]() { return m_Stop || !m_Queue.empty(); });
+        if (m_Stop) return;
+
+        size_t index = m_Queue.front();
+        m_Queue.pop_front();
+        Slot& slot = m_Slots[index];
+        slot.queued = false;
+        if (slot.data || slot.loading || slot.failed) continue;
+
+        slot.loading = true;
+        lock.unlock();
+        std::shared_ptr<const CachedStock> data = Load(index);
+        lock.lock();
+
+        slot.loading = false;
+        if (data) Insert(index, data);
+        else slot.failed = true;
+        m_LoadDone.notify_all();
+    }
+}
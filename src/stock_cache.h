@@ -0,0 +1,72 @@
+#pragma once
+
+#include "analysis_engine.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// LRU cache of decoded stocks for the lazy library mode. Stocks are identified by their
+// index in the engine's header list and decoded by 'loader' on first use. Resident data is
+// kept under a byte budget; callers hold shared_ptr pins, so evicting a stock that is still
+// being searched (or shown) only drops the cache's reference.
+class StockCache {
+public:
+    using Loader = std::function<std::shared_ptr<const CachedStock>(size_t index)>;
+
+    struct Stats {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evictions = 0;
+        size_t residentBytes = 0;
+    };
+
+    StockCache(size_t stockCount, size_t budgetBytes, Loader loader);
+    ~StockCache();
+    StockCache(const StockCache&) = delete;
+    StockCache& operator=(const StockCache&) = delete;
+
+    // Decoded stock, loading it on a miss (or waiting if another thread already is).
+    // nullptr if the file could not be decoded.
+    std::shared_ptr<const CachedStock> Pin(size_t index);
+
+    // Queues a background decode so a later Pin hits. Cheap no-op if resident or queued.
+    void Prefetch(size_t index);
+
+    Stats GetStats() const;
+
+    // Bytes a decoded stock accounts for against the budget
+    static size_t Footprint(const CachedStock& stock);
+
+private:
+    struct Slot {
+        std::shared_ptr<const CachedStock> data;
+        std::list<size_t>::iterator lru;
+        size_t bytes = 0;
+        bool loading = false;
+        bool queued = false;
+        bool failed = false;
+    };
+
+    std::shared_ptr<const CachedStock> Load(size_t index); // Runs the loader, nullptr on any failure
+    void Insert(size_t index, std::shared_ptr<const CachedStock> data); // Caller holds m_Mutex
+    void PrefetchLoop();
+
+    static constexpr size_t kMaxQueued = 64;
+
+    Loader m_Loader;
+    size_t m_Budget;
+    mutable std::mutex m_Mutex;
+    std::condition_variable m_LoadDone;
+    std::condition_variable m_Work;
+    std::vector<Slot> m_Slots;
+    std::list<size_t> m_Lru; // Most recently used first
+    std::deque<size_t> m_Queue;
+    Stats m_Stats;
+    bool m_Stop = false;
+    std::thread m_Prefetcher;
+};
@@ -0,0 +1,223 @@
+#include "streaming_search.h"
+#include "search_common.h"
+#include "simd_kernels.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <omp.h>
+
+StreamingSearch::StreamingSearch(AnalysisEngine& engine) : m_Engine(engine) {}
+
+std::vector<SearchResult> StreamingSearch::Start(const std::vector<double>& query, bool useFred, int topK,
+                                                 int lookahead, const SearchOptions& options) {
+    m_Library = m_Engine.GetLibrary();
+    m_Query = query;
+    m_UseFred = useFred;
+    m_TopK = topK;
+    m_Lookahead = lookahead;
+    m_Options = options;
+    m_Options.scaleFactors.clear();
+    m_Options.mode = SearchMode::Rolling; // The query is scored as Rolling does, no FFT plan or zNorm
+    m_Stocks.clear();
+    if (!m_Library || query.size() < AnalysisEngine::kMinLevelSize) {
+        m_Query.clear();
+        return {};
+    }
+    // Prepared once: Run recenters it in place as the query slides (and catches a flat query)
+    m_Variants = QueryVariants();
+    PrepareVariants(m_Query, m_Options, m_Variants);
+    Plan();
+    return Run(Pass::Resync, 0.0, 0.0);
+}
+
+std::vector<SearchResult> StreamingSearch::Advance(double value) {
+    if (!IsStarted()) return {};
+    const double dropped = m_Query.front();
+    m_Query.erase(m_Query.begin());
+    m_Query.push_back(value);
+
+    std::shared_ptr<const StockLibrary> current = m_Engine.GetLibrary();
+    if (current != m_Library) {
+        std::cout << "AnalysisEngine: Library changed, streaming search starts over." << std::endl;
+        m_Library = current;
+        Plan();
+        return Run(Pass::Resync, 0.0, 0.0);
+    }
+    if (m_SinceResync + 1 >= kResyncInterval) return Run(Pass::Resync, 0.0, 0.0);
+    return Run(Pass::Slide, dropped, value);
+}
+
+int StreamingSearch::StepsTo(const std::vector<double>& query, bool useFred, int topK, int lookahead,
+                             const SearchOptions& options, int maxSteps) const {
+    if (!IsStarted() || query.size() != m_Query.size() || useFred != m_UseFred || topK != m_TopK ||
+        lookahead != m_Lookahead || !options.scaleFactors.empty() || options.minPearson != m_Options.minPearson ||
+        options.matchesPerStock != m_Options.matchesPerStock || options.exclusionZone != m_Options.exclusionZone) {
+        return -1;
+    }
+    // The last size - steps points of the session's query must start 'query'
+    const size_t m = query.size();
+    for (int steps = 0; steps <= maxSteps && static_cast<size_t>(steps) < m; ++steps) {
+        if (std::memcmp(m_Query.data() + steps, query.data(), (m - steps) * sizeof(double)) == 0) return steps;
+    }
+    return -1;
+}
+
+void StreamingSearch::Plan() {
+    m_Stocks.clear();
+    m_Seeds.clear();
+    m_StateById.clear();
+    if (!m_Library) return;
+    const size_t m = m_Query.size();
+    for (size_t i = 0; i < m_Library->stocks.size(); ++i) {
+        const CachedStock& stock = m_Library->stocks[i];
+        if (!m_UseFred && stock.isFred) continue;
+
+        StockState state;
+        state.index = i;
+        size_t windows = 0;
+        for (int level = 0; level < stock.LevelCount(); ++level) {
+            const int searchLimit = SearchLimit(stock, level, m, m_Lookahead);
+            if (searchLimit < 0) break;
+            state.levelStart.push_back(windows);
+            windows += static_cast<size_t>(searchLimit) + 1;
+        }
+        if (windows == 0) continue;
+        state.levelStart.push_back(windows);
+        state.dots.resize(windows);
+        m_StateById[stock.Id()] = m_Stocks.size();
+        m_Stocks.push_back(std::move(state));
+    }
+}
+
+double StreamingSearch::SeedThreshold() const {
+    const size_t m = m_Query.size();
+    std::vector<double> best; // Per seeded stock
+    size_t current = m_Stocks.size();
+    std::shared_ptr<const CachedStock> stock;
+    for (const Seed& seed : m_Seeds) {
+        const StockState& state = m_Stocks[seed.state];
+        if (seed.state != current) {
+            current = seed.state;
+            stock = AnalysisEngine::AcquireStock(m_Library, state.index);
+            if (stock) best.push_back(-1.0);
+        }
+        if (!stock) continue;
+        const int windows = static_cast<int>(state.levelStart[seed.level + 1] - state.levelStart[seed.level]);
+        const int offset = std::min(seed.offset + 1, windows - 1);
+        const double p = AnalysisEngine::CalculatePearson(m_Query.data(), stock->Level(seed.level).data() + offset, m);
+        best.back() = std::max(best.back(), p);
+    }
+    if (m_TopK <= 0 || best.size() < static_cast<size_t>(m_TopK)) return m_Options.minPearson;
+    std::nth_element(best.begin(), best.begin() + (m_TopK - 1), best.end(), std::greater<double>());
+    return std::max(m_Options.minPearson, best[m_TopK - 1]);
+}
+
+std::vector<SearchResult> StreamingSearch::Run(Pass pass, double dropped, double added) {
+    const size_t m = m_Query.size();
+    double queryMean = 0.0;
+    for (double v : m_Query) queryMean += v;
+    queryMean /= static_cast<double>(m);
+    PreparedQuery& prepared = m_Variants.prepared[0];
+    prepared.sumSq = 0.0;
+    for (size_t t = 0; t < m; ++t) {
+        prepared.centered[t] = m_Query[t] - queryMean;
+        prepared.sumSq += prepared.centered[t] * prepared.centered[t];
+    }
+    // A flat query (m equal closes) correlates at 0 with everything: the dot products still
+    // follow it, so the next update can slide them, but no window is scored
+    const bool flat = prepared.sumSq == 0.0;
+    std::vector<double> shifted;
+    if (pass == Pass::Resync) {
+        m_QueryShift = queryMean;
+        m_SinceResync = 0;
+        shifted.reserve(m);
+        for (double v : m_Query) shifted.push_back(v - m_QueryShift);
+    } else {
+        ++m_SinceResync;
+    }
+    // Mean of the query as the dot products see it
+    const double queryOffset = queryMean - m_QueryShift;
+    const double first = dropped - m_QueryShift;
+    const double last = added - m_QueryShift;
+    double shiftedSum = 0.0;
+    for (double v : shifted) shiftedSum += v;
+
+    SharedThreshold threshold(flat ? m_Options.minPearson : SeedThreshold());
+    const int exclusionZone = m_Options.exclusionZone >= 0 ? m_Options.exclusionZone : static_cast<int>(m);
+    const int threads = omp_get_max_threads();
+    std::vector<TopKHeap> threadHeaps(threads, TopKHeap(m_TopK));
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int s = 0; s < static_cast<int>(m_Stocks.size()); ++s) {
+        StockState& state = m_Stocks[s];
+        std::shared_ptr<const CachedStock> stock = AnalysisEngine::AcquireStock(m_Library, state.index);
+        if (!stock) continue;
+        const int tid = omp_get_thread_num();
+        MatchSet matches(m_Options.matchesPerStock, exclusionZone);
+
+        for (int level = 0; level + 1 < static_cast<int>(state.levelStart.size()); ++level) {
+            const SeriesView data = stock->Level(level);
+            const LevelStats stats = stock->Stats(level);
+            const double* x = data.data();
+            double* dots = state.dots.data() + state.levelStart[level];
+            const int windows = static_cast<int>(state.levelStart[level + 1] - state.levelStart[level]);
+
+            if (pass == Pass::Resync) {
+                // sum(q~ * (x - shift)) = sum(q~ * x) - shift * sum(q~)
+                for (int j = 0; j < windows; ++j) {
+                    dots[j] = SimdKernels::Dot(shifted.data(), x + j, m) - stats.shift * shiftedSum;
+                }
+            } else {
+                // Right to left, so dots[j - 1] is still the previous query's
+                for (int j = windows - 1; j > 0; --j) {
+                    dots[j] = dots[j - 1] - first * (x[j - 1] - stats.shift) + last * (x[j + m - 1] - stats.shift);
+                }
+                double dot = 0.0;
+                for (size_t t = 0; t < m; ++t) dot += (m_Query[t] - m_QueryShift) * (x[t] - stats.shift);
+                dots[0] = dot;
+            }
+            if (flat) continue;
+
+            // As Rolling: Pearson from the centered dot product, and every window that could still
+            // enter the match set rescored exactly. The centered dot product is
+            //   sum((q - mean_q) * (x - mean_x)) = dot - m * (mean_q - queryShift) * (mean_x - shift)
+            const int scale = 1 << level;
+            const double floor = threshold.Get() - kRescoreMargin;
+            const double floorSq = floor * floor * prepared.sumSq;
+            for (int j = 0; j < windows; ++j) {
+                double mean, ssx;
+                stats.Window(j, m, mean, ssx);
+                const double centered = dots[j] - static_cast<double>(m) * queryOffset * (mean - stats.shift);
+                // approx < floor without the square root while the bar is positive
+                if (floor > 0.0 && (centered <= 0.0 || centered * centered < floorSq * ssx)) continue;
+                const double approx = (ssx > 0.0) ? centered / std::sqrt(prepared.sumSq * ssx) : 0.0;
+                if (approx < floor) continue;
+                if (!matches.Admits(approx + kRescoreMargin, j, scale)) continue;
+
+                const double p = AnalysisEngine::CalculatePearson(m_Query.data(), x + j, m);
+                matches.Offer(p, j, scale);
+            }
+        }
+
+        for (const Match& match : matches.Matches()) {
+            if (match.pearson < m_Options.minPearson) continue;
+            SearchResult result = MakeResult(*stock, match, m_Variants);
+            result.stockPin = stock;
+            if (threadHeaps[tid].Push(result)) threshold.Publish(threadHeaps[tid].Kth());
+        }
+    }
+
+    std::vector<SearchResult> results = MergeTopK(threadHeaps, m_TopK);
+
+    // Seeds for the next update, grouped by stock
+    m_Seeds.clear();
+    for (const SearchResult& result : results) {
+        auto state = m_StateById.find(result.stockId);
+        if (state == m_StateById.end()) continue;
+        int level = 0;
+        while ((1 << level) < result.scale) ++level;
+        m_Seeds.push_back({ state->second, level, result.offset });
+    }
+    std::sort(m_Seeds.begin(), m_Seeds.end(), [](const Seed& a, const Seed& b) { return a.state < b.state; });
+    return results;
+}
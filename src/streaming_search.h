@@ -0,0 +1,76 @@
+#pragma once
+
+#include "analysis_engine.h"
+#include "search_common.h"
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Search session for a query that slides forward one point at a time, as the live query (the
+// last N closes) does with every new close. It keeps the dot product of the query with every
+// window it searches, and when the query gains a point qNew and loses its first one, q[0], each
+// one follows from its left neighbour's in O(1):
+//   dot'(j) = dot(j - 1) - q[0] * x[j - 1] + qNew * x[j + m - 1]
+// Windows that could make the results are still rescored with CalculatePearson, so an update
+// returns what Search (SearchMode::Rolling) would. The dot products are recomputed from scratch
+// every kResyncInterval updates, so rounding cannot build up, and when the library version changes.
+//
+// Pyramid levels only (options.scaleFactors and mode are ignored). Holds one double per searched
+// window, about 16 bytes per library data point. Not thread safe: one caller at a time.
+class StreamingSearch {
+public:
+    static constexpr int kResyncInterval = 64;
+
+    explicit StreamingSearch(AnalysisEngine& engine = AnalysisEngine::GetInstance());
+
+    // Searches 'query' from scratch and keeps the state to follow it
+    std::vector<SearchResult> Start(const std::vector<double>& query, bool useFred, int topK = 10, int lookahead = 100,
+                                    const SearchOptions& options = SearchOptions());
+    // Appends 'value' to the query and drops its first point, then searches again (empty before Start)
+    std::vector<SearchResult> Advance(double value);
+
+    // Advance calls (at most maxSteps) that turn the session's query into 'query' under the same
+    // arguments, 0 if it already is; -1 if the session cannot follow it there
+    int StepsTo(const std::vector<double>& query, bool useFred, int topK, int lookahead, const SearchOptions& options,
+                int maxSteps) const;
+
+    bool IsStarted() const { return !m_Query.empty(); }
+    const std::vector<double>& Query() const { return m_Query; }
+
+private:
+    struct StockState {
+        size_t index = 0;               // In the library's stocks
+        std::vector<size_t> levelStart; // Start of each searched level's windows in 'dots', plus an end marker
+        std::vector<double> dots;       // sum((q - m_QueryShift) * (x - levelShift)) per window
+    };
+
+    // A match of the last results, as a window to seed the next search's bar with
+    struct Seed {
+        size_t state; // In m_Stocks
+        int level;
+        int offset;
+    };
+
+    // Recomputes every dot product (Resync) or slides them (Slide), then scores every stock
+    enum class Pass { Resync, Slide };
+    std::vector<SearchResult> Run(Pass pass, double dropped, double added);
+    void Plan(); // m_Stocks for the current library and arguments
+    // Bar the next results are known to clear: the K-th best, over stocks, of the best Pearson of
+    // the new query with a window one point on from a last match (each stock keeps at least that)
+    double SeedThreshold() const;
+
+    AnalysisEngine& m_Engine;
+    std::shared_ptr<const StockLibrary> m_Library;
+    std::vector<double> m_Query;
+    bool m_UseFred = false;
+    int m_TopK = 0;
+    int m_Lookahead = 0;
+    SearchOptions m_Options; // mode forced to Rolling, no scaleFactors
+    QueryVariants m_Variants; // m_Query prepared once in Start; Run recenters it for every update
+    double m_QueryShift = 0.0; // Query mean at the last resync, subtracted to limit cancellation
+    int m_SinceResync = 0;
+    std::vector<StockState> m_Stocks;
+    std::unordered_map<uint32_t, size_t> m_StateById; // StockName id -> index in m_Stocks
+    std::vector<Seed> m_Seeds;
+};
@@ -0,0 +1,278 @@
+// Self-check: N matches per stock do not depend on the order windows are offered in or on how
+// a stock is cut into chunks. MatchSet against a sort-then-pick reference, then chunked Search
+// against unchunked SearchBatch with 3 matches per stock, then StreamingSearch against Search at
+// every step of a sliding query.
+
+#include "analysis_engine.h"
+#include "search_common.h"
+#include "streaming_search.h"
+#include "synthetic_library.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <omp.h>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+int g_Failures = 0;
+
+void Expect(bool ok, const std::string& what) {
+    if (ok) return;
+    std::printf("FAIL: %s\n", what.c_str());
+    ++g_Failures;
+}
+
+// Same matches in the same order, with bit-identical scores
+bool SameResults(const std::vector<SearchResult>& a, const std::vector<SearchResult>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].symbol != b[i].symbol || a[i].offset != b[i].offset || a[i].scale != b[i].scale ||
+            std::memcmp(&a[i].pearson, &b[i].pearson, sizeof(double)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SameMatches(std::vector<Match> a, std::vector<Match> b) {
+    auto byStart = [](const Match& x, const Match& y) {
+        if (x.offset * x.scale != y.offset * y.scale) return x.offset * x.scale < y.offset * y.scale;
+        return x.scale < y.scale;
+    };
+    std::sort(a.begin(), a.end(), byStart);
+    std::sort(b.begin(), b.end(), byStart);
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].pearson != b[i].pearson || a[i].offset != b[i].offset || a[i].scale != b[i].scale ||
+            a[i].variant != b[i].variant) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Sort every window by score, then take each one clear of those already taken
+std::vector<Match> Reference(std::vector<Match> windows, int capacity, int zone) {
+    std::sort(windows.begin(), windows.end(), [](const Match& a, const Match& b) {
+        if (a.pearson != b.pearson) return a.pearson > b.pearson;
+        if (a.scale != b.scale) return a.scale < b.scale;
+        if (a.variant != b.variant) return a.variant < b.variant;
+        return a.offset < b.offset;
+    });
+    std::vector<Match> picks;
+    for (const Match& w : windows) {
+        if (static_cast<int>(picks.size()) == capacity) break;
+        bool clear = true;
+        for (const Match& p : picks) {
+            const long long a = static_cast<long long>(p.offset) * p.scale;
+            const long long b = static_cast<long long>(w.offset) * w.scale;
+            if (a == b || std::llabs(a - b) < zone) clear = false;
+        }
+        if (clear) picks.push_back(w);
+    }
+    return picks;
+}
+
+// Offers 'windows' in chunks the way Search does: each chunk starts from a copy of the stock's
+// set and is merged back when done, in 'order'
+MatchSet Chunked(const std::vector<std::vector<Match>>& chunks, const std::vector<size_t>& order, int capacity, int zone) {
+    MatchSet stock(capacity, zone);
+    for (size_t c : order) {
+        MatchSet matches = stock;
+        for (const Match& w : chunks[c]) matches.Offer(w);
+        stock.Merge(matches);
+    }
+    return stock;
+}
+
+void CheckReviewCase() {
+    // Zone 60, two per stock: 0.95@50 blocks 0.90@0 and 0.90@100, which must not take 0.85@150 with it
+    const std::vector<Match> windows = { { 0.90, 0, 1, 0 }, { 0.95, 50, 1, 0 }, { 0.90, 100, 1, 0 }, { 0.85, 150, 1, 0 } };
+    const std::vector<Match> expected = { { 0.95, 50, 1, 0 }, { 0.85, 150, 1, 0 } };
+
+    MatchSet scan(2, 60);
+    for (const Match& w : windows) scan.Offer(w);
+    Expect(SameMatches(scan.Matches(), expected), "offset-order scan of the exclusion example");
+
+    const std::vector<std::vector<Match>> chunks = { { windows[0], windows[1] }, { windows[2], windows[3] } };
+    Expect(SameMatches(Chunked(chunks, { 0, 1 }, 2, 60).Matches(), expected), "chunks merged in order");
+    Expect(SameMatches(Chunked(chunks, { 1, 0 }, 2, 60).Matches(), expected), "chunks merged in reverse");
+}
+
+void CheckRandomOrders() {
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    int checked = 0;
+    for (int trial = 0; trial < 300; ++trial) {
+        const int capacity = 1 + trial % 4;
+        const int zone = 20 + static_cast<int>(rng() % 80);
+        const int count = 50 + static_cast<int>(rng() % 2000);
+
+        // Peaks with sloping neighbours, like correlation around a match, on two scales
+        std::vector<Match> windows;
+        for (int i = 0; i < count; ++i) {
+            const int scale = (i % 5 == 0) ? 2 : 1;
+            const int offset = static_cast<int>(rng() % 3000);
+            const double p = std::round((0.5 + 0.5 * std::fabs(std::sin(offset * 0.05)) * unit(rng)) * 1e4) / 1e4;
+            windows.push_back({ p, offset, scale, 0 });
+        }
+        const std::vector<Match> expected = Reference(windows, capacity, zone);
+
+        std::sort(windows.begin(), windows.end(), [](const Match& a, const Match& b) { return a.offset < b.offset; });
+        MatchSet scan(capacity, zone);
+        for (const Match& w : windows) scan.Offer(w);
+
+        std::shuffle(windows.begin(), windows.end(), rng);
+        MatchSet shuffled(capacity, zone);
+        for (const Match& w : windows) shuffled.Offer(w);
+
+        std::sort(windows.begin(), windows.end(), [](const Match& a, const Match& b) { return a.offset < b.offset; });
+        const size_t pieces = 2 + rng() % 8;
+        std::vector<std::vector<Match>> chunks(pieces);
+        for (size_t i = 0; i < windows.size(); ++i) chunks[i * pieces / windows.size()].push_back(windows[i]);
+        std::vector<size_t> order(pieces);
+        for (size_t c = 0; c < pieces; ++c) order[c] = c;
+        std::shuffle(order.begin(), order.end(), rng);
+
+        const std::string label = "trial " + std::to_string(trial) + " (N " + std::to_string(capacity) + ")";
+        Expect(SameMatches(scan.Matches(), expected), label + ": offset order");
+        Expect(SameMatches(shuffled.Matches(), expected), label + ": shuffled");
+        Expect(SameMatches(Chunked(chunks, order, capacity, zone).Matches(), expected), label + ": chunked");
+        ++checked;
+    }
+    std::printf("MatchSet: %d random window sets, offset order, shuffled and chunked\n", checked);
+}
+
+// Search cuts long stocks into chunks; SearchBatch scores each stock in one piece
+void CheckChunkedSearch() {
+    std::mt19937 rng(3);
+    std::vector<double> query = SyntheticLibrary::RandomWalk(200, rng, 0.02);
+    std::uniform_real_distribution<double> noise(0.3, 3.0);
+    std::vector<std::vector<double>> series;
+    for (int s = 0; s < 10; ++s) {
+        series.push_back(SyntheticLibrary::RandomWalk(12000 + 2000 * s, rng));
+        // Chains of query copies closer than the exclusion zone (the query length), so every
+        // chunk boundary cuts through windows that compete with each other
+        for (size_t at = 500; at + 400 < series.back().size(); at += 160) {
+            SyntheticLibrary::Plant(series.back(), at, query, 0.5 + 0.1 * s, noise(rng), rng);
+        }
+    }
+    const std::string root = SyntheticLibrary::Write("rel2_match_set_check", series);
+
+    AnalysisEngine& engine = AnalysisEngine::GetInstance();
+    engine.SetResultCacheSize(0);
+    Expect(engine.LoadLibrary(root) == series.size(), "synthetic library loads");
+
+    const SearchMode modes[] = { SearchMode::BruteForce, SearchMode::Rolling, SearchMode::Mass, SearchMode::Pruned };
+    const char* names[] = { "BruteForce", "Rolling", "Mass", "Pruned" };
+    std::vector<SearchResult> reference;
+    for (int k = 0; k < 4; ++k) {
+        SearchOptions options;
+        options.mode = modes[k];
+        options.matchesPerStock = 3;
+        options.minPearson = 0.0;
+        const std::vector<SearchResult> chunked = engine.Search(query, true, 40, 50, options);
+        const std::vector<SearchResult> whole = engine.SearchBatch({ query }, true, 40, 50, options)[0];
+        if (k == 0) reference = chunked;
+
+        std::printf("%-10s 3 per stock: %zu results, chunked vs unchunked %s, vs BruteForce %s\n", names[k],
+                    chunked.size(), SameResults(chunked, whole) ? "identical" : "DIFFERENT",
+                    SameResults(chunked, reference) ? "identical" : "DIFFERENT");
+        Expect(!chunked.empty(), std::string("results found, ") + names[k]);
+        Expect(SameResults(chunked, whole), std::string("chunked and unchunked results, ") + names[k]);
+        Expect(SameResults(chunked, reference), std::string("same results as BruteForce, ") + names[k]);
+    }
+    std::filesystem::remove_all(root);
+}
+
+// A live query slid one close at a time through StreamingSearch::Advance, against Search from
+// scratch at every step. The series opens and later pauses on m equal closes (a flat query, which
+// matches nothing but must still be followed), runs past a resync, and the library changes midway.
+void CheckStreamingSearch() {
+    const size_t m = 64;
+    std::mt19937 rng(5);
+    auto append = [](std::vector<double>& to, const std::vector<double>& walk) {
+        for (double v : walk) to.push_back(100.0 + 0.1 * v);
+    };
+    std::vector<double> live(m, 100.0); // Start on a flat query
+    append(live, SyntheticLibrary::RandomWalk(150, rng));
+    live.insert(live.end(), m + 6, 110.0); // Flat again for 7 steps
+    append(live, SyntheticLibrary::RandomWalk(40, rng));
+
+    // Stocks with noisy copies of stretches of the live series, so the results are real matches
+    std::vector<std::vector<double>> series;
+    std::uniform_real_distribution<double> noise(0.05, 1.0);
+    for (int s = 0; s < 8; ++s) {
+        series.push_back(SyntheticLibrary::RandomWalk(3000 + 500 * s, rng));
+        for (size_t at = 200; at + 2 * m < series.back().size(); at += 700) {
+            const size_t from = rng() % (live.size() - 2 * m);
+            const std::vector<double> stretch(live.begin() + from, live.begin() + from + 2 * m);
+            SyntheticLibrary::Plant(series.back(), at, stretch, 0.5 + 0.1 * s, noise(rng), rng);
+        }
+    }
+    const std::string name = "rel2_streaming_check";
+    const std::string root = SyntheticLibrary::Write(name, series);
+
+    AnalysisEngine engine; // One library per engine, and GetInstance() holds CheckChunkedSearch's
+    engine.SetResultCacheSize(0);
+    Expect(engine.LoadLibrary(root) == series.size(), "streaming library loads");
+
+    SearchOptions options;
+    options.mode = SearchMode::Rolling;
+    options.matchesPerStock = 2;
+    options.minPearson = 0.5;
+    const int topK = 15, lookahead = 50;
+    const size_t steps = live.size() - m;
+    const size_t changeAt = steps / 2; // Past the first resync
+
+    StreamingSearch stream(engine);
+    std::vector<double> query(live.begin(), live.begin() + m);
+    Expect(stream.Start(query, false, topK, lookahead, options).empty(), "a flat query matches nothing");
+    size_t mismatches = 0, results = 0, flatSteps = 0;
+    for (size_t step = 1; step <= steps; ++step) {
+        if (step == changeAt) {
+            // One stock gains a stretch with another copy of the query; the next Advance starts over
+            const std::vector<double> ahead(live.begin() + step, live.begin() + step + 2 * m);
+            const double last = series[3].back();
+            for (double v : SyntheticLibrary::RandomWalk(400, rng)) series[3].push_back(last + v);
+            SyntheticLibrary::Plant(series[3], series[3].size() - 300, ahead, 1.0, 0.2, rng);
+            SyntheticLibrary::Write(name, series);
+            Expect(engine.RefreshLibrary() > 0, "the refresh sees the changed stock");
+        }
+        query.assign(live.begin() + step, live.begin() + step + m);
+        const std::vector<SearchResult> streamed = stream.Advance(live[step + m - 1]);
+        const std::vector<SearchResult> expected = engine.Search(query, false, topK, lookahead, options);
+        if (!SameResults(streamed, expected)) {
+            std::printf("Streaming step %zu: %zu results, Search %zu\n", step, streamed.size(), expected.size());
+            ++mismatches;
+        }
+        if (std::all_of(query.begin(), query.end(), [&](double v) { return v == query[0]; })) ++flatSteps;
+        results += streamed.size();
+    }
+    std::printf("StreamingSearch: %zu steps (%zu on a flat query, library changed at %zu), %zu results, "
+                "%zu differ from Search\n", steps, flatSteps, changeAt, results, mismatches);
+    Expect(mismatches == 0, "streaming results equal Search at every step");
+    Expect(steps > static_cast<size_t>(StreamingSearch::kResyncInterval) && flatSteps > 0 && results > 0,
+           "the session resyncs, crosses a flat query and finds matches");
+    std::filesystem::remove_all(root);
+}
+
+} // namespace
+
+int main() {
+    // Enough threads that long stocks are cut into several chunks even on a small machine
+    omp_set_num_threads(std::max(4, omp_get_max_threads()));
+
+    CheckReviewCase();
+    CheckRandomOrders();
+    CheckChunkedSearch();
+    CheckStreamingSearch();
+
+    std::printf(g_Failures ? "FAILED (%d)\n" : "OK\n", g_Failures);
+    return g_Failures ? 1 : 0;
+}
@@ -0,0 +1,151 @@
+// Self-check: every vector ISA this machine supports against the scalar kernels (std::exp for
+// the decoder's exp pass).
+// Random lengths (tails that are not a multiple of the vector width included) and
+// unaligned starts; exits non-zero if any kernel falls outside its bound.
+
+#include "analysis_engine.h"
+#include "simd_kernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace {
+
+// Reordered summation error: each side is within size * eps * sum(|terms|) of the exact sum
+double SumBound(size_t size, double absSum) {
+    return 2.0 * static_cast<double>(size + 2) * std::ldexp(1.0, -53) * absSum + 1e-300;
+}
+
+struct Check {
+    const char* name;
+    double worst = 0.0; // Largest error seen, as a share of the bound
+    bool Record(double error, double bound) {
+        worst = std::max(worst, error / bound);
+        return error <= bound;
+    }
+};
+
+} // namespace
+
+int main() {
+    const SimdIsa best = SimdKernels::Detect();
+    std::printf("Detected %s\n", SimdKernels::Name(best));
+
+    std::mt19937 rng(20240501);
+    std::normal_distribution<double> noise(0.0, 1.0);
+    std::vector<size_t> lengths;
+    for (size_t n = 1; n <= 70; ++n) lengths.push_back(n);
+    for (int k = 0; k < 400; ++k) lengths.push_back(71 + rng() % 2000);
+
+    int failures = 0;
+    for (int isa = static_cast<int>(SimdIsa::Avx2); isa <= static_cast<int>(SimdIsa::Avx512); ++isa) {
+        if (isa > static_cast<int>(best)) {
+            std::printf("%s: not supported here, skipped\n", SimdKernels::Name(static_cast<SimdIsa>(isa)));
+            continue;
+        }
+        Check pearson{ "CalculatePearson" }, hyper{ "CalculateHyperspherical" }, dot{ "Dot" }, sums{ "Sums" },
+            centered{ "CenteredSums" }, norms{ "DotAndNorms" };
+
+        for (size_t t = 0; t < lengths.size(); ++t) {
+            const size_t n = lengths[t];
+            const size_t skew = t % 3; // Unaligned starts
+            std::vector<double> bufA(n + skew), bufB(n + skew);
+            const double offset = (t % 4) * 1000.0; // Prices far from zero stress the centering
+            for (size_t i = 0; i < n + skew; ++i) {
+                bufA[i] = offset + noise(rng);
+                bufB[i] = offset + 0.5 * (bufA[i] - offset) + noise(rng);
+            }
+            const double* a = bufA.data() + skew;
+            const double* b = bufB.data() + skew;
+
+            double absDot = 0.0, absA = 0.0, absB = 0.0, meanA = 0.0, meanB = 0.0;
+            for (size_t i = 0; i < n; ++i) {
+                absDot += std::fabs(a[i] * b[i]);
+                absA += std::fabs(a[i]);
+                absB += std::fabs(b[i]);
+                meanA += a[i];
+                meanB += b[i];
+            }
+            meanA /= static_cast<double>(n);
+            meanB /= static_cast<double>(n);
+            double absCross = 0.0, absSqA = 0.0, absSqB = 0.0;
+            for (size_t i = 0; i < n; ++i) {
+                absCross += std::fabs((a[i] - meanA) * (b[i] - meanB));
+                absSqA += (a[i] - meanA) * (a[i] - meanA);
+                absSqB += (b[i] - meanB) * (b[i] - meanB);
+            }
+
+            SimdKernels::SetActive(SimdIsa::Scalar);
+            const double p0 = AnalysisEngine::CalculatePearson(a, b, n);
+            const double h0 = AnalysisEngine::CalculateHyperspherical(a, b, n);
+            const double d0 = SimdKernels::Dot(a, b, n);
+            double sa0, sb0, c0, ca0, cb0, nd0, na0, nb0;
+            SimdKernels::Sums(a, b, n, sa0, sb0);
+            SimdKernels::CenteredSums(a, b, n, meanA, meanB, c0, ca0, cb0);
+            SimdKernels::DotAndNorms(a, b, n, nd0, na0, nb0);
+
+            SimdKernels::SetActive(static_cast<SimdIsa>(isa));
+            const double p = AnalysisEngine::CalculatePearson(a, b, n);
+            const double h = AnalysisEngine::CalculateHyperspherical(a, b, n);
+            const double d = SimdKernels::Dot(a, b, n);
+            double sa, sb, c, ca, cb, nd, na, nb;
+            SimdKernels::Sums(a, b, n, sa, sb);
+            SimdKernels::CenteredSums(a, b, n, meanA, meanB, c, ca, cb);
+            SimdKernels::DotAndNorms(a, b, n, nd, na, nb);
+
+            // The angle is acos of a cosine near 1 for prices, so it is compared as a cosine
+            bool ok = pearson.Record(std::fabs(p - p0), 1e-12) & hyper.Record(std::fabs(std::cos(h) - std::cos(h0)), 1e-12) &
+                      dot.Record(std::fabs(d - d0), SumBound(n, absDot)) &
+                      sums.Record(std::max(std::fabs(sa - sa0) / SumBound(n, absA), std::fabs(sb - sb0) / SumBound(n, absB)), 1.0) &
+                      centered.Record(std::max({ std::fabs(c - c0) / SumBound(n, absCross),
+                                                 std::fabs(ca - ca0) / SumBound(n, absSqA),
+                                                 std::fabs(cb - cb0) / SumBound(n, absSqB) }), 1.0) &
+                      norms.Record(std::max({ std::fabs(nd - nd0) / SumBound(n, absDot),
+                                              std::fabs(na - na0) / SumBound(n, na0),
+                                              std::fabs(nb - nb0) / SumBound(n, nb0) }), 1.0);
+            if (!ok) {
+                std::printf("%s: mismatch at length %zu\n", SimdKernels::Name(static_cast<SimdIsa>(isa)), n);
+                ++failures;
+            }
+        }
+
+        // The exp pass: T * (exp(x) - 1) carries eps * |T| * max(1, exp(x)) of rounding on either path
+        Check exp{ "ExpMinusOneScaled" };
+        for (size_t t = 0; t < lengths.size(); ++t) {
+            const size_t n = lengths[t];
+            const double scale = (t % 2) ? 1000.0 : -250.0;
+            std::uniform_real_distribution<double> logReturn(-3.0, 3.0);
+            std::vector<double> x(n);
+            for (double& v : x) v = logReturn(rng);
+            std::vector<double> reference = x;
+            SimdKernels::SetActive(SimdIsa::Scalar);
+            SimdKernels::ExpMinusOneScaled(reference.data(), n, scale);
+            SimdKernels::SetActive(static_cast<SimdIsa>(isa));
+            SimdKernels::ExpMinusOneScaled(x.data(), n, scale);
+
+            bool ok = true;
+            for (size_t i = 0; i < n; ++i) {
+                const double e = std::max(1.0, reference[i] / scale + 1.0);
+                ok &= exp.Record(std::fabs(x[i] - reference[i]), 2.0 * std::ldexp(1.0, -52) * std::fabs(scale) * e);
+            }
+            if (!ok) {
+                std::printf("%s: exp mismatch at length %zu\n", SimdKernels::Name(static_cast<SimdIsa>(isa)), n);
+                ++failures;
+            }
+        }
+
+        std::printf("%s vs Scalar over %zu lengths:\n", SimdKernels::Name(static_cast<SimdIsa>(isa)), lengths.size());
+        std::printf("  %-24s max |diff| %.3g (limit 1e-12)\n", pearson.name, pearson.worst * 1e-12);
+        std::printf("  %-24s max |diff| of the cosine %.3g (limit 1e-12)\n", hyper.name, hyper.worst * 1e-12);
+        for (const Check* check : { &dot, &sums, &centered, &norms }) {
+            std::printf("  %-24s max error %.3g of the summation bound\n", check->name, check->worst);
+        }
+        std::printf("  %-24s max error %.3g of 2 eps*|T|*max(1, exp(x))\n", exp.name, exp.worst);
+    }
+
+    SimdKernels::SetActive(best);
+    std::printf(failures ? "FAILED (%d)\n" : "OK\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+// Synthetic .dsp libraries for the self-checks and benchmarks: random-walk investment series
+// written with DspWriter under the system temp directory.
+
+#include "dsp_writer.h"
+#include <cmath>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace SyntheticLibrary {
+
+constexpr double kInvestment = 1000.0;
+
+// Investment value of a log-return random walk, as DspReader returns it
+inline std::vector<double> RandomWalk(size_t n, std::mt19937& rng, double step = 0.01) {
+    std::normal_distribution<double> noise(0.0, step);
+    std::vector<double> values(n);
+    double y = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+        y += noise(rng);
+        values[i] = kInvestment * std::expm1(y);
+    }
+    return values;
+}
+
+// Writes pattern * scale + level + noise over series[offset...], a match for 'pattern'
+inline void Plant(std::vector<double>& series, size_t offset, const std::vector<double>& pattern, double scale,
+                  double noise, std::mt19937& rng) {
+    std::normal_distribution<double> jitter(0.0, noise);
+    const double level = series[offset];
+    for (size_t k = 0; k < pattern.size() && offset + k < series.size(); ++k) {
+        series[offset + k] = level + scale * (pattern[k] - pattern[0]) + jitter(rng);
+    }
+}
+
+// Replaces <temp>/<name> with one .dsp per series (format 'version') and returns its path
+inline std::string Write(const std::string& name, const std::vector<std::vector<double>>& series, int version = 2) {
+    namespace fs = std::filesystem;
+    const fs::path root = fs::temp_directory_path() / name;
+    fs::remove_all(root);
+    for (size_t s = 0; s < series.size(); ++s) {
+        const std::string symbol = "SYN" + std::to_string(s);
+        fs::create_directories(root / symbol);
+
+        DspData data;
+        data.values = series[s];
+        data.total_investment = kInvestment;
+        data.smooth_value = 1;
+        data.n = series[s].size();
+        DspWriteOptions options;
+        options.version = version;
+        options.level = 3;
+        DspWriter::Save((root / symbol / (symbol + "20(S1).dsp")).string(), data, options);
+    }
+    return root.string();
+}
+
+} // namespace SyntheticLibrary